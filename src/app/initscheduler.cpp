@@ -0,0 +1,117 @@
+#include "initscheduler.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+InitScheduler::InitScheduler(PhaseTimer *timings) {
+    this->timings = timings;
+}
+
+InitTaskId InitScheduler::Add(const char *name, std::function<void()> task, std::vector<InitTaskId> dependencies, bool background) {
+    InitTaskId id = static_cast<InitTaskId>(tasks.size());
+    for (InitTaskId dependency: dependencies) {
+        if (dependency >= id)
+            throw std::runtime_error("init task depends on a task added after it");
+    }
+    tasks.push_back({name, std::move(task), std::move(dependencies), background});
+    return id;
+}
+
+// Returns once every task finished. If one throws nothing new is started, the ones running are waited for and the
+// first exception is rethrown.
+void InitScheduler::Run() {
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::vector<std::thread> workers;
+    std::exception_ptr failure;
+    size_t remaining = tasks.size();
+    size_t running = 0;
+
+    // Background tasks are started by whoever finished their last dependency, so a worker chain doesn't have to wait
+    // for the main thread to come back from a long task. Everything below runs with the lock held.
+    std::function<void(Task&)> startWorker;
+    auto launchReady = [&]() {
+        if (failure)
+            return;
+        for (Task &task: tasks) {
+            if (task.background && !task.started && ready(task))
+                startWorker(task);
+        }
+    };
+    auto complete = [&](Task &task, std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        task.done = true;
+        remaining--;
+        running--;
+        if (error && !failure)
+            failure = error;
+        launchReady();
+        finished.notify_all();
+    };
+    startWorker = [&](Task &task) {
+        task.started = true;
+        running++;
+        workers.emplace_back([this, &task, &complete]() {
+            std::exception_ptr error;
+            try {
+                runTask(task);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            complete(task, error);
+        });
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    launchReady();
+    while (remaining > 0 && !(failure && running == 0)) {
+        Task *mainTask = nullptr;
+        for (Task &task: tasks) {
+            if (!failure && !task.background && !task.started && ready(task)) {
+                mainTask = &task;
+                break;
+            }
+        }
+        if (!mainTask) {
+            finished.wait(lock);
+            continue;
+        }
+
+        mainTask->started = true;
+        running++;
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            runTask(*mainTask);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        complete(*mainTask, error);
+        lock.lock();
+    }
+    lock.unlock();
+
+    // Nothing can be started anymore, so the list doesn't change while joining
+    for (std::thread &worker: workers)
+        worker.join();
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+// Only called with the lock held, done is written under it
+bool InitScheduler::ready(const Task &task) {
+    for (InitTaskId dependency: task.dependencies) {
+        if (!tasks[dependency].done)
+            return false;
+    }
+    return true;
+}
+
+void InitScheduler::runTask(Task &task) {
+    if (timings)
+        timings->Run(task.name.c_str(), task.run);
+    else
+        task.run();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+#include "profiler/phasetimer.h"
+
+typedef uint32_t InitTaskId;
+
+// Runs startup steps as a dependency graph, so independent ones (window system vs Vulkan loader and ICDs) overlap.
+// Tasks run on the thread that calls Run unless marked background, then they go to a worker thread. Anything touching
+// GLFW must stay on the calling thread (the main thread), so never mark those background.
+// Dependencies have to be added before the tasks that need them, so there can't be cycles.
+class InitScheduler {
+    private:
+    struct Task {
+        std::string name;
+        std::function<void()> run;
+        std::vector<InitTaskId> dependencies;
+        bool background = false;
+        bool started = false;
+        bool done = false;
+    };
+
+    std::vector<Task> tasks;
+    PhaseTimer *timings;
+
+    public:
+    InitScheduler(PhaseTimer *timings = nullptr);
+
+    InitTaskId Add(const char *name, std::function<void()> task, std::vector<InitTaskId> dependencies = {}, bool background = false);
+    void Run();
+
+    private:
+    bool ready(const Task &task);
+    void runTask(Task &task);
+};
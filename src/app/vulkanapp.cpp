@@ -0,0 +1,595 @@
+#include "vulkanapp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "vulkan/physicaldevice.h"
+#include "vulkan/instancecapabilities.h"
+#include "profiler/cpuprofiler.h"
+#include "initscheduler.h"
+
+using namespace std;
+
+const uint32_t WIDTH = 800;
+const uint32_t HEIGHT = 600;
+const char *PIPELINE_CACHE_PATH = "pipeline.cache";
+const uint32_t FRAMES_IN_FLIGHT = 2;
+const PresentPolicy PRESENT_POLICY = PresentPolicy::LowLatency;
+const char *TRACE_PATH = "trace.json";
+const char *SHADER_CACHE_PATH = "shadercache";
+#ifdef NDEBUG
+    const bool enableValidationLayers = false;
+#else
+    const bool enableValidationLayers = true;
+#endif
+
+VulkanApp::VulkanApp(AppOptions options) {
+    this->options = options;
+}
+
+void VulkanApp::run() {
+    runStart = TraceWriter::NowUs();
+    initialize();
+    mainLoop();
+    timed("cleanup", &VulkanApp::cleanup);
+
+    cout << "Startup and shutdown phases:" << endl;
+    timings.Print();
+    if (!options.timingsPath.empty())
+        timings.WriteJson(options.timingsPath);
+}
+
+PhaseTimer& VulkanApp::Timings() {
+    return timings;
+}
+
+void VulkanApp::timed(const char *name, void (VulkanApp::*step)()) {
+    timings.Run(name, [this, step]() { (this->*step)(); });
+}
+
+void VulkanApp::createWindow() {
+    window = new Window(WIDTH, HEIGHT, "Finestra");
+}
+
+// The window system and the Vulkan loader don't know about each other until the surface is created, so loader and
+// ICD discovery plus instance creation run on a worker while GLFW connects to the display on the main thread.
+void VulkanApp::initialize() {
+    CpuProfiler::Start(&trace);
+    PROFILE_THREAD("Main");
+    InitScheduler scheduler(&timings);
+    bool background = !options.serialInit;
+    auto step = [&](const char *name, void (VulkanApp::*method)(), std::vector<InitTaskId> dependencies, bool onWorker) {
+        return scheduler.Add(name, [this, method]() { (this->*method)(); }, std::move(dependencies), onWorker);
+    };
+
+    InitTaskId vulkan = scheduler.Add("loadVulkan", VulkanLoader::Initialize, {}, background);
+    vulkan = step("printSupportedExtensions", &VulkanApp::printSupportedExtensions, {vulkan}, background);
+    if (enableValidationLayers)
+        vulkan = step("printSupportedLayers", &VulkanApp::printSupportedLayers, {vulkan}, background);
+    vulkan = step("createInstance", &VulkanApp::createInstance, {vulkan}, background);
+    vulkan = step("setupDebugMessenger", &VulkanApp::setupDebugMessenger, {vulkan}, background);
+
+    // GLFW wants its main thread
+    InitTaskId last = vulkan;
+    if (!options.headless) {
+        InitTaskId glfw = scheduler.Add("glfwInit", Window::Init, {}, false);
+        InitTaskId window = step("glfwCreateWindow", &VulkanApp::createWindow, {glfw}, false);
+        last = step("createSurface", &VulkanApp::createSurface, {vulkan, window}, false);
+    }
+
+    // Everything else needs the one before it
+    last = step("createPhysicalDevice", &VulkanApp::createPhysicalDevice, {last}, false);
+    last = step("createLogicalDevice", &VulkanApp::createLogicalDevice, {last}, false);
+    last = step("createAllocator", &VulkanApp::createAllocator, {last}, false);
+    last = step("createPipelineCache", &VulkanApp::createPipelineCache, {last}, false);
+    last = step("createShaderCache", &VulkanApp::createShaderCache, {last}, false);
+    last = step("createComputePipeline", &VulkanApp::createComputePipeline, {last}, false);
+    last = step("createFrameRing", &VulkanApp::createFrameRing, {last}, false);
+    if (options.headless) {
+        last = step("createOffscreenTarget", &VulkanApp::createOffscreenTarget, {last}, false);
+        last = step("createFramebuffers", &VulkanApp::createFramebuffers, {last}, false);
+    } else
+        last = step("createSwapchain", &VulkanApp::createSwapchain, {last}, false);
+    last = step("createProfiler", &VulkanApp::createProfiler, {last}, false);
+    step("createRenderGraph", &VulkanApp::createRenderGraph, {last}, false);
+
+    double start = TraceWriter::NowUs();
+    scheduler.Run();
+    timings.Record("initialize", start, TraceWriter::NowUs());
+}
+
+void VulkanApp::mainLoop() {
+    if (options.headless) {
+        headlessLoop();
+        return;
+    }
+
+    // Startup isn't over until the first frame went out
+    double loopStart = TraceWriter::NowUs();
+    uint32_t presented = 0;
+    while(!window->ShouldClose() && (options.frames == 0 || presented < options.frames)) {
+        PROFILE_FRAME();
+        {
+            PROFILE_ZONE("PollEvents");
+            window->PollEvents();
+        }
+
+        // Nothing to present to while minimized
+        VkExtent2D extent = window->FramebufferExtent();
+        if (extent.width == 0 || extent.height == 0) {
+            window->WaitEvents();
+            continue;
+        }
+
+        FrameContext &frame = frameRing->BeginFrame();
+        gpuProfiler->AddCpuTimes(frameRing->LastTimings().cpuFrameMs, frameRing->LastTimings().cpuWaitMs);
+        gpuProfiler->BeginFrame(frame.commandBuffer, frame.index);
+        swapchain->ReleaseRetired();
+        if (window->ConsumeResized())
+            swapchain->Recreate(extent);
+
+        uint32_t imageIndex;
+        if (!swapchain->Acquire(frame.imageAvailable, imageIndex)) {
+            // The frame still has to be submitted so its fence gets signalled
+            frameRing->EndFrame();
+            swapchain->Submitted(frame.inFlight);
+            swapchain->Recreate(extent);
+            continue;
+        }
+
+        {
+            PROFILE_ZONE("Record");
+            GpuScope frameScope(*gpuProfiler, frame.commandBuffer, "Frame");
+            renderGraph->SetImportedImage(backbuffer, swapchain->Image(imageIndex), swapchain->ImageView(imageIndex), swapchain->Extent());
+            renderGraph->Execute(frame.commandBuffer);
+        }
+        frameRing->EndFrame(frame.imageAvailable, VK_PIPELINE_STAGE_TRANSFER_BIT, swapchain->RenderFinished(imageIndex));
+        swapchain->Submitted(frame.inFlight);
+        if (!swapchain->Present(imageIndex))
+            swapchain->Recreate(extent);
+        if (presented++ == 0) {
+            timings.Record("firstFrame", loopStart, TraceWriter::NowUs());
+            timings.Record("startup", runStart, TraceWriter::NowUs());
+        }
+    }
+    frameRing->WaitIdle();
+}
+
+void VulkanApp::headlessLoop() {
+    uint32_t frames = options.frames ? options.frames : HEADLESS_DEFAULT_FRAMES;
+    uint32_t lastIndex = 0;
+    auto start = chrono::steady_clock::now();
+    double loopStart = TraceWriter::NowUs();
+    for (uint32_t i = 0; i < frames; i++) {
+        PROFILE_FRAME();
+        FrameContext &frame = frameRing->BeginFrame();
+        gpuProfiler->AddCpuTimes(frameRing->LastTimings().cpuFrameMs, frameRing->LastTimings().cpuWaitMs);
+        gpuProfiler->BeginFrame(frame.commandBuffer, frame.index);
+        {
+            GpuScope frameScope(*gpuProfiler, frame.commandBuffer, "Frame");
+            renderGraph->SetImportedImage(backbuffer, offscreenTarget->Image(frame.index), offscreenTarget->ImageView(frame.index), offscreenTarget->Extent());
+            if (!options.readbackPath.empty())
+                renderGraph->SetImportedBuffer(readbackBuffer, offscreenTarget->ReadbackBuffer(frame.index));
+            renderGraph->Execute(frame.commandBuffer);
+        }
+        frameRing->EndFrame();
+        lastIndex = frame.index;
+        if (i == 0) {
+            timings.Record("firstFrame", loopStart, TraceWriter::NowUs());
+            timings.Record("startup", runStart, TraceWriter::NowUs());
+        }
+    }
+    frameRing->WaitIdle();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << frames << " headless frames in " << seconds * 1000.0 << "ms (" << frames / seconds << " fps)" << endl;
+    if (!options.readbackPath.empty())
+        offscreenTarget->WritePPM(lastIndex, options.readbackPath);
+}
+
+// Barriers and layout transitions come from the render graph, the image is in TRANSFER_DST_OPTIMAL here
+void VulkanApp::recordClear(VkCommandBuffer commandBuffer, VkImage image) {
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.levelCount = 1;
+    range.layerCount = 1;
+
+    VkClearColorValue color = {{0.1f, 0.1f, 0.2f, 1.0f}};
+    vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+}
+
+// Clears through the render pass's load op, so with a device group each GPU only touches its own render area. The
+// render graph has already moved the image to COLOR_ATTACHMENT_OPTIMAL.
+void VulkanApp::recordRenderPass(VkCommandBuffer commandBuffer, uint32_t index) {
+    VkRect2D area = {{0, 0}, offscreenTarget->Extent()};
+    VkClearValue clear{};
+    clear.color = {{0.1f, 0.1f, 0.2f, 1.0f}};
+    VkRenderPassBeginInfo passInfo{};
+    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    passInfo.renderPass = renderPass;
+    passInfo.framebuffer = framebuffers[index];
+    passInfo.renderArea = area;
+    passInfo.clearValueCount = 1;
+    passInfo.pClearValues = &clear;
+    // Lives until vkCmdBeginRenderPass, split frame gives every device its band
+    DeviceGroup::RenderPassInfo groupInfo;
+    if (deviceGroup) {
+        groupInfo = deviceGroup->RenderPassBegin(frameRing->Current().deviceMask, area);
+        passInfo.pNext = groupInfo.Next();
+    }
+    vkCmdBeginRenderPass(commandBuffer, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdEndRenderPass(commandBuffer);
+}
+
+void VulkanApp::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
+    if (!debugSink)
+        debugSink = new DebugSink();
+    debugSink->Populate(createInfo);
+}
+
+void VulkanApp::setupDebugMessenger() {
+    if (!enableValidationLayers)
+        return;
+
+    VkDebugUtilsMessengerCreateInfoEXT createInfo;
+    populateDebugMessengerCreateInfo(createInfo);
+    if (!vkCreateDebugUtilsMessengerEXT || vkCreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS) {
+        throw std::runtime_error("error creating debug messenger");
+    }
+}
+
+void VulkanApp::createInstance() {
+    // Ask for the newest version both we and the loader know about, devices may still expose less
+    instanceApiVersion = std::min<uint32_t>(InstanceCapabilities::Get().ApiVersion(), VK_API_VERSION_1_3);
+
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.apiVersion = instanceApiVersion;
+    appInfo.pApplicationName = "G's Vulkan Test";
+    appInfo.applicationVersion = 0;
+
+    VkInstanceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
+
+    // Vulkan has no concept of window et al, so it need extensions to interact with it. GLFW could tell which ones, but
+    // this runs before glfwInit is done, so every supported platform surface is enabled and createSurface checks it
+    instanceExtensions.clear();
+    if (!options.headless) {
+        const char *surfaceExtensions[] = {
+            "VK_KHR_surface", "VK_KHR_xlib_surface", "VK_KHR_xcb_surface", "VK_KHR_wayland_surface",
+            "VK_KHR_win32_surface", "VK_EXT_metal_surface", "VK_MVK_macos_surface"
+        };
+        for (const char *extension: surfaceExtensions) {
+            if (supportsVkExtension(extension))
+                instanceExtensions.push_back(extension);
+        }
+        // Optional, lets the device use present fences for retired swapchains (see Swapchain)
+        if (supportsVkExtension(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME) && supportsVkExtension(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME)) {
+            instanceExtensions.push_back(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
+            instanceExtensions.push_back(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME);
+        }
+    }
+    if (enableValidationLayers)
+        instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size());
+    createInfo.ppEnabledExtensionNames = instanceExtensions.data();
+    createInfo.enabledLayerCount = 0;
+
+    std::vector<const char*> validationLayerNames = {
+        "VK_LAYER_KHRONOS_validation"
+    };
+    VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
+    if (enableValidationLayers) {
+    
+        bool allLayersSupported = true;
+        cout << validationLayerNames.size() << " validation layers required" << endl;
+        for (auto layer: validationLayerNames) {
+            bool supported = supportsVkLayer(layer);
+            cout << "- " << layer;
+            if (supported) {
+                cout << " (Supported)" << endl;
+            } else {
+                cout << " (NOT supported)" << endl;
+                allLayersSupported = false;
+            }
+        }
+
+        if (!allLayersSupported) {
+            throw std::runtime_error("error initializing validation layers: required extension not supported");
+        }
+        
+        createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayerNames.size());
+        createInfo.ppEnabledLayerNames = validationLayerNames.data();
+        
+        populateDebugMessengerCreateInfo(debugCreateInfo);
+        createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
+        cout << "Validation layers enabled" << endl;
+    }
+
+    bool allExtSupported = true;
+    cout << instanceExtensions.size() << " extensions required:" << endl;
+    for (const char *extension: instanceExtensions) {
+        bool supported = supportsVkExtension(extension);
+        cout << "- " << extension;
+        if (supported) {
+            cout << " (Supported)" << endl;
+        } else {
+            cout << " (NOT supported)" << endl;
+            allExtSupported = false;
+        }
+    }
+
+    if (!allExtSupported) {
+        throw std::runtime_error("unsupported Vulkan extension/s");
+    }
+
+    VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("error creating instance");
+    }
+    VulkanLoader::LoadInstance(instance);
+}
+
+void VulkanApp::createPhysicalDevice() {
+    PhysicalDeviceBuilder pdBuilder(instance);
+    if (!options.headless)
+        pdBuilder.RequirePresent(surface);
+    if (options.groupMode != GroupRenderMode::Single) {
+        physicalGroup = pdBuilder.BuildGroup();
+        physicalDevice = physicalGroup.devices[0];
+    } else {
+        physicalDevice = pdBuilder.Build();
+    }
+}
+
+void VulkanApp::createLogicalDevice() {
+    LogicalDeviceBuilder ldBuilder(physicalDevice, instanceApiVersion);
+    if (!options.headless) {
+        ldBuilder.RequireExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        auto surfaceMaintenance = find_if(instanceExtensions.begin(), instanceExtensions.end(), [](const char *name) { return strcmp(name, VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME) == 0; });
+        if (surfaceMaintenance != instanceExtensions.end())
+            ldBuilder.AllowSwapchainMaintenance();
+    }
+    if (!physicalGroup.devices.empty())
+        ldBuilder.SetDeviceGroup(physicalGroup);
+    device = ldBuilder.Build();
+
+    QueueFamilyIndices &queueFamilies = device.queueFamilies;
+    cout << "Queue families: graphics " << queueFamilies.graphicsFamily.value()
+         << ", compute " << queueFamilies.computeFamily.value() << (queueFamilies.hasDedicatedCompute() ? " (dedicated)" : "")
+         << ", transfer " << queueFamilies.transferFamily.value() << (queueFamilies.hasDedicatedTransfer() ? " (dedicated)" : "") << endl;
+}
+
+void VulkanApp::createAllocator() {
+    allocator = new MemoryAllocator(device);
+    if (device.features.timelineSemaphore)
+        stagingRing = new StagingRing(device, *allocator);
+    else
+        cout << "No timeline semaphores, staging uploads disabled" << endl;
+}
+
+void VulkanApp::createPipelineCache() {
+    pipelineCache = new PipelineCache(device.device, physicalDevice, PIPELINE_CACHE_PATH);
+}
+
+// Starts compiling right away, the pipeline step only waits for what's left of it
+void VulkanApp::createShaderCache() {
+    shaderCache = new ShaderCache(device.device, SHADER_CACHE_PATH);
+    ShaderSource source;
+    source.path = string(CPPTESTS_SHADER_DIR) + "/saxpy.comp";
+    saxpySpirv = shaderCache->Compile(source);
+}
+
+// Goes through both on disk caches, so a cold start pays for the shader compile and the driver's pipeline compile and
+// a warm one doesn't. Without glslc the app still runs, just without the pipeline.
+void VulkanApp::createComputePipeline() {
+    try {
+        saxpyKernel = new ComputeKernel(device, saxpySpirv.get(), {64, 0, 0}, pipelineCache->Get());
+    } catch (std::exception &e) {
+        cout << "No compute pipeline: " << e.what() << endl;
+    }
+}
+
+void VulkanApp::createSurface() {
+    uint32_t glfwExtensionCount = 0;
+    const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    for (uint32_t i = 0; i < glfwExtensionCount; i++) {
+        auto enabled = find_if(instanceExtensions.begin(), instanceExtensions.end(), [&](const char *name) { return strcmp(name, glfwExtensions[i]) == 0; });
+        if (enabled == instanceExtensions.end())
+            throw std::runtime_error(string("instance is missing extension ") + glfwExtensions[i] + " needed by glfw");
+    }
+    surface = window->CreateSurface(instance);
+}
+
+void VulkanApp::createSwapchain() {
+    // The backbuffer is cleared with vkCmdClearColorImage, a transfer
+    swapchain = new Swapchain(device, surface, window->FramebufferExtent(), PRESENT_POLICY, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+}
+
+void VulkanApp::createOffscreenTarget() {
+    offscreenTarget = new OffscreenTarget(device, *allocator, {WIDTH, HEIGHT}, FRAMES_IN_FLIGHT);
+}
+
+// The render graph owns the layout transitions and barriers around the pass, so the attachment starts and ends in
+// COLOR_ATTACHMENT_OPTIMAL and needs no external dependencies
+void VulkanApp::createFramebuffers() {
+    VkAttachmentDescription attachment{};
+    attachment.format = offscreenTarget->Format();
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference colorReference{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &attachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    if (vkCreateRenderPass(device.device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+        throw std::runtime_error("error creating render pass");
+    }
+
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        VkImageView view = offscreenTarget->ImageView(i);
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &view;
+        framebufferInfo.width = offscreenTarget->Extent().width;
+        framebufferInfo.height = offscreenTarget->Extent().height;
+        framebufferInfo.layers = 1;
+        VkFramebuffer framebuffer;
+        if (vkCreateFramebuffer(device.device, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+            throw std::runtime_error("error creating framebuffer");
+        }
+        framebuffers.push_back(framebuffer);
+    }
+}
+
+void VulkanApp::createFrameRing() {
+    frameRing = new FrameRing(device, *allocator, FRAMES_IN_FLIGHT);
+    if (options.groupMode != GroupRenderMode::Single) {
+        deviceGroup = new DeviceGroup(device, options.groupMode);
+        frameRing->SetDeviceGroup(deviceGroup);
+    }
+}
+
+void VulkanApp::createProfiler() {
+    gpuProfiler = new GpuProfiler(device, FRAMES_IN_FLIGHT, &trace);
+}
+
+void VulkanApp::createRenderGraph() {
+    renderGraph = new RenderGraph(device, *allocator);
+    renderGraph->SetProfiler(gpuProfiler);
+
+    // Acquired images come in undefined, after the acquire semaphore wait at the transfer stage (see EndFrame).
+    // Offscreen images are simply overwritten every frame.
+    GraphImageDesc backbufferDesc;
+    ImportedState backbufferState;
+    backbufferState.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (options.headless) {
+        backbufferDesc.format = offscreenTarget->Format();
+        backbufferDesc.extent = offscreenTarget->Extent();
+    } else {
+        backbufferDesc.format = swapchain->Format();
+        backbufferDesc.extent = swapchain->Extent();
+        backbufferState.initialStages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        backbufferState.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        backbufferState.finalStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    }
+    backbuffer = renderGraph->ImportImage("Backbuffer", backbufferDesc, backbufferState);
+
+    // The swapchain images have no framebuffers, so with a window the frame is a transfer clear
+    if (options.headless) {
+        renderGraph->AddPass("Clear")
+            .Write(backbuffer, ResourceUsage::ColorAttachment())
+            .Execute([this](VkCommandBuffer commandBuffer, RenderGraph &) {
+                recordRenderPass(commandBuffer, frameRing->Current().index);
+            });
+    } else {
+        renderGraph->AddPass("Clear")
+            .Write(backbuffer, ResourceUsage::TransferWrite())
+            .Execute([this](VkCommandBuffer commandBuffer, RenderGraph &graph) {
+                recordClear(commandBuffer, graph.Image(backbuffer));
+            });
+    }
+
+    if (options.headless && !options.readbackPath.empty()) {
+        // The host reads it after the frame's fence, which alone doesn't make the copy visible to the host
+        GraphBufferDesc readbackDesc;
+        readbackDesc.size = offscreenTarget->ReadbackSize();
+        ImportedState readbackState;
+        readbackState.finalStages = VK_PIPELINE_STAGE_HOST_BIT;
+        readbackState.finalAccess = VK_ACCESS_HOST_READ_BIT;
+        readbackBuffer = renderGraph->ImportBuffer("Readback", readbackDesc, readbackState);
+
+        renderGraph->AddPass("Readback")
+            .Read(backbuffer, ResourceUsage::TransferRead())
+            .Write(readbackBuffer, ResourceUsage::TransferWrite())
+            .Execute([this](VkCommandBuffer commandBuffer, RenderGraph &graph) {
+                uint32_t index = frameRing->Current().index;
+                if (!deviceGroup || deviceGroup->Mode() != GroupRenderMode::SplitFrame) {
+                    offscreenTarget->RecordReadback(commandBuffer, index);
+                    return;
+                }
+                // Each GPU only rendered its own band of the frame, they meet in the host visible buffer
+                std::vector<VkRect2D> bands = deviceGroup->SplitAreas({{0, 0}, offscreenTarget->Extent()});
+                for (uint32_t i = 0; i < bands.size(); i++) {
+                    deviceGroup->SetDeviceMask(commandBuffer, 1u << i);
+                    offscreenTarget->RecordReadback(commandBuffer, index, bands[i]);
+                }
+                deviceGroup->SetDeviceMask(commandBuffer, frameRing->Current().deviceMask);
+            });
+    }
+    renderGraph->Compile();
+}
+
+void VulkanApp::cleanup() {
+    delete renderGraph;
+    for (VkFramebuffer framebuffer: framebuffers)
+        vkDestroyFramebuffer(device.device, framebuffer, nullptr);
+    if (renderPass != VK_NULL_HANDLE)
+        vkDestroyRenderPass(device.device, renderPass, nullptr);
+    delete gpuProfiler;
+    CpuProfiler::Stop();
+    trace.Write(TRACE_PATH);
+    delete swapchain;
+    delete offscreenTarget;
+    delete frameRing;
+    delete deviceGroup;
+    delete saxpyKernel;
+    delete shaderCache;
+    pipelineCache->Save();
+    delete pipelineCache;
+    delete stagingRing;
+    allocator->PrintStats();
+    delete allocator;
+    vkDestroyDevice(device.device, nullptr);
+    if (surface != VK_NULL_HANDLE)
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (debugMessenger != VK_NULL_HANDLE)
+        vkDestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+    vkDestroyInstance(instance, nullptr);
+    // After the instance, its destruction can still report through the sink
+    delete debugSink;
+    delete window;
+}
+
+bool VulkanApp::supportsVkExtension(const char *name) {
+    return InstanceCapabilities::Get().SupportsExtension(name);
+}
+
+bool VulkanApp::supportsVkLayer(const char *name) {
+    return InstanceCapabilities::Get().SupportsLayer(name);
+}
+
+void VulkanApp::printSupportedExtensions() {
+    const InstanceCapabilities &capabilities = InstanceCapabilities::Get();
+    cout << "Instance capabilities enumerated in "
+         << chrono::duration_cast<chrono::microseconds>(capabilities.EnumerationTime()).count() << "us" << endl;
+
+    cout << capabilities.Extensions().size() << " extensions supported:" << endl;
+    for (const VkExtensionProperties &extension: capabilities.Extensions()) {
+        cout << "- " << extension.extensionName << endl;
+    }
+}
+
+void VulkanApp::printSupportedLayers() {
+    const InstanceCapabilities &capabilities = InstanceCapabilities::Get();
+    cout << capabilities.Layers().size() << " layers supported:" << endl;
+    for (const VkLayerProperties &layer: capabilities.Layers()) {
+        cout << "- " << layer.layerName << endl;
+    }
+}
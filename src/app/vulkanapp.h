@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "window/window.h"
+#include "vulkan/logicaldevice.h"
+#include "vulkan/pipelinecache.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/stagingring.h"
+#include "vulkan/framering.h"
+#include "vulkan/swapchain.h"
+#include "vulkan/gpuprofiler.h"
+#include "vulkan/debugsink.h"
+#include "vulkan/shadercache.h"
+#include "vulkan/computerunner.h"
+#include "vulkan/rendergraph.h"
+#include "vulkan/offscreentarget.h"
+#include "vulkan/devicegroup.h"
+#include "profiler/trace.h"
+#include "profiler/phasetimer.h"
+
+const uint32_t HEADLESS_DEFAULT_FRAMES = 100;
+// On disk caches, the startup benchmark deletes them for cold runs
+extern const char *PIPELINE_CACHE_PATH;
+extern const char *SHADER_CACHE_PATH;
+
+struct AppOptions {
+    // No window, no surface: renders into offscreen images, works with a software ICD and no display
+    bool headless = false;
+    // 0 runs until the window is closed, or HEADLESS_DEFAULT_FRAMES when headless
+    uint32_t frames = 0;
+    // Headless only, the last frame is written here as a PPM
+    std::string readbackPath;
+    // Startup and shutdown phase durations are written here as JSON
+    std::string timingsPath;
+    // Runs every startup step on the main thread one after the other, to compare against
+    bool serialInit = false;
+    // Headless only, spreads frames over every GPU of a linked device group. A lone GPU renders alone either way.
+    // In split frame each GPU's render pass only covers its own band, and only that band is read back from it.
+    GroupRenderMode groupMode = GroupRenderMode::Single;
+};
+
+class VulkanApp {
+public:
+    VulkanApp(AppOptions options);
+
+    void run();
+    PhaseTimer& Timings();
+
+private:
+    AppOptions options;
+    Window *window = nullptr;
+    VkInstance instance = VK_NULL_HANDLE;
+    DebugSink *debugSink = nullptr;
+    VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
+    uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+    std::vector<const char*> instanceExtensions;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    PhysicalDeviceGroup physicalGroup;
+    LogicalDevice device;
+    DeviceGroup *deviceGroup = nullptr;
+    PipelineCache *pipelineCache = nullptr;
+    ShaderCache *shaderCache = nullptr;
+    std::shared_future<std::vector<uint32_t>> saxpySpirv;
+    ComputeKernel *saxpyKernel = nullptr;
+    MemoryAllocator *allocator = nullptr;
+    StagingRing *stagingRing = nullptr;
+    FrameRing *frameRing = nullptr;
+    Swapchain *swapchain = nullptr;
+    OffscreenTarget *offscreenTarget = nullptr;
+    // Headless frames are drawn in a render pass, one framebuffer per offscreen image
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> framebuffers;
+    TraceWriter trace;
+    PhaseTimer timings{&trace};
+    double runStart = 0.0;
+    GpuProfiler *gpuProfiler = nullptr;
+    RenderGraph *renderGraph = nullptr;
+    ResourceHandle backbuffer = 0;
+    ResourceHandle readbackBuffer = 0;
+
+    void timed(const char *name, void (VulkanApp::*step)());
+    void createWindow();
+    void initialize();
+    void mainLoop();
+    void headlessLoop();
+    void recordClear(VkCommandBuffer commandBuffer, VkImage image);
+    void recordRenderPass(VkCommandBuffer commandBuffer, uint32_t index);
+    void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
+    void setupDebugMessenger();
+    void createInstance();
+    void createPhysicalDevice();
+    void createLogicalDevice();
+    void createAllocator();
+    void createPipelineCache();
+    void createShaderCache();
+    void createComputePipeline();
+    void createSurface();
+    void createSwapchain();
+    void createOffscreenTarget();
+    void createFramebuffers();
+    void createFrameRing();
+    void createProfiler();
+    void createRenderGraph();
+    void cleanup();
+    bool supportsVkExtension(const char *name);
+    bool supportsVkLayer(const char *name);
+    void printSupportedExtensions();
+    void printSupportedLayers();
+};
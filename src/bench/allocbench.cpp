@@ -0,0 +1,128 @@
+// Checks MemoryAllocator on a real device: sub-allocations honour their alignment and never overlap, small ones share
+// blocks, big ones go dedicated, mapped pointers work, and freeing everything in a scattered order merges the buddies
+// back into one whole free block. Also reports allocate/free throughput. Runs on any device including lavapipe.
+// Usage: Cpptests_allocbench [allocations]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+// Small enough that a few hundred allocations need several blocks
+const VkDeviceSize BLOCK_SIZE = 4 * 1024 * 1024;
+
+int main(int argc, char **argv) {
+    uint32_t count = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 2000;
+
+    try {
+        BenchContext context("Cpptests allocator bench");
+        MemoryAllocator *allocator = new MemoryAllocator(context.device, BLOCK_SIZE);
+        bool ok = true;
+        auto check = [&ok](bool condition, const char *what) {
+            if (!condition) {
+                cout << "FAILED: " << what << endl;
+                ok = false;
+            }
+        };
+
+        // Sizes from a few bytes to 64KiB, alignments from 1 to 64KiB
+        mt19937 random(1234);
+        vector<VkMemoryRequirements> requirements(count);
+        for (VkMemoryRequirements &requirement: requirements) {
+            requirement.size = 1 + random() % (64 * 1024);
+            requirement.alignment = VkDeviceSize(1) << (random() % 17);
+            requirement.memoryTypeBits = ~0u;
+        }
+
+        vector<Allocation> allocations(count);
+        auto start = chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            allocations[i] = allocator->Allocate(requirements[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, true);
+        }
+        double allocateNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
+
+        bool aligned = true;
+        for (uint32_t i = 0; i < count; i++) {
+            aligned = aligned && allocations[i].offset % requirements[i].alignment == 0 && !allocations[i].dedicated;
+        }
+        check(aligned, "an allocation is misaligned or went dedicated");
+
+        vector<uint32_t> order(count);
+        for (uint32_t i = 0; i < count; i++)
+            order[i] = i;
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            if (allocations[a].memory != allocations[b].memory)
+                return allocations[a].memory < allocations[b].memory;
+            return allocations[a].offset < allocations[b].offset;
+        });
+        bool disjoint = true;
+        for (uint32_t i = 1; i < count; i++) {
+            const Allocation &previous = allocations[order[i - 1]];
+            const Allocation &next = allocations[order[i]];
+            if (previous.memory == next.memory && previous.offset + previous.size > next.offset)
+                disjoint = false;
+        }
+        check(disjoint, "two allocations overlap");
+
+        MemoryStats full = allocator->Stats();
+        check(full.allocationCount == count, "allocation count doesn't match");
+        check(full.blockCount < count / 8, "small allocations don't share blocks");
+
+        // Scattered frees: every other one first, then the rest backwards, so buddies come back out of order
+        start = chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; i += 2)
+            allocator->Free(allocations[i]);
+        for (uint32_t i = count; i > 0; i--)
+            allocator->Free(allocations[i - 1]);
+        double freeNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
+
+        MemoryStats empty = allocator->Stats();
+        check(empty.allocationCount == 0, "allocations left after freeing everything");
+        check(empty.blockCount == 1, "empty blocks weren't given back");
+        check(empty.largestFreeRange == empty.bytesReserved && empty.externalFragmentation == 0.0, "buddies didn't merge back into one free block");
+
+        // More than half a block can't be sub-allocated without wasting most of it
+        VkMemoryRequirements big{};
+        big.size = BLOCK_SIZE;
+        big.alignment = 256;
+        big.memoryTypeBits = ~0u;
+        Allocation dedicated = allocator->Allocate(big, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, true);
+        check(dedicated.dedicated && dedicated.offset == 0, "a block sized allocation wasn't dedicated");
+        allocator->Free(dedicated);
+
+        VkMemoryRequirements small{};
+        small.size = 4096;
+        small.alignment = 64;
+        small.memoryTypeBits = ~0u;
+        Allocation first = allocator->Allocate(small, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, true);
+        Allocation second = allocator->Allocate(small, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, true);
+        check(first.mapped && second.mapped, "host visible allocations aren't mapped");
+        if (first.mapped && second.mapped) {
+            memset(first.mapped, 0xab, small.size);
+            memset(second.mapped, 0xcd, small.size);
+            check(static_cast<uint8_t*>(first.mapped)[small.size - 1] == 0xab, "mapped allocations share bytes");
+        }
+        allocator->Free(second);
+        allocator->Free(first);
+
+        cout << count << " allocations in " << full.blockCount << " blocks of " << BLOCK_SIZE / 1024 << " KiB, "
+             << static_cast<int>(full.internalFragmentation * 100) << "% lost to rounding" << endl;
+        cout << "allocate\t" << allocateNs << " ns" << endl;
+        cout << "free\t\t" << freeNs << " ns" << endl;
+        cout << (ok ? "Allocator checks passed" : "FAILED, see above") << endl;
+
+        delete allocator;
+        return ok ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,46 @@
+#include "benchcontext.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include "vulkan/physicaldevice.h"
+#include "vulkan/instancecapabilities.h"
+
+BenchContext::BenchContext(const char *name, bool deviceGroup) {
+    apiVersion = std::min<uint32_t>(InstanceCapabilities::Get().ApiVersion(), VK_API_VERSION_1_3);
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.apiVersion = apiVersion;
+    appInfo.pApplicationName = name;
+    VkInstanceCreateInfo instanceInfo{};
+    instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceInfo.pApplicationInfo = &appInfo;
+    if (vkCreateInstance(&instanceInfo, nullptr, &instance) != VK_SUCCESS) {
+        throw std::runtime_error("error creating instance");
+    }
+    VulkanLoader::LoadInstance(instance);
+
+    try {
+        PhysicalDeviceBuilder pdBuilder(instance);
+        PhysicalDeviceGroup physicalGroup;
+        VkPhysicalDevice physicalDevice;
+        if (deviceGroup) {
+            physicalGroup = pdBuilder.BuildGroup();
+            physicalDevice = physicalGroup.devices[0];
+        } else {
+            physicalDevice = pdBuilder.Build();
+        }
+        LogicalDeviceBuilder ldBuilder(physicalDevice, apiVersion);
+        if (!physicalGroup.devices.empty())
+            ldBuilder.SetDeviceGroup(physicalGroup);
+        device = ldBuilder.Build();
+    } catch (...) {
+        vkDestroyInstance(instance, nullptr);
+        throw;
+    }
+}
+
+BenchContext::~BenchContext() {
+    if (device.device != VK_NULL_HANDLE)
+        vkDestroyDevice(device.device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "vulkan/vulkanloader.h"
+#include "vulkan/logicaldevice.h"
+
+// The instance and device every headless bench starts from: the newest API up to 1.3, no layers and no surface,
+// on the device PhysicalDeviceBuilder rates best. Destroys both when it goes, so declare it before anything that
+// uses the device. With deviceGroup the device is built on the best device group instead, a group of one when the
+// GPUs aren't linked.
+struct BenchContext {
+    VkInstance instance = VK_NULL_HANDLE;
+    uint32_t apiVersion = VK_API_VERSION_1_0;
+    LogicalDevice device;
+
+    BenchContext(const char *name, bool deviceGroup = false);
+    ~BenchContext();
+    BenchContext(const BenchContext&) = delete;
+    BenchContext& operator=(const BenchContext&) = delete;
+};
@@ -0,0 +1,98 @@
+// Runs a SAXPY kernel through ComputeRunner, checks the result against the CPU and reports dispatch throughput.
+// Needs glslc (or GLSLC) to build the kernel, runs on any device including lavapipe.
+// Usage: Cpptests_computebench [elements] [iterations] [workgroup size]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/shadercache.h"
+#include "vulkan/computerunner.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+struct SaxpyParams {
+    float a;
+    uint32_t count;
+};
+
+int main(int argc, char **argv) {
+    uint32_t elements = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 1 << 20;
+    uint32_t iterations = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 20;
+    uint32_t workgroupSize = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 64;
+
+    try {
+        BenchContext context("Cpptests compute bench");
+        LogicalDevice &device = context.device;
+        cout << "Compute family " << device.queueFamilies.computeFamily.value()
+             << (device.queueFamilies.hasDedicatedCompute() ? " (dedicated)" : " (shared with graphics)") << endl;
+
+        MemoryAllocator *allocator = new MemoryAllocator(device);
+        ShaderCache *shaderCache = new ShaderCache(device.device);
+        ShaderSource source;
+        source.path = string(CPPTESTS_SHADER_DIR) + "/saxpy.comp";
+        vector<uint32_t> spirv = shaderCache->Compile(source).get();
+
+        ComputeRunner *runner = new ComputeRunner(device, *allocator);
+        ComputeKernel *kernel = new ComputeKernel(device, spirv, {workgroupSize, 0, 0});
+
+        vector<float> x(elements), y(elements);
+        for (uint32_t i = 0; i < elements; i++) {
+            x[i] = static_cast<float>(i % 1000) * 0.001f;
+            y[i] = static_cast<float>(i % 7);
+        }
+        SaxpyParams params{2.0f, elements};
+        VkDeviceSize bytes = static_cast<VkDeviceSize>(elements) * sizeof(float);
+        ComputeBuffer xBuffer = runner->CreateBuffer(bytes, true);
+        ComputeBuffer yBuffer = runner->CreateBuffer(bytes, true);
+        ComputeBuffer paramsBuffer = runner->CreateBuffer(sizeof(params), true);
+        runner->Write(xBuffer, x.data(), bytes);
+        runner->Write(yBuffer, y.data(), bytes);
+        runner->Write(paramsBuffer, &params, sizeof(params));
+
+        // Only the last dispatch reads back, the others are queued without waiting
+        array<uint32_t, 3> groups = kernel->GroupsFor(elements);
+        auto start = chrono::steady_clock::now();
+        future<vector<uint8_t>> result;
+        for (uint32_t i = 0; i < iterations; i++) {
+            result = runner->Dispatch(*kernel, {&xBuffer, &yBuffer, &paramsBuffer}, groups, i + 1 == iterations ? &yBuffer : nullptr);
+        }
+        vector<uint8_t> data = result.get();
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        const float *gpu = reinterpret_cast<const float*>(data.data());
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < elements; i++) {
+            float expected = y[i];
+            for (uint32_t j = 0; j < iterations; j++)
+                expected = params.a * x[i] + expected;
+            if (fabs(gpu[i] - expected) > 1e-3f * max(1.0f, fabs(expected)))
+                mismatches++;
+        }
+
+        // x and params read, y read and written, per iteration
+        double gigabytes = 3.0 * bytes * iterations / 1e9;
+        cout << elements << " elements, " << iterations << " dispatches of " << groups[0] << "x" << workgroupSize << " in " << ms << "ms ("
+             << gigabytes / (ms / 1000.0) << " GB/s)" << endl;
+        cout << (mismatches ? "FAILED, " + to_string(mismatches) + " mismatches" : string("Results match")) << endl;
+
+        runner->WaitIdle();
+        runner->DestroyBuffer(xBuffer);
+        runner->DestroyBuffer(yBuffer);
+        runner->DestroyBuffer(paramsBuffer);
+        delete kernel;
+        delete runner;
+        delete shaderCache;
+        delete allocator;
+        return mismatches ? 1 : 0;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,371 @@
+// GPU frustum culling against the same test on the CPU, from a thousand to a quarter million instances. Checks that
+// both agree and shows that what the CPU records stays the same whatever the instance count. The first thousand are
+// then culled and drawn through RecordDraw, one point per instance on its own pixel, and the lit pixels have to match
+// what the cull kept.
+// Needs glslc (or GLSLC) to build the kernel and the point shaders, runs on any device including lavapipe.
+// Usage: Cpptests_cullbench [max instances]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <glm/gtc/matrix_transform.hpp>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/shadercache.h"
+#include "vulkan/gpuculling.h"
+#include "vulkan/offscreentarget.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+// Instance i lands on pixel i, so this many instances fill the target
+const VkExtent2D DRAW_EXTENT = {32, 32};
+
+static VkShaderModule loadShader(ShaderCache &shaderCache, const char *name) {
+    ShaderSource source;
+    source.path = string(CPPTESTS_SHADER_DIR) + "/" + name;
+    return shaderCache.Load(source).get();
+}
+
+// Culls and draws the instances already in culling into a DRAW_EXTENT target and returns how many pixels were lit
+static uint32_t drawVisible(const LogicalDevice &device, MemoryAllocator &allocator, ShaderCache &shaderCache, GpuCulling &culling,
+    VkCommandPool pool, VkCommandBuffer commandBuffer, VkFence fence, const glm::mat4 &viewProjection) {
+    OffscreenTarget target(device, allocator, DRAW_EXTENT, 1);
+
+    VkAttachmentDescription attachment{};
+    attachment.format = target.Format();
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    VkAttachmentReference colorReference{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+    // The points have to be written before the readback copies them
+    VkSubpassDependency dependency{};
+    dependency.srcSubpass = 0;
+    dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &attachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
+    VkRenderPass renderPass;
+    if (vkCreateRenderPass(device.device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+        throw runtime_error("error creating render pass");
+    }
+
+    VkImageView view = target.ImageView(0);
+    VkFramebufferCreateInfo framebufferInfo{};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &view;
+    framebufferInfo.width = DRAW_EXTENT.width;
+    framebufferInfo.height = DRAW_EXTENT.height;
+    framebufferInfo.layers = 1;
+    VkFramebuffer framebuffer;
+    if (vkCreateFramebuffer(device.device, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+        throw runtime_error("error creating framebuffer");
+    }
+
+    VkPushConstantRange pushRange{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t) * 2};
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    VkPipelineLayout layout;
+    if (vkCreatePipelineLayout(device.device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+        throw runtime_error("error creating pipeline layout");
+    }
+
+    VkPipelineShaderStageCreateInfo stages[2]{};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = loadShader(shaderCache, "cullpoints.vert");
+    stages[0].pName = "main";
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = loadShader(shaderCache, "cullpoints.frag");
+    stages[1].pName = "main";
+    VkPipelineVertexInputStateCreateInfo vertexInput{};
+    vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+    VkViewport viewport{0.0f, 0.0f, static_cast<float>(DRAW_EXTENT.width), static_cast<float>(DRAW_EXTENT.height), 0.0f, 1.0f};
+    VkRect2D scissor{{0, 0}, DRAW_EXTENT};
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = &viewport;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = &scissor;
+    VkPipelineRasterizationStateCreateInfo rasterization{};
+    rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterization.cullMode = VK_CULL_MODE_NONE;
+    rasterization.lineWidth = 1.0f;
+    VkPipelineMultisampleStateCreateInfo multisample{};
+    multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    VkPipelineColorBlendAttachmentState blendAttachment{};
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    VkPipelineColorBlendStateCreateInfo blend{};
+    blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    blend.attachmentCount = 1;
+    blend.pAttachments = &blendAttachment;
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = stages;
+    pipelineInfo.pVertexInputState = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterization;
+    pipelineInfo.pMultisampleState = &multisample;
+    pipelineInfo.pColorBlendState = &blend;
+    pipelineInfo.layout = layout;
+    pipelineInfo.renderPass = renderPass;
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(device.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+        throw runtime_error("error creating point pipeline");
+    }
+
+    // Every mesh is the single index 0, the vertex shader only looks at gl_InstanceIndex
+    VkBufferCreateInfo indexInfo{};
+    indexInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    indexInfo.size = sizeof(uint32_t);
+    indexInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    indexInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    Allocation indexAllocation;
+    VkBuffer indices = allocator.CreateBuffer(indexInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, indexAllocation);
+    memset(indexAllocation.mapped, 0, sizeof(uint32_t));
+
+    vkResetCommandPool(device.device, pool, 0);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    culling.RecordCull(commandBuffer, viewProjection);
+    VkClearValue clear{};
+    VkRenderPassBeginInfo passInfo{};
+    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    passInfo.renderPass = renderPass;
+    passInfo.framebuffer = framebuffer;
+    passInfo.renderArea = scissor;
+    passInfo.clearValueCount = 1;
+    passInfo.pClearValues = &clear;
+    vkCmdBeginRenderPass(commandBuffer, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    uint32_t targetSize[2] = {DRAW_EXTENT.width, DRAW_EXTENT.height};
+    vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(targetSize), targetSize);
+    vkCmdBindIndexBuffer(commandBuffer, indices, 0, VK_INDEX_TYPE_UINT32);
+    culling.RecordDraw(commandBuffer);
+    vkCmdEndRenderPass(commandBuffer);
+    target.RecordReadback(commandBuffer, 0);
+    VkMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &toHost, 0, nullptr, 0, nullptr);
+    vkEndCommandBuffer(commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+        throw runtime_error("error submitting culled draws");
+    }
+    vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(device.device, 1, &fence);
+
+    const uint8_t *pixels = static_cast<const uint8_t*>(target.ReadbackData(0));
+    uint32_t lit = 0;
+    for (VkDeviceSize i = 0; i < target.ReadbackSize(); i += 4)
+        lit += pixels[i] != 0 ? 1 : 0;
+
+    allocator.DestroyBuffer(indices, indexAllocation);
+    vkDestroyPipeline(device.device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device.device, layout, nullptr);
+    vkDestroyFramebuffer(device.device, framebuffer, nullptr);
+    vkDestroyRenderPass(device.device, renderPass, nullptr);
+    return lit;
+}
+
+int main(int argc, char **argv) {
+    uint32_t maxInstances = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 256 * 1024;
+    maxInstances = max<uint32_t>(maxInstances, 1024);
+
+    try {
+        BenchContext context("Cpptests cull bench");
+        LogicalDevice &device = context.device;
+
+        MemoryAllocator *allocator = new MemoryAllocator(device);
+        ShaderCache *shaderCache = new ShaderCache(device.device);
+        ShaderSource source;
+        source.path = string(CPPTESTS_SHADER_DIR) + "/cull.comp";
+        GpuCulling *culling = new GpuCulling(device, *allocator, shaderCache->Compile(source).get(), maxInstances);
+        cout << (culling->Compacted() ? "Compacted with drawIndirectCount" : "No drawIndirectCount, culled draws keep their slot") << endl;
+
+        // One index is all the draw check below needs, culling only looks at the bounding spheres
+        CullMesh mesh;
+        mesh.indexCount = 1;
+        culling->SetMeshes({mesh});
+        bool rejected = false;
+        try {
+            CullInstance stray;
+            stray.mesh = 1;
+            culling->SetInstances({stray});
+        } catch (runtime_error &) {
+            rejected = true;
+        }
+
+        // Whatever survives is read back by copying either the count or all the commands
+        VkDeviceSize readbackSize = culling->Compacted() ? sizeof(uint32_t) : sizeof(VkDrawIndexedIndirectCommand) * maxInstances;
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = readbackSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        Allocation readbackAllocation;
+        VkBuffer readback = allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT, readbackAllocation);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+        VkCommandPool pool;
+        vkCreateCommandPool(device.device, &poolInfo, nullptr, &pool);
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer);
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        vkCreateFence(device.device, &fenceInfo, nullptr, &fence);
+
+        // Unit cubes scattered in a box around a camera that sees roughly a quarter of it
+        mt19937 random(1234);
+        uniform_real_distribution<float> position(-500.0f, 500.0f);
+        uniform_real_distribution<float> scale(0.5f, 4.0f);
+        vector<CullInstance> instances(maxInstances);
+        for (CullInstance &cullInstance: instances) {
+            cullInstance.transform = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random))), glm::vec3(scale(random)));
+            cullInstance.boundingSphere = glm::vec4(0.0f, 0.0f, 0.0f, 0.87f);
+        }
+        glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(70.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+        glm::mat4 view = glm::lookAtRH(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.2f, 0.3f), glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 viewProjection = projection * view;
+        array<glm::vec4, 6> planes = GpuCulling::FrustumPlanes(viewProjection);
+
+        cout << "instances\tvisible\tcpu cull ms\tgpu cull ms\trecord us" << endl;
+        bool agree = true;
+        uint32_t firstVisible = 0;
+        for (uint32_t count = 1024; count <= maxInstances; count = count < maxInstances && count * 4 > maxInstances ? maxInstances : count * 4) {
+            vector<CullInstance> subset(instances.begin(), instances.begin() + count);
+            culling->SetInstances(subset);
+
+            auto cpuStart = chrono::steady_clock::now();
+            uint32_t cpuVisible = 0;
+            for (const CullInstance &cullInstance: subset)
+                cpuVisible += GpuCulling::Visible(planes, cullInstance) ? 1 : 0;
+            double cpuMs = chrono::duration<double, milli>(chrono::steady_clock::now() - cpuStart).count();
+
+            vkResetCommandPool(device.device, pool, 0);
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            auto recordStart = chrono::steady_clock::now();
+            culling->RecordCull(commandBuffer, viewProjection);
+            double recordUs = chrono::duration<double, micro>(chrono::steady_clock::now() - recordStart).count();
+
+            VkMemoryBarrier toTransfer{};
+            toTransfer.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            toTransfer.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 1, &toTransfer, 0, nullptr, 0, nullptr);
+            VkBufferCopy region{0, 0, culling->Compacted() ? readbackSize : sizeof(VkDrawIndexedIndirectCommand) * count};
+            vkCmdCopyBuffer(commandBuffer, culling->Compacted() ? culling->DrawCountBuffer() : culling->DrawBuffer(), readback, 1, &region);
+            VkMemoryBarrier toHost{};
+            toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &toHost, 0, nullptr, 0, nullptr);
+            vkEndCommandBuffer(commandBuffer);
+
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+            auto gpuStart = chrono::steady_clock::now();
+            vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, fence);
+            vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
+            double gpuMs = chrono::duration<double, milli>(chrono::steady_clock::now() - gpuStart).count();
+            vkResetFences(device.device, 1, &fence);
+
+            uint32_t gpuVisible = 0;
+            if (culling->Compacted()) {
+                memcpy(&gpuVisible, readbackAllocation.mapped, sizeof(uint32_t));
+            } else {
+                const VkDrawIndexedIndirectCommand *commands = static_cast<const VkDrawIndexedIndirectCommand*>(readbackAllocation.mapped);
+                for (uint32_t i = 0; i < count; i++)
+                    gpuVisible += commands[i].instanceCount;
+            }
+
+            // Spheres right on a plane can land either way with different float rounding
+            uint32_t difference = gpuVisible > cpuVisible ? gpuVisible - cpuVisible : cpuVisible - gpuVisible;
+            if (difference > count / 1000)
+                agree = false;
+            if (count == 1024)
+                firstVisible = gpuVisible;
+            cout << count << "\t\t" << gpuVisible << "\t" << cpuMs << "\t\t" << gpuMs << "\t\t" << recordUs
+                 << (gpuVisible == cpuVisible ? "" : "\t(CPU saw " + to_string(cpuVisible) + ")") << endl;
+            if (count == maxInstances)
+                break;
+        }
+        cout << (agree ? "GPU and CPU culling agree" : "FAILED, GPU and CPU culling disagree") << endl;
+
+        // The same culled commands again, this time drawn
+        culling->SetInstances(vector<CullInstance>(instances.begin(), instances.begin() + 1024));
+        uint32_t drawn = drawVisible(device, *allocator, *shaderCache, *culling, pool, commandBuffer, fence, viewProjection);
+        bool drew = drawn == firstVisible;
+        cout << drawn << " instances drawn through " << (culling->Compacted() ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirect") << endl;
+        if (!drew)
+            cout << "FAILED, expected " << firstVisible << " drawn" << endl;
+        if (!rejected)
+            cout << "FAILED, an instance past the last mesh was accepted" << endl;
+
+        vkDestroyFence(device.device, fence, nullptr);
+        vkDestroyCommandPool(device.device, pool, nullptr);
+        allocator->DestroyBuffer(readback, readbackAllocation);
+        delete culling;
+        delete shaderCache;
+        delete allocator;
+        return agree && drew && rejected ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
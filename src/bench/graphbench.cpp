@@ -0,0 +1,168 @@
+// Checks the render graph's compile step on a real device. Two transient images that are never alive at the same
+// time have to end up in one allocation, and a pass whose output nobody reads has to be culled and never run. The
+// graph is then run: each image is cleared to its own color and copied out, so a missing barrier between the two
+// users of the shared memory shows up as the wrong color. Runs on any device including lavapipe.
+// Usage: Cpptests_graphbench
+
+#include <cstring>
+#include <iostream>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/rendergraph.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+const uint32_t SIZE = 64;
+const VkDeviceSize IMAGE_BYTES = SIZE * SIZE * 4;
+
+static void clearImage(VkCommandBuffer commandBuffer, VkImage image, float red) {
+    VkClearColorValue color = {{red, 0.0f, 0.0f, 1.0f}};
+    VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+}
+
+static void copyImage(VkCommandBuffer commandBuffer, VkImage image, VkBuffer buffer, VkDeviceSize offset) {
+    VkBufferImageCopy region{};
+    region.bufferOffset = offset;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {SIZE, SIZE, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+}
+
+int main() {
+    try {
+        BenchContext context("Cpptests render graph bench");
+        LogicalDevice &device = context.device;
+        MemoryAllocator *allocator = new MemoryAllocator(device);
+        bool ok = true;
+        auto check = [&ok](bool condition, const char *what) {
+            if (!condition) {
+                cout << "FAILED: " << what << endl;
+                ok = false;
+            }
+        };
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = IMAGE_BYTES * 2;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        Allocation readbackAllocation;
+        VkBuffer readback = allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, readbackAllocation);
+
+        // first: passes 0-1, second: passes 2-3, unused: only written by pass 4
+        RenderGraph *graph = new RenderGraph(device, *allocator);
+        GraphImageDesc imageDesc;
+        imageDesc.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageDesc.extent = {SIZE, SIZE};
+        ResourceHandle first = graph->CreateImage("First", imageDesc);
+        ResourceHandle second = graph->CreateImage("Second", imageDesc);
+        ResourceHandle unused = graph->CreateImage("Unused", imageDesc);
+        GraphBufferDesc readbackDesc;
+        readbackDesc.size = bufferInfo.size;
+        ImportedState readbackState;
+        readbackState.finalStages = VK_PIPELINE_STAGE_HOST_BIT;
+        readbackState.finalAccess = VK_ACCESS_HOST_READ_BIT;
+        ResourceHandle output = graph->ImportBuffer("Readback", readbackDesc, readbackState);
+        graph->SetImportedBuffer(output, readback);
+
+        bool culledRan = false;
+        graph->AddPass("Clear first")
+            .Write(first, ResourceUsage::TransferWrite())
+            .Execute([first](VkCommandBuffer commandBuffer, RenderGraph &graph) {
+                clearImage(commandBuffer, graph.Image(first), 1.0f);
+            });
+        graph->AddPass("Copy first")
+            .Read(first, ResourceUsage::TransferRead())
+            .Write(output, ResourceUsage::TransferWrite())
+            .Execute([first, output](VkCommandBuffer commandBuffer, RenderGraph &graph) {
+                copyImage(commandBuffer, graph.Image(first), graph.Buffer(output), 0);
+            });
+        graph->AddPass("Clear second")
+            .Write(second, ResourceUsage::TransferWrite())
+            .Execute([second](VkCommandBuffer commandBuffer, RenderGraph &graph) {
+                clearImage(commandBuffer, graph.Image(second), 0.5f);
+            });
+        graph->AddPass("Copy second")
+            .Read(second, ResourceUsage::TransferRead())
+            .Write(output, ResourceUsage::TransferWrite())
+            .Execute([second, output](VkCommandBuffer commandBuffer, RenderGraph &graph) {
+                copyImage(commandBuffer, graph.Image(second), graph.Buffer(output), IMAGE_BYTES);
+            });
+        graph->AddPass("Nobody reads this")
+            .Write(unused, ResourceUsage::TransferWrite())
+            .Execute([&culledRan](VkCommandBuffer, RenderGraph &) {
+                culledRan = true;
+            });
+        graph->Compile();
+
+        const RenderGraphStats &stats = graph->Stats();
+        check(stats.culledPasses == 1, "the pass without a consumer wasn't culled");
+        check(graph->Image(unused) == VK_NULL_HANDLE, "the culled pass's image was created");
+        check(stats.transientCount == 2, "expected two transient images");
+        check(stats.allocationCount == 1, "transients with disjoint lifetimes didn't share an allocation");
+        check(stats.aliasedBytes < stats.unaliasedBytes, "aliasing saved no memory");
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+        VkCommandPool pool;
+        if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+            throw runtime_error("error creating command pool");
+        }
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw runtime_error("error allocating command buffer");
+        }
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        if (vkCreateFence(device.device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+            throw runtime_error("error creating fence");
+        }
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        graph->Execute(commandBuffer);
+        vkEndCommandBuffer(commandBuffer);
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+            throw runtime_error("error submitting render graph");
+        }
+        vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
+        check(!culledRan, "the culled pass was executed");
+
+        // 1.0 and 0.5 in UNORM8, every pixel of each half. 0.5 may round either way.
+        const uint8_t *pixels = static_cast<const uint8_t*>(readbackAllocation.mapped);
+        bool colors = true;
+        for (VkDeviceSize i = 0; i < IMAGE_BYTES; i += 4) {
+            colors = colors && pixels[i] == 255 && (pixels[IMAGE_BYTES + i] == 127 || pixels[IMAGE_BYTES + i] == 128);
+        }
+        check(colors, "an aliased image came back with the other one's contents");
+
+        cout << stats.passCount - stats.culledPasses << " of " << stats.passCount << " passes kept, " << stats.transientCount << " transients in "
+             << stats.allocationCount << " allocations, " << stats.aliasedBytes / 1024 << " KiB instead of " << stats.unaliasedBytes / 1024 << " KiB" << endl;
+        cout << (ok ? "Render graph checks passed" : "FAILED, see above") << endl;
+
+        vkDestroyFence(device.device, fence, nullptr);
+        vkDestroyCommandPool(device.device, pool, nullptr);
+        delete graph;
+        allocator->DestroyBuffer(readback, readbackAllocation);
+        delete allocator;
+        return ok ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,137 @@
+// Renders the same frames on one GPU, split across every GPU of the device group and alternating between them.
+// Every device clears the frame with its own color and copies its part back, so the readback shows which device
+// rendered which rows. Checks the last frames of each mode against that. On a single GPU or lavapipe the group has
+// one device and all three modes run the single device path.
+// Usage: Cpptests_groupbench [frames] [size]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/framering.h"
+#include "vulkan/offscreentarget.h"
+#include "vulkan/devicegroup.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+const uint32_t FRAMES_IN_FLIGHT = 2;
+
+static uint8_t frameRed(uint64_t frameNumber) {
+    return static_cast<uint8_t>(frameNumber % 256);
+}
+
+static uint8_t deviceGreen(uint32_t deviceIndex) {
+    return static_cast<uint8_t>(40 + deviceIndex * 50);
+}
+
+static void imageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout from, VkImageLayout to, VkAccessFlags srcAccess,
+    VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = from;
+    barrier.newLayout = to;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+int main(int argc, char **argv) {
+    uint32_t frameCount = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 300;
+    uint32_t size = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 2048;
+    frameCount = max(frameCount, FRAMES_IN_FLIGHT);
+
+    try {
+        BenchContext context("Cpptests device group bench", true);
+        LogicalDevice &device = context.device;
+        MemoryAllocator *allocator = new MemoryAllocator(device);
+        OffscreenTarget *target = new OffscreenTarget(device, *allocator, {size, size}, FRAMES_IN_FLIGHT);
+        VkRect2D fullArea = {{0, 0}, target->Extent()};
+
+        bool correct = true;
+        const char *names[] = {"single", "split frame", "alternate frame"};
+        GroupRenderMode modes[] = {GroupRenderMode::Single, GroupRenderMode::SplitFrame, GroupRenderMode::AlternateFrame};
+        for (uint32_t m = 0; m < 3; m++) {
+            DeviceGroup *group = new DeviceGroup(device, modes[m]);
+            FrameRing *frameRing = new FrameRing(device, *allocator, FRAMES_IN_FLIGHT, 0);
+            frameRing->SetDeviceGroup(group);
+            // Split frame clears and copies one band per device, everything else the whole image on one device
+            vector<VkRect2D> areas = group->Mode() == GroupRenderMode::SplitFrame ? group->SplitAreas(fullArea) : vector<VkRect2D>{fullArea};
+
+            vector<uint64_t> lastFrames(FRAMES_IN_FLIGHT);
+            auto start = chrono::steady_clock::now();
+            for (uint32_t i = 0; i < frameCount; i++) {
+                FrameContext &frame = frameRing->BeginFrame();
+                VkCommandBuffer commandBuffer = frame.commandBuffer;
+                VkImage image = target->Image(frame.index);
+                imageBarrier(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+                for (uint32_t a = 0; a < areas.size(); a++) {
+                    // Alternate frame has a single device in the frame's mask, split frame one device per band
+                    uint32_t mask = areas.size() > 1 ? 1u << a : frame.deviceMask;
+                    uint32_t deviceIndex = 0;
+                    while (!(mask & (1u << deviceIndex)))
+                        deviceIndex++;
+                    group->SetDeviceMask(commandBuffer, mask);
+                    VkClearColorValue color = {{frameRed(frame.frameNumber) / 255.0f, deviceGreen(deviceIndex) / 255.0f, 0.0f, 1.0f}};
+                    VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+                    vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+                    imageBarrier(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+                    target->RecordReadback(commandBuffer, frame.index, areas[a]);
+                }
+                group->SetDeviceMask(commandBuffer, frame.deviceMask);
+
+                VkMemoryBarrier hostBarrier{};
+                hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+                lastFrames[frame.index] = frame.frameNumber;
+                frameRing->EndFrame();
+            }
+            frameRing->WaitIdle();
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+            // The readback of each slot holds the last frame that used it
+            for (uint32_t index = 0; index < FRAMES_IN_FLIGHT; index++) {
+                uint64_t frameNumber = lastFrames[index];
+                const uint8_t *pixels = static_cast<const uint8_t*>(target->ReadbackData(index));
+                for (uint32_t y = 0; y < size; y += 7) {
+                    uint32_t deviceIndex = 0;
+                    if (group->Mode() == GroupRenderMode::SplitFrame) {
+                        while (y >= areas[deviceIndex].offset.y + areas[deviceIndex].extent.height)
+                            deviceIndex++;
+                    } else {
+                        uint32_t mask = group->FrameDeviceMask(frameNumber);
+                        while (!(mask & (1u << deviceIndex)))
+                            deviceIndex++;
+                    }
+                    const uint8_t *pixel = pixels + (static_cast<size_t>(y) * size + (y * 13) % size) * 4;
+                    if (pixel[0] != frameRed(frameNumber) || pixel[1] != deviceGreen(deviceIndex))
+                        correct = false;
+                }
+            }
+
+            cout << names[m] << (group->Mode() != modes[m] ? " (ran single)" : "") << "\t" << ms / frameCount << " ms per frame on "
+                 << (group->Mode() == GroupRenderMode::Single ? 1 : group->DeviceCount()) << " of " << group->DeviceCount() << " devices" << endl;
+            delete frameRing;
+            delete group;
+        }
+        cout << (correct ? "Every device rendered the part of the frame it was given" : "FAILED, a frame came back from the wrong device") << endl;
+
+        delete target;
+        delete allocator;
+        return correct ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
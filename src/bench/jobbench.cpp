@@ -0,0 +1,208 @@
+// Upload, simulate and render chained across the transfer, compute and graphics queues, each frame depending on the
+// previous one for the buffers they share. Runs once as a DAG of timeline waits where the CPU fills the next upload
+// while the GPU works, and once waiting for every submission like a fence per step would, then compares frame times.
+// The "simulation" and "render" are buffer copies, so any device works. Checks every frame's result.
+// Usage: Cpptests_jobbench [frames] [MiB per frame]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <vector>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/queuescheduler.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+const uint32_t SLOTS = 2;
+
+struct Buffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation allocation;
+};
+
+int main(int argc, char **argv) {
+    uint32_t frameCount = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 200;
+    VkDeviceSize size = (argc > 2 ? static_cast<VkDeviceSize>(atoi(argv[2])) : 16) * 1024 * 1024;
+    uint32_t words = static_cast<uint32_t>(size / sizeof(uint32_t));
+
+    try {
+        BenchContext context("Cpptests job bench");
+        LogicalDevice &device = context.device;
+        MemoryAllocator *allocator = new MemoryAllocator(device);
+        QueueScheduler *scheduler = new QueueScheduler(device);
+        cout << scheduler->LaneCount() - 1 << " distinct queues" << endl;
+
+        // Shared by every family that touches them, so no ownership transfers are needed
+        QueueFamilyIndices &families = device.queueFamilies;
+        set<uint32_t> familySet = {families.graphicsFamily.value(), families.computeFamily.value(), families.transferFamily.value()};
+        vector<uint32_t> familyList(familySet.begin(), familySet.end());
+        auto createBuffer = [&](VkBufferUsageFlags usage, bool hostVisible) {
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = size;
+            bufferInfo.usage = usage;
+            bufferInfo.sharingMode = familyList.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+            bufferInfo.queueFamilyIndexCount = familyList.size() > 1 ? static_cast<uint32_t>(familyList.size()) : 0;
+            bufferInfo.pQueueFamilyIndices = familyList.data();
+            Buffer buffer;
+            if (hostVisible) {
+                buffer.buffer = allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    VK_MEMORY_PROPERTY_HOST_CACHED_BIT, buffer.allocation);
+            } else {
+                buffer.buffer = allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, buffer.allocation);
+            }
+            return buffer;
+        };
+        Buffer staging[SLOTS], readback[SLOTS];
+        for (uint32_t i = 0; i < SLOTS; i++) {
+            staging[i] = createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true);
+            readback[i] = createBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, true);
+        }
+        Buffer uploaded = createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+        Buffer simulated = createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+
+        // Recorded once. Frames are queued ahead of the GPU, so the same command buffer can be pending twice.
+        vector<VkCommandPool> pools;
+        auto record = [&](uint32_t family, VkBuffer src, VkBuffer dst) {
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.queueFamilyIndex = family;
+            VkCommandPool pool;
+            vkCreateCommandPool(device.device, &poolInfo, nullptr, &pool);
+            pools.push_back(pool);
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = pool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+            VkCommandBuffer commandBuffer;
+            vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer);
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+            vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            VkBufferCopy region{0, 0, size};
+            vkCmdCopyBuffer(commandBuffer, src, dst, 1, &region);
+            vkEndCommandBuffer(commandBuffer);
+            return commandBuffer;
+        };
+        VkCommandBuffer upload[SLOTS], render[SLOTS];
+        for (uint32_t i = 0; i < SLOTS; i++) {
+            upload[i] = record(families.transferFamily.value(), staging[i].buffer, uploaded.buffer);
+            render[i] = record(families.graphicsFamily.value(), simulated.buffer, readback[i].buffer);
+        }
+        VkCommandBuffer simulate = record(families.computeFamily.value(), uploaded.buffer, simulated.buffer);
+
+        auto fill = [&](uint32_t frame) {
+            uint32_t *data = static_cast<uint32_t*>(staging[frame % SLOTS].allocation.mapped);
+            for (uint32_t i = 0; i < words; i++)
+                data[i] = frame * 7 + i;
+        };
+        bool correct = true;
+        auto check = [&](uint32_t frame) {
+            const uint32_t *data = static_cast<const uint32_t*>(readback[frame % SLOTS].allocation.mapped);
+            for (uint32_t i = 0; i < words; i += 997) {
+                if (data[i] != frame * 7 + i)
+                    correct = false;
+            }
+        };
+
+        // Each frame waits on the CPU filling its upload and on the previous frame being done with the buffer it
+        // overwrites, nothing else. The CPU fills frame f while the GPU is still on f - 1 and checks f - 1 after.
+        auto start = chrono::steady_clock::now();
+        vector<JobHandle> uploads, simulations, renders;
+        JobHandle filled;
+        for (uint32_t frame = 0; frame < frameCount; frame++) {
+            filled = scheduler->AddHostJob();
+            QueueJob uploadJob;
+            uploadJob.queue = QueueRole::Transfer;
+            uploadJob.commandBuffers = {upload[frame % SLOTS]};
+            uploadJob.dependencies.push_back({filled, VK_PIPELINE_STAGE_TRANSFER_BIT});
+            if (frame > 0)
+                uploadJob.dependencies.push_back({simulations[frame - 1], VK_PIPELINE_STAGE_TRANSFER_BIT});
+            uploads.push_back(scheduler->Add(uploadJob));
+
+            QueueJob simulateJob;
+            simulateJob.queue = QueueRole::Compute;
+            simulateJob.commandBuffers = {simulate};
+            simulateJob.dependencies.push_back({uploads[frame], VK_PIPELINE_STAGE_TRANSFER_BIT});
+            if (frame > 0)
+                simulateJob.dependencies.push_back({renders[frame - 1], VK_PIPELINE_STAGE_TRANSFER_BIT});
+            simulations.push_back(scheduler->Add(simulateJob));
+
+            QueueJob renderJob;
+            renderJob.queue = QueueRole::Graphics;
+            renderJob.commandBuffers = {render[frame % SLOTS]};
+            renderJob.dependencies.push_back({simulations[frame], VK_PIPELINE_STAGE_TRANSFER_BIT});
+            renders.push_back(scheduler->Add(renderJob));
+            scheduler->Flush();
+
+            // The staging slot was last read by the upload two frames back
+            if (frame >= SLOTS)
+                scheduler->Wait(uploads[frame - SLOTS]);
+            fill(frame);
+            scheduler->CompleteHostJob(filled);
+            if (frame > 0) {
+                scheduler->Wait(renders[frame - 1]);
+                check(frame - 1);
+            }
+        }
+        scheduler->Wait(renders.back());
+        check(frameCount - 1);
+        double dagMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        // Same work, every step waited for before the next one goes out
+        start = chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < frameCount; frame++) {
+            fill(frame);
+            QueueJob uploadJob;
+            uploadJob.queue = QueueRole::Transfer;
+            uploadJob.commandBuffers = {upload[frame % SLOTS]};
+            scheduler->Wait(scheduler->Add(uploadJob));
+            QueueJob simulateJob;
+            simulateJob.queue = QueueRole::Compute;
+            simulateJob.commandBuffers = {simulate};
+            scheduler->Wait(scheduler->Add(simulateJob));
+            QueueJob renderJob;
+            renderJob.queue = QueueRole::Graphics;
+            renderJob.commandBuffers = {render[frame % SLOTS]};
+            scheduler->Wait(scheduler->Add(renderJob));
+            check(frame);
+        }
+        double serialMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        // Completing a host job that was never added would release GPU work waiting on the ones after it
+        bool rejected = false;
+        try {
+            scheduler->CompleteHostJob({filled.lane, filled.value + 1});
+        } catch (runtime_error &) {
+            rejected = true;
+        }
+
+        cout << frameCount << " frames of " << size / (1024 * 1024) << " MiB" << endl;
+        cout << "timeline DAG\t" << dagMs / frameCount << " ms per frame" << endl;
+        cout << "serialized\t" << serialMs / frameCount << " ms per frame" << endl;
+        cout << (correct ? "Every frame arrived intact" : "FAILED, a frame was corrupted") << endl;
+        if (!rejected)
+            cout << "FAILED, completed a host job that was never added" << endl;
+
+        delete scheduler;
+        for (VkCommandPool pool: pools)
+            vkDestroyCommandPool(device.device, pool, nullptr);
+        allocator->DestroyBuffer(simulated.buffer, simulated.allocation);
+        allocator->DestroyBuffer(uploaded.buffer, uploaded.allocation);
+        for (uint32_t i = 0; i < SLOTS; i++) {
+            allocator->DestroyBuffer(readback[i].buffer, readback[i].allocation);
+            allocator->DestroyBuffer(staging[i].buffer, staging[i].allocation);
+        }
+        delete allocator;
+        return correct && rejected ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,147 @@
+// Quantizes a finely tessellated sphere and decodes it again the way the vertex stage does, to show how much smaller
+// the vertex streams get and how much precision that costs, failing when any attribute loses more than its format
+// allows. Also checks the inputs that used to slip through: zero normals, indices past the vertices and flat meshes.
+// CPU only, no device needed.
+// Usage: Cpptests_meshbench [segments]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+#include "mesh/quantizedmesh.h"
+
+using namespace std;
+
+// Worst case decode errors. Positions and uvs get a whole step of their format where half would do, normals and tangents
+// are mostly float noise in acos near 1.
+static const float NORMAL_ERROR_DEGREES = 0.1f;
+static const float UV_ERROR = 1.0f / 2048.0f;
+
+// A zero normal has to encode to something decodable, a bad index must be rejected rather than quietly kept, and a
+// flat mesh still needs an invertible dequantize transform
+static bool edgeCases() {
+    bool ok = true;
+    glm::vec3 zero = QuantizedMesh::OctahedralDecode(glm::unpackSnorm2x16(glm::packSnorm2x16(QuantizedMesh::OctahedralEncode(glm::vec3(0.0f)))));
+    if (zero != glm::vec3(0.0f, 0.0f, 1.0f)) {
+        cout << "FAILED: a zero normal didn't decode to +Z" << endl;
+        ok = false;
+    }
+
+    MeshData triangle;
+    triangle.positions = {glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)};
+    triangle.normals = {glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f)};
+    for (uint32_t bad: {3u, 65536u + 2}) {
+        triangle.indices = {0, 1, bad};
+        try {
+            QuantizedMesh::Quantize(triangle);
+            cout << "FAILED: index " << bad << " past the vertices was accepted" << endl;
+            ok = false;
+        } catch (runtime_error&) {
+        }
+    }
+    triangle.indices = {0, 1, 2};
+    QuantizedMesh quantized = QuantizedMesh::Quantize(triangle);
+    if (quantized.indexType != VK_INDEX_TYPE_UINT16) {
+        cout << "FAILED: a small mesh didn't get 16 bit indices" << endl;
+        ok = false;
+    }
+    // The triangle is flat in z, that axis must not scale to zero
+    glm::mat4 dequantize = quantized.DequantizeTransform();
+    if (glm::determinant(dequantize) == 0.0f || dequantize * glm::vec4(1.0f, 0.0f, 0.0f, 1.0f) != glm::vec4(1.0f, 0.0f, 0.0f, 1.0f)) {
+        cout << "FAILED: a flat mesh got a singular or wrong dequantize transform" << endl;
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    uint32_t segments = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 512;
+    if (segments < 3) {
+        cout << "need at least 3 segments" << endl;
+        return 1;
+    }
+
+    // Sphere of radius 10 away from the origin, so the bounds don't start at zero
+    MeshData mesh;
+    glm::vec3 center(100.0f, -20.0f, 5.0f);
+    for (uint32_t ring = 0; ring <= segments; ring++) {
+        float theta = glm::pi<float>() * ring / segments;
+        for (uint32_t segment = 0; segment <= segments; segment++) {
+            float phi = 2.0f * glm::pi<float>() * segment / segments;
+            glm::vec3 normal(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            mesh.positions.push_back(center + normal * 10.0f);
+            mesh.normals.push_back(normal);
+            mesh.tangents.push_back(glm::vec4(-sin(phi), 0.0f, cos(phi), segment % 2 ? 1.0f : -1.0f));
+            mesh.uvs.push_back(glm::vec2(static_cast<float>(segment) / segments, static_cast<float>(ring) / segments));
+            mesh.colors.push_back(glm::vec4(normal * 0.5f + 0.5f, 1.0f));
+        }
+    }
+    for (uint32_t ring = 0; ring < segments; ring++) {
+        for (uint32_t segment = 0; segment < segments; segment++) {
+            uint32_t a = ring * (segments + 1) + segment;
+            uint32_t b = a + segments + 1;
+            mesh.indices.insert(mesh.indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+        }
+    }
+
+    try {
+        auto start = chrono::steady_clock::now();
+        QuantizedMesh quantized = QuantizedMesh::Quantize(mesh);
+        double quantizeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        // What the vertex input formats and the vertex shader do on the GPU
+        glm::mat4 dequantize = quantized.DequantizeTransform();
+        float positionError = 0.0f, normalError = 0.0f, tangentError = 0.0f, uvError = 0.0f;
+        bool handedness = true;
+        for (size_t i = 0; i < mesh.positions.size(); i++) {
+            uint64_t packedPosition;
+            memcpy(&packedPosition, &quantized.positions[i], sizeof(packedPosition));
+            glm::vec4 position = glm::unpackUnorm4x16(packedPosition);
+            glm::vec3 decodedPosition = glm::vec3(dequantize * glm::vec4(glm::vec3(position), 1.0f));
+            glm::vec3 normal = QuantizedMesh::OctahedralDecode(glm::unpackSnorm2x16(quantized.attributes[i].normal));
+            glm::vec3 tangent = QuantizedMesh::OctahedralDecode(glm::unpackSnorm2x16(quantized.attributes[i].tangent));
+            glm::vec2 uv = glm::unpackHalf2x16(quantized.attributes[i].uv);
+
+            positionError = max(positionError, glm::length(decodedPosition - mesh.positions[i]));
+            normalError = max(normalError, acos(glm::clamp(glm::dot(normal, mesh.normals[i]), -1.0f, 1.0f)));
+            tangentError = max(tangentError, acos(glm::clamp(glm::dot(tangent, glm::vec3(mesh.tangents[i])), -1.0f, 1.0f)));
+            uvError = max(uvError, glm::length(uv - mesh.uvs[i]));
+            handedness = handedness && (position.w * 2.0f - 1.0f) == mesh.tangents[i].w;
+        }
+
+        size_t vertexCount = mesh.positions.size();
+        size_t floatBytes = vertexCount * (sizeof(glm::vec3) * 2 + sizeof(glm::vec4) * 2 + sizeof(glm::vec2));
+        size_t floatIndexBytes = mesh.indices.size() * sizeof(uint32_t);
+        cout << vertexCount << " vertices, " << mesh.indices.size() / 3 << " triangles, quantized in " << quantizeMs << " ms" << endl;
+        cout << "vertex bytes\t" << floatBytes << " -> " << quantized.VertexBytes()
+             << " (" << floatBytes / vertexCount << " -> " << quantized.VertexBytes() / vertexCount << " per vertex)" << endl;
+        cout << "index bytes\t" << floatIndexBytes << " -> " << quantized.IndexBytes()
+             << (quantized.indexType == VK_INDEX_TYPE_UINT16 ? " (16 bit)" : " (32 bit)") << endl;
+        cout << "max position error\t" << positionError << " (radius 10)" << endl;
+        cout << "max normal error\t" << glm::degrees(normalError) << " degrees" << endl;
+        cout << "max tangent error\t" << glm::degrees(tangentError) << " degrees" << endl;
+        cout << "max uv error\t\t" << uvError << endl;
+        cout << "tangent handedness\t" << (handedness ? "kept" : "FAILED") << endl;
+
+        bool correct = handedness;
+        auto check = [&correct](bool ok, const char *what) {
+            if (!ok) {
+                cout << "FAILED: " << what << endl;
+                correct = false;
+            }
+        };
+        // One unorm16 step over the bounds diagonal
+        check(positionError <= glm::length(quantized.boundsMax - quantized.boundsMin) / 65535.0f, "position error over one unorm16 step");
+        check(glm::degrees(normalError) <= NORMAL_ERROR_DEGREES, "normal error over the octahedral budget");
+        check(glm::degrees(tangentError) <= NORMAL_ERROR_DEGREES, "tangent error over the octahedral budget");
+        check(uvError <= UV_ERROR, "uv error over one half float step");
+        bool edges = edgeCases();
+        return correct && edges ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,91 @@
+// Measures how command recording scales with the number of CommandRecorder threads.
+// Usage: Cpptests_recordbench [items] [iterations]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/commandrecorder.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+    uint32_t items = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 100000;
+    uint32_t iterations = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 20;
+
+    try {
+        BenchContext context("Cpptests record bench");
+        LogicalDevice &device = context.device;
+
+        // Something cheap to record per item, this measures recording overhead and not GPU work
+        MemoryAllocator *allocator = new MemoryAllocator(device);
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = 64 * 1024;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        Allocation allocation;
+        VkBuffer buffer = allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, allocation);
+        RecordFunction record = [buffer](VkCommandBuffer commandBuffer, uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; i++) {
+                vkCmdFillBuffer(commandBuffer, buffer, (i % 4096) * 16, 16, i);
+            }
+        };
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+        VkCommandPool pool;
+        vkCreateCommandPool(device.device, &poolInfo, nullptr, &pool);
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer primary;
+        vkAllocateCommandBuffers(device.device, &allocInfo, &primary);
+
+        uint32_t maxThreads = max(thread::hardware_concurrency(), 1u);
+        vector<uint32_t> threadCounts;
+        for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(maxThreads);
+
+        cout << items << " items, " << iterations << " iterations" << endl;
+        cout << "threads\tms\tspeedup" << endl;
+        double singleThreaded = 0.0;
+        for (uint32_t threads: threadCounts) {
+            CommandRecorder recorder(device, 1, threads);
+            chrono::steady_clock::duration total{};
+            for (uint32_t i = 0; i < iterations; i++) {
+                vkResetCommandPool(device.device, pool, 0);
+                VkCommandBufferBeginInfo beginInfo{};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                vkBeginCommandBuffer(primary, &beginInfo);
+                recorder.Record(primary, 0, items, record);
+                vkEndCommandBuffer(primary);
+                total += recorder.LastRecordTime();
+            }
+
+            double ms = chrono::duration<double, milli>(total).count() / iterations;
+            if (threads == 1)
+                singleThreaded = ms;
+            cout << threads << "\t" << ms << "\t" << singleThreaded / ms << "x" << endl;
+        }
+
+        vkDestroyCommandPool(device.device, pool, nullptr);
+        allocator->DestroyBuffer(buffer, allocation);
+        delete allocator;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
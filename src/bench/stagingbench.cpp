@@ -0,0 +1,216 @@
+// Pushes buffers and an image through a small StagingRing until it has wrapped several times, then acquires them on
+// the graphics queue and copies everything back to the host. Space reclaimed too early shows up as another upload's
+// bytes, a missing ownership transfer or layout change as garbage. Runs on any device with timeline semaphores,
+// including lavapipe, where transfer and graphics share a family and no ownership transfer is needed.
+// Usage: Cpptests_stagingbench [buffers]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/stagingring.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+// Small, so a few dozen uploads wrap it several times
+const VkDeviceSize RING_SIZE = 256 * 1024;
+// More than a quarter of the ring, UploadBuffer has to split it
+const VkDeviceSize BIG_SIZE = 200 * 1024;
+const uint32_t IMAGE_SIZE = 64;
+const VkDeviceSize IMAGE_BYTES = IMAGE_SIZE * IMAGE_SIZE * 4;
+// Flushed every few uploads like a frame would, the ring flushes on its own when it runs out in between
+const uint32_t UPLOADS_PER_FLUSH = 5;
+
+struct Upload {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation allocation;
+    vector<uint8_t> data;
+    VkDeviceSize readbackOffset;
+};
+
+static vector<uint8_t> pattern(uint32_t seed, VkDeviceSize size) {
+    vector<uint8_t> data(size);
+    for (VkDeviceSize i = 0; i < size; i++)
+        data[i] = static_cast<uint8_t>(seed * 31 + i * 7 + (i >> 8));
+    return data;
+}
+
+int main(int argc, char **argv) {
+    uint32_t bufferCount = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 64;
+    // 16 of the smallest already wrap the ring twice
+    bufferCount = max(bufferCount, 16u);
+
+    try {
+        BenchContext context("Cpptests staging bench");
+        LogicalDevice &device = context.device;
+        MemoryAllocator *allocator = new MemoryAllocator(device);
+        StagingRing *ring = new StagingRing(device, *allocator, RING_SIZE);
+        bool ok = true;
+        auto check = [&ok](bool condition, const char *what) {
+            if (!condition) {
+                cout << "FAILED: " << what << endl;
+                ok = false;
+            }
+        };
+
+        // Odd sizes so the ring's copy alignment matters, plus one that has to be split
+        vector<Upload> uploads(bufferCount + 1);
+        VkDeviceSize readbackSize = 0;
+        for (uint32_t i = 0; i < uploads.size(); i++) {
+            VkDeviceSize size = i == bufferCount ? BIG_SIZE : 40000 + i * 37;
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = size;
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            uploads[i].buffer = allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, uploads[i].allocation);
+            uploads[i].data = pattern(i, size);
+            uploads[i].readbackOffset = readbackSize;
+            readbackSize += size;
+        }
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageInfo.extent = {IMAGE_SIZE, IMAGE_SIZE, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        Allocation imageAllocation;
+        VkImage image = allocator->CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, imageAllocation);
+        vector<uint8_t> texels = pattern(bufferCount + 1, IMAGE_BYTES);
+        // Image copies need a multiple of the texel size
+        readbackSize = (readbackSize + 3) / 4 * 4;
+        VkDeviceSize imageReadbackOffset = readbackSize;
+        readbackSize += IMAGE_BYTES;
+
+        // The image goes in the middle, after the ring has wrapped at least once
+        VkDeviceSize uploaded = 0;
+        uint64_t lastValue = 0;
+        auto start = chrono::steady_clock::now();
+        for (uint32_t i = 0; i < uploads.size(); i++) {
+            ring->UploadBuffer(uploads[i].buffer, 0, uploads[i].data.data(), uploads[i].data.size());
+            uploaded += uploads[i].data.size();
+            if (i == uploads.size() / 2) {
+                ring->UploadImage(image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, imageInfo.extent, {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1}, texels.data(), IMAGE_BYTES);
+                uploaded += IMAGE_BYTES;
+            }
+            if (i % UPLOADS_PER_FLUSH == UPLOADS_PER_FLUSH - 1)
+                lastValue = ring->Flush();
+        }
+        lastValue = ring->Flush();
+        double uploadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        check(uploaded > RING_SIZE * 2, "the uploads didn't wrap the ring");
+
+        VkBufferCreateInfo readbackInfo{};
+        readbackInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        readbackInfo.size = readbackSize;
+        readbackInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        readbackInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        Allocation readbackAllocation;
+        VkBuffer readback = allocator->CreateBuffer(readbackInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, readbackAllocation);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+        VkCommandPool pool;
+        if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+            throw runtime_error("error creating command pool");
+        }
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw runtime_error("error allocating command buffer");
+        }
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        if (vkCreateFence(device.device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+            throw runtime_error("error creating fence");
+        }
+
+        // The consumer: acquires everything on the graphics queue and copies it out
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        ring->RecordAcquireBarriers(commandBuffer);
+        for (const Upload &upload: uploads) {
+            VkBufferCopy region{};
+            region.dstOffset = upload.readbackOffset;
+            region.size = upload.data.size();
+            vkCmdCopyBuffer(commandBuffer, upload.buffer, readback, 1, &region);
+        }
+        VkBufferImageCopy imageRegion{};
+        imageRegion.bufferOffset = imageReadbackOffset;
+        imageRegion.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        imageRegion.imageExtent = imageInfo.extent;
+        vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback, 1, &imageRegion);
+        VkMemoryBarrier hostBarrier{};
+        hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSemaphore timeline = ring->Timeline();
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &lastValue;
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &timeline;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+            throw runtime_error("error submitting readback");
+        }
+        if (vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+            throw runtime_error("error waiting for readback");
+        }
+
+        const uint8_t *bytes = static_cast<const uint8_t*>(readbackAllocation.mapped);
+        bool buffersIntact = true;
+        for (const Upload &upload: uploads)
+            buffersIntact = buffersIntact && memcmp(bytes + upload.readbackOffset, upload.data.data(), upload.data.size()) == 0;
+        check(buffersIntact, "a buffer came back with different bytes, ring space was reused too early");
+        check(memcmp(bytes + imageReadbackOffset, texels.data(), IMAGE_BYTES) == 0, "the image came back with different texels");
+
+        bool ownership = device.queueFamilies.transferFamily.value() != device.queueFamilies.graphicsFamily.value();
+        cout << uploads.size() << " buffers and an image, " << uploaded / 1024 << " KiB through a " << RING_SIZE / 1024 << " KiB ring in "
+             << uploadMs << " ms, " << (ownership ? "with" : "without") << " ownership transfers" << endl;
+        cout << (ok ? "Everything arrived intact" : "FAILED, see above") << endl;
+
+        vkDestroyFence(device.device, fence, nullptr);
+        vkDestroyCommandPool(device.device, pool, nullptr);
+        delete ring;
+        allocator->DestroyBuffer(readback, readbackAllocation);
+        allocator->DestroyImage(image, imageAllocation);
+        for (Upload &upload: uploads)
+            allocator->DestroyBuffer(upload.buffer, upload.allocation);
+        delete allocator;
+        return ok ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
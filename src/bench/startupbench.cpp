@@ -0,0 +1,184 @@
+// Times every startup phase of VulkanApp::run over repeated cold and warm starts.
+// Cold runs delete the pipeline and shader caches first, so createComputePipeline compiles the shader with glslc and
+// the pipeline in the driver. Warm runs keep what the previous run left behind and load both from disk.
+// Every run is a fresh child process so nothing stays initialized in between, the parent only aggregates.
+// "startup" is the wall clock time from VulkanApp::run to the first frame, the other phases can overlap.
+// Usage: Cpptests_bench [--iterations N] [--output startup.json] [--headless] [--serial-init]
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "app/vulkanapp.h"
+#include "vulkan/childprocess.h"
+
+using namespace std;
+
+namespace {
+    const char *CHILD_TIMINGS_PATH = "startupbench_child.json";
+    const char *CHILD_LOG_PATH = "startupbench.log";
+
+    // Same as PhaseTimer's writer, control characters are dropped
+    string escape(const string &text) {
+        string escaped;
+        for (char c: text) {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+
+    struct PhaseSamples {
+        string name;
+        vector<double> ms;
+    };
+
+    // Runs in the child: one frame, then the phase timings go to path
+    int runChild(const string &path, bool headless, bool serialInit) {
+        AppOptions options;
+        options.headless = headless;
+        options.serialInit = serialInit;
+        options.frames = 1;
+        options.timingsPath = path;
+        try {
+            VulkanApp app(options);
+            app.run();
+        } catch(exception& e) {
+            cout << "exception: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    void clearCaches() {
+        error_code error;
+        filesystem::remove(PIPELINE_CACHE_PATH, error);
+        filesystem::remove_all(SHADER_CACHE_PATH, error);
+    }
+
+    // Phases keep the order they were first seen in, runs can skip some (e.g. no surface headless)
+    void addSample(vector<PhaseSamples> &phases, const string &name, double ms) {
+        auto phase = find_if(phases.begin(), phases.end(), [&](const PhaseSamples &p) { return p.name == name; });
+        if (phase == phases.end()) {
+            phases.push_back({name, {}});
+            phase = phases.end() - 1;
+        }
+        phase->ms.push_back(ms);
+    }
+
+    // The child is this same executable, started without a shell so odd paths need no quoting
+    vector<PhaseSamples> runIterations(const string &self, uint32_t iterations, bool cold, const vector<string> &flags) {
+        vector<string> args = {self, "--child", CHILD_TIMINGS_PATH};
+        args.insert(args.end(), flags.begin(), flags.end());
+        vector<PhaseSamples> phases;
+        for (uint32_t i = 0; i < iterations; i++) {
+            if (cold)
+                clearCaches();
+            filesystem::remove(CHILD_TIMINGS_PATH);
+            if (RunProcess(args, CHILD_LOG_PATH) != 0)
+                throw runtime_error(string("startup run failed, see ") + CHILD_LOG_PATH);
+
+            vector<PhaseTiming> timings = PhaseTimer::ReadJson(CHILD_TIMINGS_PATH);
+            if (timings.empty())
+                throw runtime_error("startup run wrote no timings");
+            for (const PhaseTiming &timing: timings)
+                addSample(phases, timing.name, timing.ms);
+        }
+        return phases;
+    }
+
+    void writeStats(ostream &out, const vector<PhaseSamples> &phases) {
+        for (size_t i = 0; i < phases.size(); i++) {
+            vector<double> ms = phases[i].ms;
+            sort(ms.begin(), ms.end());
+            double mean = 0.0;
+            for (double sample: ms)
+                mean += sample;
+            mean /= ms.size();
+            double median = ms.size() % 2 ? ms[ms.size() / 2] : (ms[ms.size() / 2 - 1] + ms[ms.size() / 2]) / 2.0;
+            out << "        {\"name\": \"" << escape(phases[i].name) << "\", \"samples\": " << ms.size()
+                << ", \"min\": " << ms.front() << ", \"median\": " << median << ", \"mean\": " << mean << ", \"max\": " << ms.back() << "}"
+                << (i + 1 < phases.size() ? "," : "") << "\n";
+        }
+    }
+
+    void printStats(const char *label, const vector<PhaseSamples> &phases) {
+        cout << label << " (median ms)" << endl;
+        for (const PhaseSamples &phase: phases) {
+            vector<double> ms = phase.ms;
+            sort(ms.begin(), ms.end());
+            cout << "  " << setw(32) << left << phase.name << right << setw(10) << ms[ms.size() / 2] << endl;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t iterations = 5;
+    string outputPath = "startup.json";
+    string childPath;
+    bool headless = false;
+    bool serialInit = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) {
+            iterations = max(static_cast<uint32_t>(stoul(argv[++i])), 1u);
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (arg == "--child" && i + 1 < argc) {
+            childPath = argv[++i];
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--serial-init") {
+            serialInit = true;
+        } else {
+            cout << "usage: " << argv[0] << " [--iterations N] [--output startup.json] [--headless] [--serial-init]" << endl;
+            return 1;
+        }
+    }
+    if (!childPath.empty())
+        return runChild(childPath, headless, serialInit);
+
+    try {
+        // Cold first, so the warm runs start from caches the last cold run wrote
+        vector<string> flags;
+        if (headless)
+            flags.push_back("--headless");
+        if (serialInit)
+            flags.push_back("--serial-init");
+        vector<PhaseSamples> cold = runIterations(argv[0], iterations, true, flags);
+        vector<PhaseSamples> warm = runIterations(argv[0], iterations, false, flags);
+        filesystem::remove(CHILD_TIMINGS_PATH);
+
+        cout << fixed << setprecision(3);
+        printStats("Cold", cold);
+        printStats("Warm", warm);
+
+        ofstream file(outputPath, ios::trunc);
+        if (!file)
+            throw runtime_error("could not write " + outputPath);
+#ifdef NDEBUG
+        const char *build = "release";
+#else
+        const char *build = "debug";
+#endif
+        file << fixed << setprecision(3);
+        file << "{\n    \"build\": \"" << build << "\",\n    \"headless\": " << (headless ? "true" : "false")
+             << ",\n    \"serialInit\": " << (serialInit ? "true" : "false")
+             << ",\n    \"iterations\": " << iterations << ",\n";
+        file << "    \"cold\": [\n";
+        writeStats(file, cold);
+        file << "    ],\n    \"warm\": [\n";
+        writeStats(file, warm);
+        file << "    ]\n}\n";
+        cout << "Wrote " << outputPath << endl;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,326 @@
+// Streams a 64k x 64k virtual texture, 16GiB as plain RGBA8, through a pool of a few hundred pages while a camera
+// pans across it. Feedback comes from the CPU instead of a shader so no pipeline is needed. Checks that residency
+// stays inside the pool and that every page the final view wants ends up resident. Then a small texture evicts a
+// page and asks for it again right away, which with sparse residency has to leave it bound to its new memory.
+// Usage: Cpptests_vtbench [--fallback] [--frames N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "vulkan/logicaldevice.h"
+#include "vulkan/memoryallocator.h"
+#include "vulkan/virtualtexture.h"
+#include "benchcontext.h"
+
+using namespace std;
+
+const uint32_t FRAMES_IN_FLIGHT = 2;
+// Pages visible at level 0, plus their parents
+const uint32_t VIEW_PAGES = 8;
+
+// Texels encode where they come from, a real loader would read a tile file here
+static void loadTexels(uint32_t level, VkOffset2D origin, VkExtent2D extent, uint8_t *texels) {
+    for (uint32_t y = 0; y < extent.height; y++) {
+        uint8_t *row = texels + static_cast<size_t>(y) * extent.width * 4;
+        for (uint32_t x = 0; x < extent.width; x++) {
+            row[x * 4 + 0] = static_cast<uint8_t>(origin.x + x);
+            row[x * 4 + 1] = static_cast<uint8_t>(origin.y + y);
+            row[x * 4 + 2] = static_cast<uint8_t>(level * 16);
+            row[x * 4 + 3] = 255;
+        }
+    }
+}
+
+// Command buffers and fences for FRAMES_IN_FLIGHT frames, each one updating a virtual texture and asking for pages
+class FrameLoop {
+    private:
+    const LogicalDevice &device;
+    VkCommandPool pool;
+    VkCommandBuffer commandBuffers[FRAMES_IN_FLIGHT];
+    VkFence fences[FRAMES_IN_FLIGHT];
+
+    public:
+    FrameLoop(const LogicalDevice &device) : device(device) {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+        if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+            throw runtime_error("error creating command pool");
+        }
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = FRAMES_IN_FLIGHT;
+        if (vkAllocateCommandBuffers(device.device, &allocInfo, commandBuffers) != VK_SUCCESS) {
+            throw runtime_error("error allocating command buffers");
+        }
+        for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+            if (vkCreateFence(device.device, &fenceInfo, nullptr, &fences[i]) != VK_SUCCESS) {
+                throw runtime_error("error creating fence");
+            }
+        }
+    }
+
+    ~FrameLoop() {
+        for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++)
+            vkDestroyFence(device.device, fences[i], nullptr);
+        vkDestroyCommandPool(device.device, pool, nullptr);
+    }
+
+    // Records what the shaders of the frame would have done with record and returns how long Update() took in us
+    double Run(VirtualTexture &texture, uint64_t frame, const function<void(VkCommandBuffer, uint32_t)> &record) {
+        uint32_t index = static_cast<uint32_t>(frame % FRAMES_IN_FLIGHT);
+        vkWaitForFences(device.device, 1, &fences[index], VK_TRUE, UINT64_MAX);
+        vkResetFences(device.device, 1, &fences[index]);
+
+        VkCommandBuffer commandBuffer = commandBuffers[index];
+        vkResetCommandBuffer(commandBuffer, 0);
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        auto start = chrono::steady_clock::now();
+        texture.Update(commandBuffer, index, frame);
+        double updateUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        record(commandBuffer, index);
+        texture.RecordFeedbackBarrier(commandBuffer);
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSemaphore bindSemaphore = texture.BindSemaphore();
+        uint64_t bindValue = texture.BindValue();
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &bindValue;
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        if (bindSemaphore != VK_NULL_HANDLE) {
+            submitInfo.pNext = &timelineInfo;
+            submitInfo.waitSemaphoreCount = 1;
+            submitInfo.pWaitSemaphores = &bindSemaphore;
+            submitInfo.pWaitDstStageMask = &waitStage;
+        }
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, fences[index]) != VK_SUCCESS) {
+            throw runtime_error("error submitting frame");
+        }
+        return updateUs;
+    }
+
+    void WaitIdle() {
+        vkWaitForFences(device.device, FRAMES_IN_FLIGHT, fences, VK_TRUE, UINT64_MAX);
+    }
+};
+
+// Views pages A and B of a level 0 quad until they are resident, glances at C and D for a single frame, which evicts
+// both, then looks at A and C. A comes back in B's old slot while C takes A's old one in the same update, so with
+// sparse residency reusing A's old slot must not unbind A again. The pool is the quad's parents plus two pages, which
+// depends on where the driver starts the mip tail, so a first texture is only made to find that out.
+static bool evictAndReload(const LogicalDevice &device, MemoryAllocator &allocator, FrameLoop &frames, bool forceFallback) {
+    VirtualTextureDesc desc;
+    desc.extent = {1024, 1024};
+    desc.poolPages = 1;
+    desc.framesInFlight = FRAMES_IN_FLIGHT;
+    desc.forceFallback = forceFallback;
+    uint32_t tailLevel;
+    VkExtent2D quadPages;
+    {
+        VirtualTexture probe(device, allocator, desc, loadTexels);
+        tailLevel = probe.Info().tailLevel;
+        quadPages = probe.LevelPages(0);
+    }
+    if (quadPages.width < 2 || quadPages.height < 2) {
+        cout << "Evict and reload skipped, level 0 is smaller than a quad of pages" << endl;
+        return true;
+    }
+    // Sparse: one parent per level below the tail. Fallback: the same minus the pinned last level, plus its slot.
+    desc.poolPages = tailLevel + 1;
+    VirtualTexture texture(device, allocator, desc, loadTexels);
+    const VirtualTextureInfo &info = texture.Info();
+
+    // Page A read back at the end, its level 0 region in the sparse image
+    VkExtent2D readExtent = {min(info.pageWidth, info.width), min(info.pageHeight, info.height)};
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = static_cast<VkDeviceSize>(readExtent.width) * readExtent.height * 4;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    Allocation readbackAllocation;
+    VkBuffer readback = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT, readbackAllocation);
+
+    const uint32_t settle = FRAMES_IN_FLIGHT * 3;
+    struct Phase {
+        uint32_t frames;
+        vector<pair<uint32_t, uint32_t>> view;
+    };
+    const Phase phases[] = {
+        {settle, {{0, 0}, {1, 0}}},
+        {1, {{0, 1}, {1, 1}}},
+        {settle, {{0, 0}, {0, 1}}},
+    };
+    uint64_t frame = 0;
+    for (const Phase &phase: phases) {
+        for (uint32_t i = 0; i < phase.frames; i++, frame++) {
+            frames.Run(texture, frame, [&texture, &phase](VkCommandBuffer, uint32_t index) {
+                for (auto &page: phase.view)
+                    texture.Request(index, 0, page.first, page.second);
+            });
+        }
+    }
+
+    bool readBack = texture.Sparse();
+    if (readBack) {
+        frames.Run(texture, frame, [&texture, &phases, readback, readExtent](VkCommandBuffer commandBuffer, uint32_t index) {
+            for (auto &page: phases[2].view)
+                texture.Request(index, 0, page.first, page.second);
+            VkImageMemoryBarrier toTransfer{};
+            toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            toTransfer.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            toTransfer.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            toTransfer.image = texture.Image();
+            toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+            VkBufferImageCopy region{};
+            region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            region.imageExtent = {readExtent.width, readExtent.height, 1};
+            vkCmdCopyImageToBuffer(commandBuffer, texture.Image(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback, 1, &region);
+
+            // Back to where Update() expects it
+            VkImageMemoryBarrier toShader = toTransfer;
+            toShader.srcAccessMask = 0;
+            toShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            toShader.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            toShader.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            VkMemoryBarrier toHost{};
+            toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                0, 1, &toHost, 0, nullptr, 1, &toShader);
+        });
+    }
+    frames.WaitIdle();
+
+    const VirtualTextureStats &stats = texture.Stats();
+    bool ok = stats.requestedPages == 0 && stats.totalEvictions >= 2;
+    if (!ok)
+        cout << "FAILED: the quad didn't go through eviction and back, " << stats.totalEvictions << " evictions, " << stats.requestedPages << " pages missing" << endl;
+    if (readBack) {
+        const uint8_t *texels = static_cast<const uint8_t*>(readbackAllocation.mapped);
+        bool intact = true;
+        for (uint32_t y = 0; y < readExtent.height; y++) {
+            for (uint32_t x = 0; x < readExtent.width; x++) {
+                const uint8_t *texel = texels + (static_cast<size_t>(y) * readExtent.width + x) * 4;
+                intact = intact && texel[0] == static_cast<uint8_t>(x) && texel[1] == static_cast<uint8_t>(y) && texel[2] == 0 && texel[3] == 255;
+            }
+        }
+        if (!intact)
+            cout << "FAILED: the reloaded page lost its memory when its old slot was reused" << endl;
+        ok = ok && intact;
+    }
+    cout << "Evict and reload " << (ok ? "kept the page" : "FAILED") << (readBack ? "" : " (resident, texels only checked with sparse residency)") << endl;
+
+    allocator.DestroyBuffer(readback, readbackAllocation);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    bool forceFallback = false;
+    uint32_t frameCount = 600;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--fallback") {
+            forceFallback = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frameCount = static_cast<uint32_t>(atoi(argv[++i]));
+        } else {
+            cout << "usage: " << argv[0] << " [--fallback] [--frames N]" << endl;
+            return 1;
+        }
+    }
+
+    try {
+        BenchContext context("Cpptests virtual texture bench");
+        LogicalDevice &device = context.device;
+        MemoryAllocator *allocator = new MemoryAllocator(device);
+
+        uint64_t loadedBytes = 0;
+        PageLoader loader = [&loadedBytes](uint32_t level, VkOffset2D origin, VkExtent2D extent, uint8_t *texels) {
+            loadTexels(level, origin, extent, texels);
+            loadedBytes += static_cast<uint64_t>(extent.width) * extent.height * 4;
+        };
+
+        VirtualTextureDesc desc;
+        desc.extent = {65536, 65536};
+        desc.poolPages = 256;
+        desc.maxUploadsPerFrame = 16;
+        desc.framesInFlight = FRAMES_IN_FLIGHT;
+        desc.forceFallback = forceFallback;
+        VirtualTexture *texture = new VirtualTexture(device, *allocator, desc, loader);
+        const VirtualTextureInfo &info = texture->Info();
+        VkExtent2D basePages = texture->LevelPages(0);
+        FrameLoop *frames = new FrameLoop(device);
+
+        // The camera pans diagonally for frameCount frames, then holds still long enough for streaming to catch up
+        uint32_t settleFrames = FRAMES_IN_FLIGHT + (VIEW_PAGES * VIEW_PAGES * 2) / desc.maxUploadsPerFrame + 8;
+        double updateTotalUs = 0.0, updateMaxUs = 0.0;
+        uint32_t maxResident = 0;
+        uint32_t pan = 0;
+        for (uint64_t frame = 0; frame < frameCount + settleFrames; frame++) {
+            // What the shaders of this frame would have written
+            if (frame < frameCount)
+                pan = static_cast<uint32_t>(frame / 4);
+            double updateUs = frames->Run(*texture, frame, [texture, pan, basePages](VkCommandBuffer, uint32_t index) {
+                for (uint32_t y = 0; y < VIEW_PAGES; y++) {
+                    for (uint32_t x = 0; x < VIEW_PAGES; x++) {
+                        texture->Request(index, 0, (pan + x) % basePages.width, (pan + y) % basePages.height);
+                    }
+                }
+            });
+            updateTotalUs += updateUs;
+            updateMaxUs = max(updateMaxUs, updateUs);
+            maxResident = max(maxResident, texture->Stats().residentPages);
+        }
+        frames->WaitIdle();
+
+        const VirtualTextureStats &stats = texture->Stats();
+        uint64_t virtualBytes = static_cast<uint64_t>(info.width) * info.height * 4 * 4 / 3;
+        uint64_t poolBytes = static_cast<uint64_t>(desc.poolPages) * info.pageWidth * info.pageHeight * 4;
+        cout << (texture->Sparse() ? "Sparse residency" : "Software page table") << ", " << texture->PageCount() << " pages of "
+             << info.pageWidth << "x" << info.pageHeight << ", tail from level " << info.tailLevel << endl;
+        cout << "virtual MiB\t" << virtualBytes / (1024 * 1024) << "\tpool MiB\t" << poolBytes / (1024 * 1024) << endl;
+        cout << "uploads\t\t" << stats.totalUploads << "\tevictions\t" << stats.totalEvictions << "\tloaded MiB\t" << loadedBytes / (1024 * 1024) << endl;
+        cout << "update us\t" << updateTotalUs / (frameCount + settleFrames) << " mean\t" << updateMaxUs << " max" << endl;
+        cout << "resident\t" << stats.residentPages << " now\t" << maxResident << " max" << endl;
+
+        bool ok = maxResident <= desc.poolPages && stats.requestedPages == 0;
+        cout << (ok ? "Streaming caught up with the view inside the pool" : "FAILED, pages still missing or pool exceeded") << endl;
+        delete texture;
+
+        bool reloaded = evictAndReload(device, *allocator, *frames, forceFallback);
+
+        delete frames;
+        delete allocator;
+        return ok && reloaded ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,83 @@
+// Measures what a CPU profiler zone costs on the thread that records it: two clock reads and a store into the
+// thread's ring. The zones are drained into a trace between batches, like FrameMark does every frame, so none get
+// dropped. The clock reads cost what the machine makes them cost, rdtsc alone takes ~18ns in some VMs, so the budget
+// is the two reads plus what the profiler adds. Fails when a zone costs more than that in a release build, debug
+// builds don't inline the timer and only report. Needs no GPU or window.
+// Usage: Cpptests_zonebench [zones]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include "profiler/cpuprofiler.h"
+
+using namespace std;
+
+// On top of the two timer reads, for the ring
+const double ZONE_OVERHEAD_NS = 15.0;
+#ifdef NDEBUG
+const bool ENFORCE_BUDGET = true;
+#else
+const bool ENFORCE_BUDGET = false;
+#endif
+// Well below the per thread ring size so a batch always fits
+const uint32_t BATCH = 4096;
+
+// Records count zones in batches and returns the average cost of one, without the drains in between. Zones are
+// constructed directly, PROFILE_ZONE is compiled out of release builds.
+static double measure(uint32_t count) {
+    double recordNs = 0.0;
+    for (uint32_t done = 0; done < count; done += BATCH) {
+        uint32_t batch = min(BATCH, count - done);
+        auto start = chrono::steady_clock::now();
+        for (uint32_t i = 0; i < batch; i++) {
+            CpuZone zone("Zone");
+        }
+        recordNs += chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        CpuProfiler::Collect();
+    }
+    return recordNs / count;
+}
+
+// One read of the zone timer, the same one the zones use
+static double measureTimer(uint32_t count) {
+    uint64_t sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++) {
+        sum += CpuProfiler::TimerValue();
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
+    // Keeps the reads from being optimized out
+    return sum == 0 ? ns + 1.0 : ns;
+}
+
+int main(int argc, char **argv) {
+    uint32_t count = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 1000000;
+    count = max(count, BATCH);
+
+    try {
+        TraceWriter trace(count + BATCH);
+        CpuProfiler::Start(&trace);
+        PROFILE_THREAD("Main");
+
+        // Touches the ring and the clock once before timing
+        measure(BATCH);
+        size_t warmup = trace.EventCount();
+        double zoneNs = measure(count);
+        double timerNs = measureTimer(count);
+        CpuProfiler::Stop();
+
+        double budgetNs = 2.0 * timerNs + ZONE_OVERHEAD_NS;
+        bool recorded = trace.EventCount() - warmup == count;
+        cout << count << " zones, " << zoneNs << " ns per zone, " << timerNs << " ns per timer read (budget " << budgetNs << " ns)" << endl;
+        if (!recorded)
+            cout << "FAILED: only " << trace.EventCount() - warmup << " zones reached the trace" << endl;
+        bool inBudget = zoneNs <= budgetNs || !ENFORCE_BUDGET;
+        if (zoneNs > budgetNs)
+            cout << (ENFORCE_BUDGET ? "FAILED: zones cost more than the budget" : "Over budget, but not enforced in debug builds") << endl;
+        return recorded && inBudget ? 0 : 1;
+    } catch(exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -1,212 +1,62 @@
-#define GLFW_INCLUDE_VULKAN
-
 #include <iostream>
-#include <vector>
+#include <limits>
 #include <string>
-#include "window/window.h"
-#include "vulkan/physicaldevice.h"
+#include "app/vulkanapp.h"
 
 using namespace std;
 
-const uint32_t WIDTH = 800;
-const uint32_t HEIGHT = 600;
-#ifdef NDEBUG
-    const bool enableValidationLayers = false;
-#else
-    const bool enableValidationLayers = true;
-#endif
-
-class VulkanApp {
-public:
-    void run() {
-        createWindow();
-        initVulkan();
-        mainLoop();
-        cleanup();
-    };
-
-private:
-    Window *window;
-    VkInstance instance = VK_NULL_HANDLE;
-    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-
-    static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-        VkDebugUtilsMessageTypeFlagsEXT messageType,
-        const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-        void* pUserData) {
-
-        std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
-
-        return VK_FALSE;
-    }
-    
-    void createWindow() {
-        window = new Window(WIDTH, HEIGHT, "Finestra");
-    }
-    
-    void initVulkan() {
-        printSupportedExtensions();
-        if (enableValidationLayers)
-            printSupportedLayers();
-        createInstance();
-        createPhysicalDevice();
-    }
-
-    void mainLoop() {
-        while(!window->ShouldClose()) {
-            window->PollEvents();
-        }
-    }
-
-    void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
-        createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-        createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-        createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-        createInfo.pfnUserCallback = debugCallback;
-    }
-
-    void createInstance() {
-        VkApplicationInfo appInfo{};
-        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        appInfo.apiVersion = VK_API_VERSION_1_2;
-        appInfo.pApplicationName = "G's Vulkan Test";
-        appInfo.applicationVersion = 0;
-
-        VkInstanceCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.pApplicationInfo = &appInfo;
-
-        // Vulkan has no concept of window et al, so it need extensions to interact with it. GLFW conveniently provides some help
-        uint32_t glfwExtensionCount = 1;
-        const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-        createInfo.enabledExtensionCount = glfwExtensionCount;
-        createInfo.ppEnabledExtensionNames = glfwExtensions;
-        createInfo.enabledLayerCount = 0;
-
-        std::vector<const char*> validationLayerNames = {
-            "VK_LAYER_KHRONOS_validation"
-        };
-        VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
-        if (enableValidationLayers) {
-        
-            bool allLayersSupported = true;
-            cout << validationLayerNames.size() << " validation layers required" << endl;
-            for (auto layer: validationLayerNames) {
-                bool supported = supportsVkLayer(layer);
-                cout << "- " << layer;
-                if (supported) {
-                    cout << " (Supported)" << endl;
-                } else {
-                    cout << " (NOT supported)" << endl;
-                    allLayersSupported = false;
-                }
-            }
-
-            if (!allLayersSupported) {
-                throw std::runtime_error("error initializing validation layers: required extension not supported");
-            }
-            
-            createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayerNames.size());
-            createInfo.ppEnabledLayerNames = validationLayerNames.data();
-            
-            populateDebugMessengerCreateInfo(debugCreateInfo);
-            createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
-            cout << "Validation layers enabled" << endl;
-        }
-
-        bool allExtSupported = true;
-        cout << glfwExtensionCount << " extensions required:" << endl;
-        for (uint32_t i = 0; i < glfwExtensionCount; i++) {
-            bool supported = supportsVkExtension(glfwExtensions[i]);
-            cout << "- " << glfwExtensions[i];
-            if (supported) {
-                cout << " (Supported)" << endl;
-            } else {
-                cout << " (NOT supported)" << endl;
-                allExtSupported = false;
-            }
-        }
-
-        if (!allExtSupported) {
-            throw std::runtime_error("unsupported Vulkan extension/s");
-        }
-
-        VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("error creating instance");
-        }
-    }
-
-    void createPhysicalDevice() {
-        PhysicalDeviceBuilder pdBuilder(instance);
-        physicalDevice = pdBuilder.Build();
-    }
-
-    void cleanup() {
-        vkDestroyInstance(instance, nullptr);
-        delete window;
-    }
-
-    bool supportsVkExtension(const char *name) {
-        uint32_t extensionCount = 0;
-        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
-        vector<VkExtensionProperties> extensions(extensionCount);
-        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
-
-        for (const VkExtensionProperties extension: extensions) {
-            if (strcmp(name, extension.extensionName) == 0) {
-                return true;
-            }
-        }
+// Whole string has to be a number that fits, stoul alone takes "12abc" and wraps "-1"
+static bool parseFrames(const string &text, uint32_t &frames) {
+    if (text.empty() || text[0] == '-') {
         return false;
     }
-
-    bool supportsVkLayer(const char *name) {
-        uint32_t layerCount = 0;
-        vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-        vector<VkLayerProperties> layers(layerCount);
-        vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
-
-        for (const VkLayerProperties layer: layers) {
-            if (strcmp(name, layer.layerName) == 0) {
-                return true;
-            }
+    try {
+        size_t used = 0;
+        unsigned long value = stoul(text, &used);
+        if (used != text.size() || value > numeric_limits<uint32_t>::max()) {
+            return false;
         }
+        frames = static_cast<uint32_t>(value);
+        return true;
+    } catch (const logic_error &) {
         return false;
     }
+}
 
-    void printSupportedExtensions() {
-        uint32_t extensionCount = 0;
-        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
-        vector<VkExtensionProperties> extensions(extensionCount);
-        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
-
-        cout << extensionCount << " extensions supported:" << endl;
-        for (const VkExtensionProperties extension: extensions) {
-            cout << "- " << extension.extensionName << endl;
+int main(int argc, char **argv)
+{
+    AppOptions options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--frames" && i + 1 < argc && parseFrames(argv[i + 1], options.frames)) {
+            i++;
+        } else if (arg == "--readback" && i + 1 < argc) {
+            options.readbackPath = argv[++i];
+        } else if (arg == "--timings" && i + 1 < argc) {
+            options.timingsPath = argv[++i];
+        } else if (arg == "--serial-init") {
+            options.serialInit = true;
+        } else if (arg == "--device-group" && i + 1 < argc && string(argv[i + 1]) == "sfr") {
+            options.groupMode = GroupRenderMode::SplitFrame;
+            i++;
+        } else if (arg == "--device-group" && i + 1 < argc && string(argv[i + 1]) == "afr") {
+            options.groupMode = GroupRenderMode::AlternateFrame;
+            i++;
+        } else {
+            cout << "usage: " << argv[0] << " [--headless [--readback frame.ppm] [--device-group sfr|afr]] [--frames N] [--timings startup.json] [--serial-init]" << endl;
+            return 1;
         }
     }
-
-    void printSupportedLayers() {
-        uint32_t layerCount = 0;
-        vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-        vector<VkLayerProperties> layers(layerCount);
-        vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
-
-        cout << layerCount << " layers supported:" << endl;
-        for (const VkLayerProperties layer: layers) {
-            cout << "- " << layer.layerName << endl;
-        }
+    // Presenting from a device group needs the device group swapchain, which isn't there yet
+    if (options.groupMode != GroupRenderMode::Single && !options.headless) {
+        cout << "--device-group needs --headless" << endl;
+        return 1;
     }
-};
 
-
-int main()
-{
     try {
-        VulkanApp app = VulkanApp();
+        VulkanApp app = VulkanApp(options);
         app.run();
     } catch(exception& e) {
         cout << "exception: " << e.what() << endl;
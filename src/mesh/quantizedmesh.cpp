@@ -0,0 +1,133 @@
+#include "quantizedmesh.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+QuantizedMesh QuantizedMesh::Quantize(const MeshData &mesh) {
+    size_t vertexCount = mesh.positions.size();
+    if (vertexCount == 0) {
+        throw std::runtime_error("can't quantize a mesh without positions");
+    }
+    auto check = [vertexCount](size_t count, const char *name) {
+        if (count != 0 && count != vertexCount)
+            throw std::runtime_error(std::string("mesh has a different number of ") + name + " and positions");
+    };
+    check(mesh.normals.size(), "normals");
+    check(mesh.tangents.size(), "tangents");
+    check(mesh.uvs.size(), "uvs");
+    check(mesh.colors.size(), "colors");
+
+    QuantizedMesh quantized;
+    quantized.boundsMin = mesh.positions[0];
+    quantized.boundsMax = mesh.positions[0];
+    for (const glm::vec3 &position: mesh.positions) {
+        quantized.boundsMin = glm::min(quantized.boundsMin, position);
+        quantized.boundsMax = glm::max(quantized.boundsMax, position);
+    }
+    // Flat meshes have a zero extent on some axis, anything works there as long as it isn't a division by zero
+    glm::vec3 extent = quantized.boundsMax - quantized.boundsMin;
+    glm::vec3 inverseExtent = glm::vec3(
+        extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    quantized.positions.resize(vertexCount);
+    quantized.attributes.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++) {
+        glm::vec3 normal = mesh.normals.empty() ? glm::vec3(0.0f, 0.0f, 1.0f) : mesh.normals[i];
+        glm::vec4 tangent = mesh.tangents.empty() ? glm::vec4(1.0f, 0.0f, 0.0f, 1.0f) : mesh.tangents[i];
+        glm::vec2 uv = mesh.uvs.empty() ? glm::vec2(0.0f) : mesh.uvs[i];
+        glm::vec4 color = mesh.colors.empty() ? glm::vec4(1.0f) : mesh.colors[i];
+
+        // packUnorm4x16 puts x in the low bits, which is the R16G16B16A16 memory order on little endian
+        glm::vec3 relative = (mesh.positions[i] - quantized.boundsMin) * inverseExtent;
+        uint64_t position = glm::packUnorm4x16(glm::vec4(relative, tangent.w < 0.0f ? 0.0f : 1.0f));
+        memcpy(&quantized.positions[i], &position, sizeof(position));
+
+        QuantizedAttributes &attributes = quantized.attributes[i];
+        attributes.normal = glm::packSnorm2x16(OctahedralEncode(normal));
+        attributes.tangent = glm::packSnorm2x16(OctahedralEncode(glm::vec3(tangent)));
+        attributes.uv = glm::packHalf2x16(uv);
+        attributes.color = glm::packUnorm4x8(color);
+    }
+
+    // An index past the vertices would read garbage on the GPU in either width, so it's an error rather than a reason
+    // to keep 32 bits
+    for (uint32_t index: mesh.indices) {
+        if (index >= vertexCount)
+            throw std::runtime_error("mesh index " + std::to_string(index) + " is past its " + std::to_string(vertexCount) + " vertices");
+    }
+    quantized.indexCount = static_cast<uint32_t>(mesh.indices.size());
+    if (vertexCount <= UINT16_MAX + 1) {
+        quantized.indexType = VK_INDEX_TYPE_UINT16;
+        quantized.indices.resize(mesh.indices.size() * sizeof(uint16_t));
+        uint16_t *indices16 = reinterpret_cast<uint16_t*>(quantized.indices.data());
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+            indices16[i] = static_cast<uint16_t>(mesh.indices[i]);
+    } else {
+        quantized.indexType = VK_INDEX_TYPE_UINT32;
+        quantized.indices.resize(mesh.indices.size() * sizeof(uint32_t));
+        memcpy(quantized.indices.data(), mesh.indices.data(), quantized.indices.size());
+    }
+    return quantized;
+}
+
+std::vector<VkVertexInputBindingDescription> QuantizedMesh::VertexBindings() {
+    return {
+        {0, sizeof(QuantizedPosition), VK_VERTEX_INPUT_RATE_VERTEX},
+        {1, sizeof(QuantizedAttributes), VK_VERTEX_INPUT_RATE_VERTEX},
+    };
+}
+
+// Locations 0 to 4: position, normal, tangent, uv, color
+std::vector<VkVertexInputAttributeDescription> QuantizedMesh::VertexAttributes() {
+    return {
+        {0, 0, VK_FORMAT_R16G16B16A16_UNORM, 0},
+        {1, 1, VK_FORMAT_R16G16_SNORM, offsetof(QuantizedAttributes, normal)},
+        {2, 1, VK_FORMAT_R16G16_SNORM, offsetof(QuantizedAttributes, tangent)},
+        {3, 1, VK_FORMAT_R16G16_SFLOAT, offsetof(QuantizedAttributes, uv)},
+        {4, 1, VK_FORMAT_R8G8B8A8_UNORM, offsetof(QuantizedAttributes, color)},
+    };
+}
+
+// Projects the unit vector on the octahedron |x| + |y| + |z| = 1 and unfolds the lower half over the corners,
+// which spreads the precision of two snorm16 values evenly over the sphere. A zero vector has no direction and
+// becomes +Z, the same default as a mesh without normals.
+glm::vec2 QuantizedMesh::OctahedralEncode(glm::vec3 normal) {
+    float length = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+    if (!(length > 0.0f))
+        return glm::vec2(0.0f);
+    normal /= length;
+    glm::vec2 encoded(normal.x, normal.y);
+    if (normal.z < 0.0f) {
+        glm::vec2 sign(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+    }
+    return encoded;
+}
+
+// What a vertex shader has to do after the R16G16_SNORM fetch
+glm::vec3 QuantizedMesh::OctahedralDecode(glm::vec2 encoded) {
+    glm::vec3 normal(encoded.x, encoded.y, 1.0f - glm::abs(encoded.x) - glm::abs(encoded.y));
+    float fold = glm::max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0.0f ? -fold : fold;
+    normal.y += normal.y >= 0.0f ? -fold : fold;
+    return glm::normalize(normal);
+}
+
+glm::mat4 QuantizedMesh::DequantizeTransform() const {
+    glm::vec3 extent = boundsMax - boundsMin;
+    glm::vec3 scale(extent.x > 0.0f ? extent.x : 1.0f, extent.y > 0.0f ? extent.y : 1.0f, extent.z > 0.0f ? extent.z : 1.0f);
+    return glm::scale(glm::translate(glm::mat4(1.0f), boundsMin), scale);
+}
+
+VkDeviceSize QuantizedMesh::VertexBytes() const {
+    return positions.size() * sizeof(QuantizedPosition) + attributes.size() * sizeof(QuantizedAttributes);
+}
+
+VkDeviceSize QuantizedMesh::IndexBytes() const {
+    return indices.size();
+}
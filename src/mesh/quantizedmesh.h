@@ -0,0 +1,59 @@
+#pragma once
+
+#include "vulkan/vulkanloader.h"
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Full precision vertex data as it comes out of an importer. Only positions are required, missing attributes get
+// defaults (normal +Z, tangent +X right handed, zero UVs, white).
+struct MeshData {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec4> tangents;    // w is the bitangent sign
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec4> colors;
+    std::vector<uint32_t> indices;
+};
+
+// Binding 0, R16G16B16A16_UNORM. Position relative to the mesh bounds, w is 1 for right handed tangent frames.
+// Kept apart from the rest so depth and shadow passes only fetch these 8 bytes.
+struct QuantizedPosition {
+    uint16_t x, y, z, w;
+};
+
+// Binding 1, everything else in 16 bytes
+struct QuantizedAttributes {
+    uint32_t normal;    // R16G16_SNORM, octahedral
+    uint32_t tangent;   // R16G16_SNORM, octahedral
+    uint32_t uv;        // R16G16_SFLOAT
+    uint32_t color;     // R8G8B8A8_UNORM
+};
+
+// Vertex streams at 24 bytes per vertex instead of 64 as floats. The vertex input formats turn everything back into
+// floats, a vertex shader only has to undo the octahedral mapping (as OctahedralDecode does), take the tangent sign
+// from position.w * 2 - 1 and apply DequantizeTransform() to positions. Indices are 16 bit when the vertex count
+// allows, Quantize throws on an index past the vertices.
+class QuantizedMesh {
+    public:
+    std::vector<QuantizedPosition> positions;
+    std::vector<QuantizedAttributes> attributes;
+    std::vector<uint8_t> indices;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+    uint32_t indexCount = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    static QuantizedMesh Quantize(const MeshData &mesh);
+    static std::vector<VkVertexInputBindingDescription> VertexBindings();
+    static std::vector<VkVertexInputAttributeDescription> VertexAttributes();
+    static glm::vec2 OctahedralEncode(glm::vec3 normal);
+    static glm::vec3 OctahedralDecode(glm::vec2 encoded);
+
+    // Maps unorm positions back into mesh space, multiply it into the model matrix for positions only. Its scale is the
+    // bounds extent and so not uniform: build the normal matrix from the model matrix alone, normals and tangents are
+    // already in mesh space. Flat axes get a scale of 1 (every position is 0 there), so it's always invertible.
+    glm::mat4 DequantizeTransform() const;
+    VkDeviceSize VertexBytes() const;
+    VkDeviceSize IndexBytes() const;
+};
@@ -0,0 +1,180 @@
+#include "cpuprofiler.h"
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(CPPTESTS_HAS_TSC) && !defined(_MSC_VER)
+    #include <cpuid.h>
+#endif
+
+namespace {
+    const uint64_t RING_SIZE = 1 << 14;
+
+    struct Zone {
+        const char *name;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    // Single producer (the owning thread), single consumer (Collect, serialized by collectMutex)
+    struct ThreadRing {
+        std::string name;
+        Zone zones[RING_SIZE];
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    TraceWriter *traceWriter = nullptr;
+    uint64_t startTicks = 0;
+    uint64_t startNs = 0;
+    double startUs = 0.0;
+    double nsPerTick = 1.0;
+    uint64_t lastFrameMark = 0;
+    uint64_t frameCount = 0;
+
+    // Rings are owned here and outlive their threads, so a thread exiting never loses zones that were not collected
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    std::mutex collectMutex;
+
+    thread_local ThreadRing *threadRing = nullptr;
+
+    ThreadRing* registerThread() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        rings.push_back(std::make_unique<ThreadRing>());
+        rings.back()->name = "Thread " + std::to_string(rings.size());
+        return rings.back().get();
+    }
+
+    uint64_t steadyNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Only a TSC that ticks at the same rate in every power state and on every core can be compared across threads
+    bool invariantTsc() {
+#if defined(CPPTESTS_HAS_TSC) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0x80000007);
+        return info[3] & (1 << 8);
+#elif defined(CPPTESTS_HAS_TSC)
+        unsigned int eax, ebx, ecx, edx;
+        return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+#else
+        return false;
+#endif
+    }
+
+    // The TSC rate against steady_clock over everything since Start(), more precise the longer the run
+    void calibrate(bool useTsc) {
+        if (!useTsc)
+            return;
+        uint64_t ticks = CpuProfiler::TimerValue();
+        uint64_t ns = steadyNs();
+        if (ticks > startTicks && ns > startNs)
+            nsPerTick = static_cast<double>(ns - startNs) / (ticks - startTicks);
+    }
+}
+
+// Lines the zone timer up with the trace timeline so CPU zones and GPU scopes end up on the same axis. Spins for a
+// fraction of a millisecond to get a first TSC rate, Collect() refines it.
+void CpuProfiler::Start(TraceWriter *trace) {
+    traceWriter = trace;
+    useTsc = invariantTsc();
+    // The first clock read can take microseconds to fault in the vDSO, that would skew the rate
+    steadyNs();
+    startTicks = TimerValue();
+    startNs = steadyNs();
+    startUs = TraceWriter::NowUs();
+    while (useTsc && steadyNs() - startNs < 200000) {}
+    calibrate(useTsc);
+    lastFrameMark = TimerValue();
+    running.store(true, std::memory_order_release);
+}
+
+void CpuProfiler::Stop() {
+    running.store(false, std::memory_order_release);
+    Collect();
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto &ring: rings) {
+        uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+        if (dropped > 0)
+            std::cout << "CPU profiler dropped " << dropped << " zones on " << ring->name << std::endl;
+    }
+}
+
+void CpuProfiler::push(const char *name, uint64_t start, uint64_t end) {
+    if (!threadRing)
+        threadRing = registerThread();
+
+    ThreadRing &ring = *threadRing;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= RING_SIZE) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring.zones[head & (RING_SIZE - 1)] = Zone{name, start, end};
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void CpuProfiler::SetThreadName(const std::string &name) {
+    if (!threadRing)
+        threadRing = registerThread();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    threadRing->name = name;
+}
+
+// Closes the frame zone on the calling thread's track and hands everything recorded so far to the trace
+void CpuProfiler::FrameMark() {
+    if (!running.load(std::memory_order_relaxed))
+        return;
+
+    uint64_t now = TimerValue();
+    if (frameCount++ > 0)
+        Record("Frame", lastFrameMark, now);
+    lastFrameMark = now;
+    Collect();
+}
+
+void CpuProfiler::Collect() {
+    if (!traceWriter)
+        return;
+
+    std::lock_guard<std::mutex> collectLock(collectMutex);
+    calibrate(useTsc);
+    std::vector<ThreadRing*> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto &ring: rings) {
+            snapshot.push_back(ring.get());
+        }
+    }
+
+    std::vector<TraceEvent> events;
+    for (ThreadRing *ring: snapshot) {
+        std::string track;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            track = ring->name;
+        }
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail < head; tail++) {
+            const Zone &zone = ring->zones[tail & (RING_SIZE - 1)];
+            // Opened before Start()
+            if (zone.start == 0)
+                continue;
+            TraceEvent event;
+            event.track = track;
+            event.name = zone.name;
+            event.startUs = startUs + static_cast<int64_t>(zone.start - startTicks) * nsPerTick / 1e3;
+            event.durationUs = (zone.end - zone.start) * nsPerTick / 1e3;
+            events.push_back(event);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    traceWriter->Add(events);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <x86intrin.h>
+    #endif
+    #define CPPTESTS_HAS_TSC 1
+#endif
+
+// Zones are compiled in for debug builds, and for release builds configured with CPPTESTS_PROFILE_RELEASE
+#if !defined(NDEBUG) || defined(CPPTESTS_PROFILE_RELEASE)
+    #define CPPTESTS_PROFILING 1
+#endif
+
+// Scoped CPU zones. Every thread writes finished zones into its own single producer ring, so recording takes no lock
+// and costs two timer reads and a store. The main thread drains the rings into the trace at every frame mark.
+// Timestamps are the invariant TSC on x86-64 and steady_clock elsewhere, zones recorded before Start() are ignored.
+// The timer read is inline, a zone is the two reads and one call into the ring.
+class CpuProfiler {
+    private:
+    static inline std::atomic<bool> running{false};
+    static inline bool useTsc = false;
+
+    public:
+    static void Start(TraceWriter *trace);
+    static void Stop();
+
+    // Zero until started, so zones from before Start() are dropped without reading the clock
+    static uint64_t Now() {
+        if (!running.load(std::memory_order_relaxed))
+            return 0;
+        return TimerValue();
+    }
+    static void Record(const char *name, uint64_t start, uint64_t end) {
+        if (running.load(std::memory_order_relaxed))
+            push(name, start, end);
+    }
+    static void SetThreadName(const std::string &name);
+
+    // Call once per frame on the main thread
+    static void FrameMark();
+    static void Collect();
+
+    // Reading the TSC is a few ns, steady_clock goes through the vDSO and costs several times that. The two reads per
+    // zone are most of what a zone costs.
+    static uint64_t TimerValue() {
+#ifdef CPPTESTS_HAS_TSC
+        if (useTsc)
+            return __rdtsc();
+#endif
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    private:
+    friend class CpuZone;
+    static void push(const char *name, uint64_t start, uint64_t end);
+};
+
+// Checks whether the profiler runs once, when it opens. One that ends after Stop() still lands in the ring and is
+// collected or overwritten later.
+class CpuZone {
+    private:
+    const char *name;
+    uint64_t start;
+
+    public:
+    CpuZone(const char *name) : name(name), start(CpuProfiler::Now()) {}
+    ~CpuZone() {
+        if (start != 0)
+            CpuProfiler::push(name, start, CpuProfiler::TimerValue());
+    }
+};
+
+#ifdef CPPTESTS_PROFILING
+    #define PROFILE_CONCAT_(a, b) a##b
+    #define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+    // name must outlive the profiler, string literals only
+    #define PROFILE_ZONE(name) CpuZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+    #define PROFILE_FRAME() CpuProfiler::FrameMark()
+    #define PROFILE_THREAD(name) CpuProfiler::SetThreadName(name)
+#else
+    #define PROFILE_ZONE(name)
+    #define PROFILE_FRAME()
+    #define PROFILE_THREAD(name)
+#endif
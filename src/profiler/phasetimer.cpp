@@ -0,0 +1,129 @@
+#include "phasetimer.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    // Same as the trace writer's, control characters are dropped
+    std::string escape(const std::string &text) {
+        std::string escaped;
+        for (char c: text) {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+
+    const std::string PHASE_NAME = "    {\"name\": \"";
+    const std::string PHASE_MS = "\", \"ms\": ";
+
+    // One line of WriteJson's output, e.g.     {"name": "Instance", "ms": 1.250},
+    // Only the escapes escape() makes are undone. False for anything else.
+    bool parsePhase(const std::string &line, PhaseTiming &phase, bool &last) {
+        if (line.compare(0, PHASE_NAME.size(), PHASE_NAME) != 0)
+            return false;
+        size_t pos = PHASE_NAME.size();
+        phase.name.clear();
+        while (pos < line.size() && line[pos] != '"') {
+            if (line[pos] == '\\') {
+                pos++;
+                if (pos >= line.size() || (line[pos] != '"' && line[pos] != '\\'))
+                    return false;
+            }
+            phase.name += line[pos++];
+        }
+        if (line.compare(pos, PHASE_MS.size(), PHASE_MS) != 0)
+            return false;
+        pos += PHASE_MS.size();
+
+        const char *start = line.c_str() + pos;
+        char *end = nullptr;
+        phase.ms = std::strtod(start, &end);
+        if (end == start)
+            return false;
+        std::string rest(end);
+        last = rest == "}";
+        return last || rest == "},";
+    }
+}
+
+PhaseTimer::PhaseTimer(TraceWriter *trace) {
+    this->trace = trace;
+}
+
+// Phases that throw aren't recorded, startup is aborted anyway
+void PhaseTimer::Run(const char *name, const std::function<void()> &phase) {
+    double start = TraceWriter::NowUs();
+    phase();
+    Record(name, start, TraceWriter::NowUs());
+}
+
+void PhaseTimer::Record(const char *name, double startUs, double endUs) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        phases.push_back({name, (endUs - startUs) / 1000.0});
+    }
+    if (trace)
+        trace->Add({"Startup", name, startUs, endUs - startUs});
+}
+
+std::vector<PhaseTiming> PhaseTimer::Phases() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return phases;
+}
+
+// One phase per line so the output diffs nicely between runs
+bool PhaseTimer::WriteJson(const std::string &path) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        std::cout << "Could not write phase timings to " << path << std::endl;
+        return false;
+    }
+
+    std::vector<PhaseTiming> snapshot = Phases();
+    file << std::fixed << std::setprecision(3) << "{\"phases\": [\n";
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        file << "    {\"name\": \"" << escape(snapshot[i].name) << "\", \"ms\": " << snapshot[i].ms << "}"
+             << (i + 1 < snapshot.size() ? "," : "") << "\n";
+    }
+    file << "]}\n";
+    return true;
+}
+
+void PhaseTimer::Print() {
+    std::vector<PhaseTiming> snapshot = Phases();
+    std::cout << std::fixed << std::setprecision(3);
+    for (const PhaseTiming &phase: snapshot)
+        std::cout << std::setw(32) << std::left << phase.name << std::right << std::setw(10) << phase.ms << "ms" << std::endl;
+    std::cout << std::defaultfloat;
+}
+
+std::vector<PhaseTiming> PhaseTimer::ReadJson(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("could not read phase timings from " + path);
+    }
+    std::string line;
+    if (!std::getline(file, line) || line != "{\"phases\": [") {
+        throw std::runtime_error(path + " is not a phase timings file");
+    }
+    std::vector<PhaseTiming> result;
+    bool last = false;
+    while (std::getline(file, line) && line != "]}") {
+        PhaseTiming phase;
+        if (last || !parsePhase(line, phase, last)) {
+            throw std::runtime_error(path + " has a malformed phase line: " + line);
+        }
+        result.push_back(phase);
+    }
+    // No closing line means a truncated file, a trailing comma means a lost phase
+    if (line != "]}" || (!result.empty() && !last)) {
+        throw std::runtime_error(path + " is truncated");
+    }
+    return result;
+}
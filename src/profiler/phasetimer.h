@@ -0,0 +1,33 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "trace.h"
+
+struct PhaseTiming {
+    std::string name;
+    double ms = 0.0;
+};
+
+// Wall clock time of one-off phases like startup and shutdown, in the order they finished. Phases can overlap when
+// they run on different threads, so they don't add up to the total.
+// Also shows them on a "Startup" track when given a trace.
+class PhaseTimer {
+    private:
+    std::mutex mutex;
+    std::vector<PhaseTiming> phases;
+    TraceWriter *trace;
+
+    public:
+    PhaseTimer(TraceWriter *trace = nullptr);
+
+    void Run(const char *name, const std::function<void()> &phase);
+    void Record(const char *name, double startUs, double endUs);
+    std::vector<PhaseTiming> Phases();
+    bool WriteJson(const std::string &path);
+    // Reads back what WriteJson wrote, throws on anything that isn't exactly that
+    static std::vector<PhaseTiming> ReadJson(const std::string &path);
+    void Print();
+};
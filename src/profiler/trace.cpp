@@ -0,0 +1,88 @@
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+    const auto traceEpoch = std::chrono::steady_clock::now();
+
+    std::string escape(const std::string &text) {
+        std::string escaped;
+        for (char c: text) {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+}
+
+TraceWriter::TraceWriter(size_t maxEvents) {
+    this->maxEvents = maxEvents;
+}
+
+void TraceWriter::Add(TraceEvent event) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.size() >= maxEvents) {
+        dropped++;
+        return;
+    }
+    events.push_back(std::move(event));
+}
+
+void TraceWriter::Add(const std::vector<TraceEvent> &batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const TraceEvent &event: batch) {
+        if (events.size() >= maxEvents) {
+            dropped++;
+            continue;
+        }
+        events.push_back(event);
+    }
+}
+
+bool TraceWriter::Write(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        std::cout << "Could not write trace to " << path << std::endl;
+        return false;
+    }
+
+    // Chrome wants numeric thread ids, so every track gets one plus a metadata event naming it
+    std::unordered_map<std::string, uint32_t> trackIds;
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const TraceEvent &event: events) {
+        auto track = trackIds.find(event.track);
+        if (track == trackIds.end()) {
+            track = trackIds.emplace(event.track, static_cast<uint32_t>(trackIds.size() + 1)).first;
+            file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track->second
+                 << ",\"args\":{\"name\":\"" << escape(event.track) << "\"}}";
+            first = false;
+        }
+        file << (first ? "" : ",\n") << "{\"name\":\"" << escape(event.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << track->second
+             << ",\"ts\":" << std::fixed << event.startUs << ",\"dur\":" << event.durationUs << "}";
+        first = false;
+    }
+    file << "\n]}\n";
+
+    std::cout << "Trace with " << events.size() << " events written to " << path;
+    if (dropped > 0)
+        std::cout << " (" << dropped << " dropped, buffer full)";
+    std::cout << std::endl;
+    return file.good();
+}
+
+size_t TraceWriter::EventCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return events.size();
+}
+
+// Microseconds since the first use of the trace module, on steady_clock
+double TraceWriter::NowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One complete span on a track. Tracks show up as separate rows in the viewer (a CPU thread, a GPU queue...)
+struct TraceEvent {
+    std::string track;
+    std::string name;
+    double startUs = 0.0;
+    double durationUs = 0.0;
+};
+
+// Collects spans from any thread and writes them as Chrome trace event JSON, which loads in chrome://tracing and
+// ui.perfetto.dev. All timestamps are microseconds on the NowUs() timeline, producers on other clocks convert first.
+class TraceWriter {
+    private:
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    size_t maxEvents;
+    size_t dropped = 0;
+
+    public:
+    TraceWriter(size_t maxEvents = 1 << 20);
+
+    void Add(TraceEvent event);
+    void Add(const std::vector<TraceEvent> &batch);
+    bool Write(const std::string &path);
+    size_t EventCount();
+
+    static double NowUs();
+};
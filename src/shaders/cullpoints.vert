@@ -0,0 +1,15 @@
+#version 450
+
+// Draws instance i as one point on pixel i of the target, so the pixels lit count what GpuCulling::RecordDraw drew.
+// Used by cullbench with a single index per mesh and no vertex input.
+layout(push_constant) uniform Target {
+    uint width;
+    uint height;
+};
+
+void main() {
+    uint i = uint(gl_InstanceIndex);
+    vec2 pixel = vec2(i % width, i / width) + 0.5;
+    gl_Position = vec4(pixel / vec2(width, height) * 2.0 - 1.0, 0.0, 1.0);
+    gl_PointSize = 1.0;
+}
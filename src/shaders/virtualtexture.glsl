@@ -0,0 +1,68 @@
+// Sampling for VirtualTexture. The including shader declares the resources before including this:
+//
+// layout(set = 0, binding = 0) uniform sampler2D vtTexture;      // ImageView(), linear filtering, clamp to edge
+// layout(std430, set = 0, binding = 1) readonly buffer VtPageTable { uint vtPageTable[]; };
+// layout(std430, set = 0, binding = 2) writeonly buffer VtFeedback { uint vtFeedback[]; };
+// layout(std140, set = 0, binding = 3) uniform VtInfo { VirtualTextureInfo vtInfo; };
+//
+// Only in fragment shaders, the level comes from screen space derivatives. With sparse residency filtering at the
+// edge of a resident page can still read its non resident neighbour, that gives a wrong texel but nothing worse.
+
+struct VirtualTextureInfo {
+    uint width, height, pageWidth, pageHeight;
+    uint atlasPagesX, atlasPagesY, mipLevels, tailLevel;
+    uint border, sparse, padding0, padding1;
+};
+
+uvec2 vtLevelSize(uint level) {
+    return max(uvec2(vtInfo.width, vtInfo.height) >> level, uvec2(1));
+}
+
+uvec2 vtLevelPages(uint level) {
+    uvec2 pageSize = uvec2(vtInfo.pageWidth, vtInfo.pageHeight);
+    return (vtLevelSize(level) + pageSize - 1) / pageSize;
+}
+
+// Same order as VirtualTexture::createPages, finest level first
+uint vtPageIndex(uint level, uvec2 page) {
+    uint offset = 0;
+    for (uint i = 0; i < level; i++) {
+        uvec2 pages = vtLevelPages(i);
+        offset += pages.x * pages.y;
+    }
+    return offset + page.y * vtLevelPages(level).x + page.x;
+}
+
+uvec2 vtPageOf(vec2 uv, uint level) {
+    uvec2 texel = uvec2(clamp(uv, 0.0, 1.0) * vec2(vtLevelSize(level) - 1));
+    return texel / uvec2(vtInfo.pageWidth, vtInfo.pageHeight);
+}
+
+vec4 vtSample(vec2 uv) {
+    vec2 texels = uv * vec2(vtInfo.width, vtInfo.height);
+    float lod = log2(max(max(length(dFdx(texels)), length(dFdy(texels))), 1.0));
+    uint wanted = min(uint(lod), vtInfo.mipLevels - 1);
+
+    // Ask for the level that would look right, sample the finest one that is there
+    if (wanted < vtInfo.tailLevel)
+        vtFeedback[vtPageIndex(wanted, vtPageOf(uv, wanted))] = 1;
+    for (uint level = wanted; level < vtInfo.mipLevels; level++) {
+        if (level >= vtInfo.tailLevel)
+            return textureLod(vtTexture, uv, float(level));
+        uvec2 page = vtPageOf(uv, level);
+        uint entry = vtPageTable[vtPageIndex(level, page)];
+        if (entry == 0)
+            continue;
+        if (vtInfo.sparse != 0)
+            return textureLod(vtTexture, uv, float(level));
+
+        // Atlas slot entry - 1, with the page's texels border texels in from the slot corner
+        uint slot = entry - 1;
+        uint slotSize = vtInfo.pageWidth + 2 * vtInfo.border;
+        vec2 inPage = uv * vec2(vtLevelSize(level)) - vec2(page * uvec2(vtInfo.pageWidth, vtInfo.pageHeight));
+        vec2 atlasTexel = vec2(uvec2(slot % vtInfo.atlasPagesX, slot / vtInfo.atlasPagesX) * slotSize + vtInfo.border) + inPage;
+        return textureLod(vtTexture, atlasTexel / vec2(uvec2(vtInfo.atlasPagesX, vtInfo.atlasPagesY) * slotSize), 0.0);
+    }
+    // Only reached by the fallback if the pinned page was missing
+    return vec4(1.0, 0.0, 1.0, 1.0);
+}
@@ -0,0 +1,75 @@
+#include "childprocess.h"
+
+#include <cerrno>
+
+#if defined(_WIN32)
+    #include <fcntl.h>
+    #include <io.h>
+    #include <process.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <spawn.h>
+    #include <sys/wait.h>
+    extern char **environ;
+#endif
+
+#if defined(_WIN32)
+int RunProcess(const std::vector<std::string> &args, const std::string &outputPath) {
+    // The CRT joins the arguments with spaces, quote them so paths with spaces survive
+    std::vector<std::string> quoted;
+    for (const std::string &arg: args) {
+        quoted.push_back("\"" + arg + "\"");
+    }
+    std::vector<const char*> argv;
+    for (const std::string &arg: quoted) {
+        argv.push_back(arg.c_str());
+    }
+    argv.push_back(nullptr);
+    if (outputPath.empty())
+        return static_cast<int>(_spawnvp(_P_WAIT, args[0].c_str(), argv.data()));
+
+    // The child inherits our stdout and stderr, point them at the file for the duration of the spawn
+    int output = _open(outputPath.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC, _S_IREAD | _S_IWRITE);
+    if (output < 0)
+        return -1;
+    int savedOut = _dup(1);
+    int savedErr = _dup(2);
+    _dup2(output, 1);
+    _dup2(output, 2);
+    int result = static_cast<int>(_spawnvp(_P_WAIT, args[0].c_str(), argv.data()));
+    _dup2(savedOut, 1);
+    _dup2(savedErr, 2);
+    _close(savedOut);
+    _close(savedErr);
+    _close(output);
+    return result;
+}
+#else
+int RunProcess(const std::vector<std::string> &args, const std::string &outputPath) {
+    std::vector<char*> argv;
+    for (const std::string &arg: args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (!outputPath.empty()) {
+        posix_spawn_file_actions_addopen(&actions, 1, outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        posix_spawn_file_actions_adddup2(&actions, 1, 2);
+    }
+    pid_t pid;
+    int spawned = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0)
+        return -1;
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+#endif
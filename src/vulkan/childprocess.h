@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Runs args[0], looked up in PATH, with exactly these arguments and waits for it. No shell in between, so paths and
+// defines are passed through as they are. With an outputPath the child's stdout and stderr both go to that file.
+// Returns its exit code, or -1 when it couldn't be started or didn't exit normally.
+int RunProcess(const std::vector<std::string> &args, const std::string &outputPath = "");
@@ -0,0 +1,157 @@
+#include "commandrecorder.h"
+
+#include <algorithm>
+#include "profiler/cpuprofiler.h"
+
+CommandRecorder::CommandRecorder(const LogicalDevice &device, uint32_t framesInFlight, uint32_t threadCount) : device(device) {
+    threadCount = std::max(threadCount, 1u);
+    recorded.resize(threadCount);
+
+    for (uint32_t i = 0; i < threadCount; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->commandBuffers.resize(framesInFlight);
+        for (uint32_t frame = 0; frame < framesInFlight; frame++) {
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+            VkCommandPool pool;
+            if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+                throw std::runtime_error("error creating worker command pool");
+            }
+            worker->commandPools.push_back(pool);
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = pool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+            if (vkAllocateCommandBuffers(device.device, &allocInfo, &worker->commandBuffers[frame]) != VK_SUCCESS) {
+                throw std::runtime_error("error allocating worker command buffer");
+            }
+        }
+        workers.push_back(std::move(worker));
+    }
+
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workers[i]->thread = std::thread(&CommandRecorder::workerLoop, this, i);
+    }
+}
+
+CommandRecorder::~CommandRecorder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for (auto &worker: workers) {
+        worker->thread.join();
+        for (VkCommandPool pool: worker->commandPools) {
+            vkDestroyCommandPool(device.device, pool, nullptr);
+        }
+    }
+}
+
+// Records itemCount items split across the workers and executes the results into primary. frameIndex must belong to
+// a frame whose fence has been waited on, its command pools are reset here. With a render pass in the inheritance
+// info the secondaries continue that render pass, which primary must have begun with
+// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+void CommandRecorder::Record(VkCommandBuffer primary, uint32_t frameIndex, uint32_t itemCount, const RecordFunction &record, const VkCommandBufferInheritanceInfo *inheritance) {
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->frameIndex = frameIndex;
+        this->itemCount = itemCount;
+        this->record = &record;
+        if (inheritance) {
+            this->inheritance = *inheritance;
+        } else {
+            this->inheritance = VkCommandBufferInheritanceInfo{};
+            this->inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        }
+        for (VkCommandBuffer &commandBuffer: recorded) {
+            commandBuffer = VK_NULL_HANDLE;
+        }
+        pending = static_cast<uint32_t>(workers.size());
+        generation++;
+    }
+    workAvailable.notify_all();
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        workDone.wait(lock, [this] { return pending == 0; });
+        this->record = nullptr;
+    }
+
+    std::vector<VkCommandBuffer> secondaries;
+    for (VkCommandBuffer commandBuffer: recorded) {
+        if (commandBuffer != VK_NULL_HANDLE)
+            secondaries.push_back(commandBuffer);
+    }
+    if (!secondaries.empty())
+        vkCmdExecuteCommands(primary, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+
+    lastRecordTime = std::chrono::steady_clock::now() - start;
+}
+
+uint32_t CommandRecorder::ThreadCount() {
+    return static_cast<uint32_t>(workers.size());
+}
+
+// Wall time of the last Record call, from handing out the work to executing the secondaries
+std::chrono::steady_clock::duration CommandRecorder::LastRecordTime() {
+    return lastRecordTime;
+}
+
+void CommandRecorder::workerLoop(uint32_t workerIndex) {
+    Worker &worker = *workers[workerIndex];
+    PROFILE_THREAD("Recorder " + std::to_string(workerIndex));
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workAvailable.wait(lock, [this, &worker] { return stopping || generation != worker.generation; });
+            if (stopping)
+                return;
+            worker.generation = generation;
+        }
+
+        recordSlice(workerIndex);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            last = --pending == 0;
+        }
+        if (last)
+            workDone.notify_one();
+    }
+}
+
+void CommandRecorder::recordSlice(uint32_t workerIndex) {
+    PROFILE_ZONE("RecordSlice");
+    Worker &worker = *workers[workerIndex];
+    vkResetCommandPool(device.device, worker.commandPools[frameIndex], 0);
+
+    // Contiguous slices, the first itemCount % workers slices get one extra item
+    uint32_t workerCount = static_cast<uint32_t>(workers.size());
+    uint32_t base = itemCount / workerCount;
+    uint32_t extra = itemCount % workerCount;
+    uint32_t count = base + (workerIndex < extra ? 1 : 0);
+    uint32_t first = workerIndex * base + std::min(workerIndex, extra);
+    if (count == 0)
+        return;
+
+    VkCommandBuffer commandBuffer = worker.commandBuffers[frameIndex];
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (inheritance.renderPass != VK_NULL_HANDLE)
+        beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritance;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    (*record)(commandBuffer, first, count);
+    vkEndCommandBuffer(commandBuffer);
+
+    recorded[workerIndex] = commandBuffer;
+}
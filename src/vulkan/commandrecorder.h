@@ -0,0 +1,59 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "logicaldevice.h"
+
+// Records a slice [first, first + count) of the caller's draw list into a secondary command buffer. Runs on a worker
+// thread, so it must only read shared state.
+using RecordFunction = std::function<void(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count)>;
+
+// Pool of worker threads that record secondary command buffers in parallel. Each worker owns one command pool per
+// frame in flight, so recording never needs a lock and a frame's pools are reset all at once when it comes around.
+// The draw list is split in contiguous slices, one per worker, and executed in slice order, so the result is the same
+// no matter which thread finishes first.
+class CommandRecorder {
+    private:
+    struct Worker {
+        std::thread thread;
+        std::vector<VkCommandPool> commandPools;
+        std::vector<VkCommandBuffer> commandBuffers;
+        uint64_t generation = 0;
+    };
+
+    const LogicalDevice &device;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workDone;
+    uint64_t generation = 0;
+    uint32_t pending = 0;
+    bool stopping = false;
+
+    // Current job, only written while no worker is running
+    uint32_t frameIndex = 0;
+    uint32_t itemCount = 0;
+    const RecordFunction *record = nullptr;
+    VkCommandBufferInheritanceInfo inheritance{};
+    std::vector<VkCommandBuffer> recorded;
+    std::chrono::steady_clock::duration lastRecordTime{};
+
+    public:
+    CommandRecorder(const LogicalDevice &device, uint32_t framesInFlight, uint32_t threadCount = std::thread::hardware_concurrency());
+    ~CommandRecorder();
+
+    void Record(VkCommandBuffer primary, uint32_t frameIndex, uint32_t itemCount, const RecordFunction &record, const VkCommandBufferInheritanceInfo *inheritance = nullptr);
+    uint32_t ThreadCount();
+    std::chrono::steady_clock::duration LastRecordTime();
+
+    private:
+    void workerLoop(uint32_t workerIndex);
+    void recordSlice(uint32_t workerIndex);
+};
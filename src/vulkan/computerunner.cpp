@@ -0,0 +1,412 @@
+#include "computerunner.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+ComputeKernel::ComputeKernel(const LogicalDevice &device, const std::vector<uint32_t> &spirv, std::array<uint32_t, 3> workgroupSize,
+    VkPipelineCache pipelineCache, const char *entryPoint) : device(device) {
+    SpirvReflection reflection(spirv);
+    bindings = reflection.Bindings();
+    for (const SpirvBinding &binding: bindings) {
+        if (binding.set != 0) {
+            throw std::runtime_error("compute kernels can only use descriptor set 0");
+        }
+    }
+
+    // Dimensions set by specialization constants get their value through the specialization info, even the defaults
+    std::array<uint32_t, 3> localSize = reflection.LocalSize();
+    std::array<int32_t, 3> specIds = reflection.LocalSizeSpecIds();
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<uint32_t> values;
+    for (uint32_t dimension = 0; dimension < 3; dimension++) {
+        uint32_t size = workgroupSize[dimension] ? workgroupSize[dimension] : localSize[dimension];
+        if (specIds[dimension] < 0 && size != localSize[dimension]) {
+            throw std::runtime_error("compute kernel workgroup size is fixed in the shader, use local_size_*_id to set it");
+        }
+        if (specIds[dimension] >= 0) {
+            entries.push_back({static_cast<uint32_t>(specIds[dimension]), static_cast<uint32_t>(values.size() * sizeof(uint32_t)), sizeof(uint32_t)});
+            values.push_back(size);
+        }
+        this->workgroupSize[dimension] = size;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device.physicalDevice, &properties);
+    uint64_t invocations = 1;
+    for (uint32_t dimension = 0; dimension < 3; dimension++) {
+        invocations *= this->workgroupSize[dimension];
+        if (this->workgroupSize[dimension] == 0 || this->workgroupSize[dimension] > properties.limits.maxComputeWorkGroupSize[dimension]) {
+            throw std::runtime_error("compute workgroup size is outside the device limits");
+        }
+    }
+    if (invocations > properties.limits.maxComputeWorkGroupInvocations) {
+        throw std::runtime_error("compute workgroup has more invocations than the device allows");
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+    for (const SpirvBinding &binding: bindings) {
+        VkDescriptorSetLayoutBinding layoutBinding{};
+        layoutBinding.binding = binding.binding;
+        layoutBinding.descriptorType = binding.type;
+        layoutBinding.descriptorCount = 1;
+        layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        layoutBindings.push_back(layoutBinding);
+    }
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    setLayoutInfo.pBindings = layoutBindings.data();
+    if (vkCreateDescriptorSetLayout(device.device, &setLayoutInfo, nullptr, &setLayout) != VK_SUCCESS) {
+        throw std::runtime_error("error creating compute descriptor set layout");
+    }
+
+    pushConstantSize = reflection.PushConstantSize();
+    VkPushConstantRange pushConstantRange{VK_SHADER_STAGE_COMPUTE_BIT, 0, pushConstantSize};
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &setLayout;
+    layoutInfo.pushConstantRangeCount = pushConstantSize ? 1 : 0;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(device.device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+        throw std::runtime_error("error creating compute pipeline layout");
+    }
+
+    // Only needed until the pipeline exists
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = spirv.size() * sizeof(uint32_t);
+    moduleInfo.pCode = spirv.data();
+    VkShaderModule module;
+    if (vkCreateShaderModule(device.device, &moduleInfo, nullptr, &module) != VK_SUCCESS) {
+        throw std::runtime_error("error creating compute shader module");
+    }
+
+    VkSpecializationInfo specialization{};
+    specialization.mapEntryCount = static_cast<uint32_t>(entries.size());
+    specialization.pMapEntries = entries.data();
+    specialization.dataSize = values.size() * sizeof(uint32_t);
+    specialization.pData = values.data();
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = module;
+    pipelineInfo.stage.pName = entryPoint;
+    pipelineInfo.stage.pSpecializationInfo = entries.empty() ? nullptr : &specialization;
+    pipelineInfo.layout = layout;
+    VkResult result = vkCreateComputePipelines(device.device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+    vkDestroyShaderModule(device.device, module, nullptr);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("error creating compute pipeline");
+    }
+}
+
+ComputeKernel::~ComputeKernel() {
+    vkDestroyPipeline(device.device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device.device, layout, nullptr);
+    vkDestroyDescriptorSetLayout(device.device, setLayout, nullptr);
+}
+
+const std::vector<SpirvBinding>& ComputeKernel::Bindings() const {
+    return bindings;
+}
+
+std::array<uint32_t, 3> ComputeKernel::WorkgroupSize() const {
+    return workgroupSize;
+}
+
+std::array<uint32_t, 3> ComputeKernel::GroupsFor(uint32_t x, uint32_t y, uint32_t z) const {
+    return {(x + workgroupSize[0] - 1) / workgroupSize[0], (y + workgroupSize[1] - 1) / workgroupSize[1], (z + workgroupSize[2] - 1) / workgroupSize[2]};
+}
+
+uint32_t ComputeKernel::PushConstantSize() const {
+    return pushConstantSize;
+}
+
+VkPipeline ComputeKernel::Pipeline() const {
+    return pipeline;
+}
+
+VkPipelineLayout ComputeKernel::Layout() const {
+    return layout;
+}
+
+VkDescriptorSetLayout ComputeKernel::SetLayout() const {
+    return setLayout;
+}
+
+ComputeRunner::ComputeRunner(const LogicalDevice &device, MemoryAllocator &allocator, uint32_t maxInFlight) : device(device), allocator(allocator) {
+    this->queue = device.computeQueue;
+    this->queueFamily = device.queueFamilies.computeFamily.value();
+    this->maxInFlight = std::max(maxInFlight, 1u);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamily;
+    if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("error creating compute command pool");
+    }
+
+    // One set per dispatch in flight, kernels with more bindings than this on average run out
+    VkDescriptorPoolSize poolSizes[] = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, this->maxInFlight * 8},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, this->maxInFlight * 2},
+    };
+    VkDescriptorPoolCreateInfo descriptorPoolInfo{};
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptorPoolInfo.maxSets = this->maxInFlight;
+    descriptorPoolInfo.poolSizeCount = 2;
+    descriptorPoolInfo.pPoolSizes = poolSizes;
+    if (vkCreateDescriptorPool(device.device, &descriptorPoolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("error creating compute descriptor pool");
+    }
+
+    completionThread = std::thread(&ComputeRunner::completionLoop, this);
+}
+
+ComputeRunner::~ComputeRunner() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    completionThread.join();
+    recycle();
+
+    for (VkFence fence: freeFences)
+        vkDestroyFence(device.device, fence, nullptr);
+    vkDestroyDescriptorPool(device.device, descriptorPool, nullptr);
+    vkDestroyCommandPool(device.device, commandPool, nullptr);
+}
+
+ComputeBuffer ComputeRunner::CreateBuffer(VkDeviceSize size, bool hostVisible) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    ComputeBuffer buffer;
+    buffer.size = size;
+    if (hostVisible) {
+        buffer.buffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer.allocation);
+    } else {
+        buffer.buffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, buffer.allocation);
+    }
+    return buffer;
+}
+
+// Coherent memory, the next submission makes the write visible to the GPU
+void ComputeRunner::Write(ComputeBuffer &buffer, const void *data, VkDeviceSize size, VkDeviceSize offset) {
+    if (!buffer.allocation.mapped) {
+        throw std::runtime_error("compute buffer isn't host visible, upload through a StagingRing");
+    }
+    if (offset + size > buffer.size) {
+        throw std::runtime_error("compute buffer write out of bounds");
+    }
+    memcpy(static_cast<uint8_t*>(buffer.allocation.mapped) + offset, data, size);
+}
+
+void ComputeRunner::DestroyBuffer(ComputeBuffer &buffer) {
+    if (buffer.buffer != VK_NULL_HANDLE)
+        allocator.DestroyBuffer(buffer.buffer, buffer.allocation);
+    buffer = ComputeBuffer();
+}
+
+std::future<std::vector<uint8_t>> ComputeRunner::Dispatch(const ComputeKernel &kernel, const std::vector<const ComputeBuffer*> &buffers,
+    std::array<uint32_t, 3> groups, const ComputeBuffer *readback) {
+    const std::vector<SpirvBinding> &bindings = kernel.Bindings();
+    if (buffers.size() != bindings.size()) {
+        throw std::runtime_error("compute dispatch needs one buffer per kernel binding");
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return inFlight < maxInFlight; });
+    }
+    recycle();
+
+    Submission submission;
+    if (!bindings.empty()) {
+        VkDescriptorSetLayout setLayout = kernel.SetLayout();
+        VkDescriptorSetAllocateInfo setInfo{};
+        setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setInfo.descriptorPool = descriptorPool;
+        setInfo.descriptorSetCount = 1;
+        setInfo.pSetLayouts = &setLayout;
+        if (vkAllocateDescriptorSets(device.device, &setInfo, &submission.descriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("out of compute descriptor sets");
+        }
+
+        std::vector<VkDescriptorBufferInfo> bufferInfos(bindings.size());
+        std::vector<VkWriteDescriptorSet> writes(bindings.size());
+        for (size_t i = 0; i < bindings.size(); i++) {
+            bufferInfos[i] = {buffers[i]->buffer, 0, VK_WHOLE_SIZE};
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = submission.descriptorSet;
+            writes[i].dstBinding = bindings[i].binding;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = bindings[i].type;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+        vkUpdateDescriptorSets(device.device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+
+    if (freeCommandBuffers.empty()) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(device.device, &allocInfo, &submission.commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("error allocating compute command buffer");
+        }
+    } else {
+        submission.commandBuffer = freeCommandBuffers.back();
+        freeCommandBuffers.pop_back();
+    }
+    if (freeFences.empty()) {
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(device.device, &fenceInfo, nullptr, &submission.fence) != VK_SUCCESS) {
+            throw std::runtime_error("error creating compute fence");
+        }
+    } else {
+        submission.fence = freeFences.back();
+        freeFences.pop_back();
+        vkResetFences(device.device, 1, &submission.fence);
+    }
+
+    // Coherent and cached when available, the CPU reads every byte
+    if (readback) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = readback->size;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        submission.readback.size = readback->size;
+        submission.readback.buffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT, submission.readback.allocation);
+    }
+
+    VkCommandBuffer commandBuffer = submission.commandBuffer;
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    // Separate submissions don't order memory accesses, earlier dispatches may have written what this one reads
+    VkMemoryBarrier before{};
+    before.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    before.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    before.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_UNIFORM_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &before, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.Pipeline());
+    if (submission.descriptorSet != VK_NULL_HANDLE)
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.Layout(), 0, 1, &submission.descriptorSet, 0, nullptr);
+    vkCmdDispatch(commandBuffer, groups[0], groups[1], groups[2]);
+
+    if (readback) {
+        VkMemoryBarrier toTransfer{};
+        toTransfer.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        toTransfer.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &toTransfer, 0, nullptr, 0, nullptr);
+        VkBufferCopy region{0, 0, readback->size};
+        vkCmdCopyBuffer(commandBuffer, readback->buffer, submission.readback.buffer, 1, &region);
+    }
+
+    // The fence alone doesn't make device writes visible to the host, for the readback or host visible buffers
+    VkMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &toHost, 0, nullptr, 0, nullptr);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("error recording compute command buffer");
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    if (vkQueueSubmit(queue, 1, &submitInfo, submission.fence) != VK_SUCCESS) {
+        throw std::runtime_error("error submitting compute dispatch");
+    }
+
+    std::future<std::vector<uint8_t>> result = submission.result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        inFlight++;
+        submitted.push_back(std::move(submission));
+    }
+    changed.notify_all();
+    return result;
+}
+
+void ComputeRunner::WaitIdle() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return inFlight == 0; });
+    }
+    recycle();
+}
+
+// Submissions finish in order on one queue, so waiting on the oldest fence first costs nothing
+void ComputeRunner::completionLoop() {
+    while (true) {
+        Submission *next;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return stopping || !submitted.empty(); });
+            if (submitted.empty())
+                return;
+            // Stays valid, the Dispatch thread only ever appends
+            next = &submitted.front();
+        }
+
+        if (vkWaitForFences(device.device, 1, &next->fence, VK_TRUE, UINT64_MAX) == VK_SUCCESS) {
+            std::vector<uint8_t> data;
+            if (next->readback.buffer != VK_NULL_HANDLE) {
+                const uint8_t *mapped = static_cast<const uint8_t*>(next->readback.allocation.mapped);
+                data.assign(mapped, mapped + next->readback.size);
+            }
+            next->result.set_value(std::move(data));
+        } else {
+            next->result.set_exception(std::make_exception_ptr(std::runtime_error("error waiting for compute dispatch")));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.push_back(std::move(submitted.front()));
+            submitted.pop_front();
+            inFlight--;
+        }
+        changed.notify_all();
+    }
+}
+
+void ComputeRunner::recycle() {
+    std::vector<Submission> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.swap(completed);
+    }
+    for (Submission &submission: done) {
+        freeCommandBuffers.push_back(submission.commandBuffer);
+        freeFences.push_back(submission.fence);
+        if (submission.descriptorSet != VK_NULL_HANDLE)
+            vkFreeDescriptorSets(device.device, descriptorPool, 1, &submission.descriptorSet);
+        DestroyBuffer(submission.readback);
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "logicaldevice.h"
+#include "memoryallocator.h"
+#include "spirvreflection.h"
+
+// A compute pipeline built from a SPIR-V kernel. The descriptor set layout comes from the kernel's buffer bindings,
+// which must all be in set 0. Dimensions of workgroupSize that are 0 keep the shader's value; the others need the
+// shader to take them from specialization constants (layout(local_size_x_id = 0, ...) in GLSL).
+class ComputeKernel {
+    private:
+    const LogicalDevice &device;
+    std::vector<SpirvBinding> bindings;
+    std::array<uint32_t, 3> workgroupSize;
+    uint32_t pushConstantSize = 0;
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    public:
+    ComputeKernel(const LogicalDevice &device, const std::vector<uint32_t> &spirv, std::array<uint32_t, 3> workgroupSize = {0, 0, 0},
+        VkPipelineCache pipelineCache = VK_NULL_HANDLE, const char *entryPoint = "main");
+    ~ComputeKernel();
+
+    const std::vector<SpirvBinding>& Bindings() const;
+    std::array<uint32_t, 3> WorkgroupSize() const;
+    // Workgroups needed to cover that many invocations
+    std::array<uint32_t, 3> GroupsFor(uint32_t x, uint32_t y = 1, uint32_t z = 1) const;
+    // Compute stage range at offset 0, for kernels recorded by hand with vkCmdPushConstants
+    uint32_t PushConstantSize() const;
+    VkPipeline Pipeline() const;
+    VkPipelineLayout Layout() const;
+    VkDescriptorSetLayout SetLayout() const;
+};
+
+struct ComputeBuffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation allocation;
+    VkDeviceSize size = 0;
+};
+
+// Runs kernels on the compute queue, the dedicated async compute family when the device has one. Every Dispatch is
+// its own submission, its results come back through a future that a completion thread fulfils once the fence
+// signals, so the caller never blocks on the GPU unless it asks for the result.
+//
+// Buffers are owned by the compute family (exclusive sharing), hand them to another queue family with an ownership
+// transfer. When compute shares the graphics queue, don't Dispatch while another thread submits to it.
+// Not thread safe, Dispatch from one thread.
+class ComputeRunner {
+    private:
+    struct Submission {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        ComputeBuffer readback;
+        std::promise<std::vector<uint8_t>> result;
+    };
+
+    const LogicalDevice &device;
+    MemoryAllocator &allocator;
+    VkQueue queue;
+    uint32_t queueFamily;
+    uint32_t maxInFlight;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+    std::vector<VkFence> freeFences;
+
+    // Submitted goes to the completion thread, which moves it to completed once the fence signalled.
+    // Only the Dispatch thread recycles completed ones, the pools aren't touched from the completion thread.
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Submission> submitted;
+    std::vector<Submission> completed;
+    uint32_t inFlight = 0;
+    bool stopping = false;
+    std::thread completionThread;
+
+    public:
+    ComputeRunner(const LogicalDevice &device, MemoryAllocator &allocator, uint32_t maxInFlight = 16);
+    ~ComputeRunner();
+
+    // Host visible buffers can be written and read directly, device local ones are faster on discrete GPUs
+    ComputeBuffer CreateBuffer(VkDeviceSize size, bool hostVisible = false);
+    void Write(ComputeBuffer &buffer, const void *data, VkDeviceSize size, VkDeviceSize offset = 0);
+    void DestroyBuffer(ComputeBuffer &buffer);
+
+    // One buffer per kernel binding, in Bindings() order. The future holds a copy of readback after the dispatch,
+    // or nothing when there is no readback, so it also works as a completion signal.
+    std::future<std::vector<uint8_t>> Dispatch(const ComputeKernel &kernel, const std::vector<const ComputeBuffer*> &buffers,
+        std::array<uint32_t, 3> groups, const ComputeBuffer *readback = nullptr);
+    void WaitIdle();
+
+    private:
+    void completionLoop();
+    void recycle();
+};
@@ -0,0 +1,176 @@
+#include "debugsink.h"
+
+#include <iostream>
+
+namespace {
+    uint32_t severityIndex(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+        if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT)
+            return 3;
+        if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+            return 2;
+        if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT)
+            return 1;
+        return 0;
+    }
+
+    const char *severityName(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+        const char *names[] = {"verbose", "info", "warning", "error"};
+        return names[severityIndex(severity)];
+    }
+}
+
+DebugSink::DebugSink(uint64_t capacity) {
+    // Power of two so positions map to slots with a mask
+    this->capacity = 1;
+    while (this->capacity < capacity) {
+        this->capacity <<= 1;
+    }
+    slots = std::make_unique<Slot[]>(this->capacity);
+    for (uint64_t i = 0; i < this->capacity; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    for (auto &counter: counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+
+    writer = std::thread(&DebugSink::writerLoop, this);
+}
+
+DebugSink::~DebugSink() {
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+    report();
+}
+
+// Verbose is left out on purpose, the loader alone produces hundreds of those at startup
+void DebugSink::Populate(VkDebugUtilsMessengerCreateInfoEXT &createInfo) {
+    createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+    createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+    createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+    createInfo.pfnUserCallback = Callback;
+    createInfo.pUserData = this;
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL DebugSink::Callback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+    VkDebugUtilsMessageTypeFlagsEXT messageType,
+    const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+    void* pUserData) {
+
+    static_cast<DebugSink*>(pUserData)->Push(messageSeverity, messageType, pCallbackData);
+    return VK_FALSE;
+}
+
+void DebugSink::Push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT *data) {
+    counters[severityIndex(severity)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &slots[pos & (capacity - 1)];
+        int64_t diff = static_cast<int64_t>(slot->sequence.load(std::memory_order_acquire)) - static_cast<int64_t>(pos);
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Full, the writer is behind. Dropping beats stalling the caller.
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->message.severity = severity;
+    slot->message.type = type;
+    slot->message.id = data->messageIdNumber;
+    slot->message.idName = data->pMessageIdName ? data->pMessageIdName : "";
+    slot->message.text = data->pMessage ? data->pMessage : "";
+    slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+uint64_t DebugSink::Count(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+    return counters[severityIndex(severity)].load(std::memory_order_relaxed);
+}
+
+bool DebugSink::pop(DebugMessage &message) {
+    Slot &slot = slots[dequeuePos & (capacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+        return false;
+
+    message = std::move(slot.message);
+    slot.sequence.store(dequeuePos + capacity, std::memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+// Polls instead of waiting on a condition variable so producers never have to touch a mutex
+void DebugSink::writerLoop() {
+    DebugMessage message;
+    while (true) {
+        bool stop = stopping.load(std::memory_order_acquire);
+        bool wrote = false;
+        while (pop(message)) {
+            write(message, std::cerr);
+            wrote = true;
+        }
+        if (wrote)
+            std::cerr.flush();
+        if (stop)
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void DebugSink::write(DebugMessage &message, std::ostream &out) {
+    if (message.type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) {
+        PerformanceEntry &entry = performance[message.id];
+        if (entry.count++ == 0) {
+            entry.idName = std::move(message.idName);
+            entry.text = std::move(message.text);
+        }
+        return;
+    }
+
+    IdState &state = ids[message.id];
+    state.count++;
+    // Same ID and text as the last one printed, only worth a count
+    if (state.count > 1 && message.text == state.lastText)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - state.windowStart >= std::chrono::seconds(1)) {
+        if (state.suppressed > 0)
+            out << "validation layer: " << state.suppressed << " more messages for " << message.idName << " suppressed\n";
+        state.windowStart = now;
+        state.printedInWindow = 0;
+        state.suppressed = 0;
+    }
+    if (state.printedInWindow >= MAX_PER_SECOND) {
+        state.suppressed++;
+        return;
+    }
+
+    state.printedInWindow++;
+    out << "validation layer (" << severityName(message.severity) << "): " << message.text << '\n';
+    state.lastText = std::move(message.text);
+}
+
+void DebugSink::report() {
+    std::cout << "Validation messages: " << Count(VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) << " errors, "
+              << Count(VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) << " warnings, "
+              << Count(VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) << " info, "
+              << ids.size() << " distinct IDs";
+    uint64_t droppedCount = dropped.load(std::memory_order_relaxed);
+    if (droppedCount > 0)
+        std::cout << ", " << droppedCount << " dropped";
+    std::cout << std::endl;
+
+    if (performance.empty())
+        return;
+    std::cout << performance.size() << " performance warnings:" << std::endl;
+    for (const auto &entry: performance) {
+        std::cout << "- [" << entry.second.count << "x] " << entry.second.idName << ": " << entry.second.text << std::endl;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+struct DebugMessage {
+    VkDebugUtilsMessageSeverityFlagBitsEXT severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+    VkDebugUtilsMessageTypeFlagsEXT type = 0;
+    int32_t id = 0;
+    std::string idName;
+    std::string text;
+};
+
+// Debug messenger target that never blocks the Vulkan call that triggered a message. The callback only bumps a
+// counter and pushes into a bounded lock-free queue (dropping when full), a writer thread does the rest:
+// identical repeats of a message ID are only counted, each ID prints at most MAX_PER_SECOND messages, and
+// performance warnings are kept aside for a report printed on destruction.
+class DebugSink {
+    private:
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        DebugMessage message;
+    };
+
+    struct IdState {
+        uint64_t count = 0;
+        uint32_t printedInWindow = 0;
+        uint64_t suppressed = 0;
+        std::chrono::steady_clock::time_point windowStart;
+        std::string lastText;
+    };
+
+    struct PerformanceEntry {
+        std::string idName;
+        std::string text;
+        uint64_t count = 0;
+    };
+
+    // Multi producer, single consumer ring. A slot's sequence says whose turn it is, so producers only race on the
+    // enqueue position.
+    std::unique_ptr<Slot[]> slots;
+    uint64_t capacity;
+    std::atomic<uint64_t> enqueuePos{0};
+    uint64_t dequeuePos = 0;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> counters[4];
+
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+
+    // Only touched by the writer thread, or after it has been joined
+    std::unordered_map<int32_t, IdState> ids;
+    std::map<int32_t, PerformanceEntry> performance;
+
+    public:
+    static const uint32_t MAX_PER_SECOND = 5;
+
+    DebugSink(uint64_t capacity = 1024);
+    ~DebugSink();
+
+    void Populate(VkDebugUtilsMessengerCreateInfoEXT &createInfo);
+    void Push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT *data);
+    uint64_t Count(VkDebugUtilsMessageSeverityFlagBitsEXT severity);
+
+    static VKAPI_ATTR VkBool32 VKAPI_CALL Callback(
+        VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+        VkDebugUtilsMessageTypeFlagsEXT messageType,
+        const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+        void* pUserData);
+
+    private:
+    bool pop(DebugMessage &message);
+    void writerLoop();
+    void write(DebugMessage &message, std::ostream &out);
+    void report();
+};
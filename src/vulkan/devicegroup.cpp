@@ -0,0 +1,114 @@
+#include "devicegroup.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static uint32_t lowestDevice(uint32_t deviceMask) {
+    uint32_t index = 0;
+    while (deviceMask != 0 && !(deviceMask & (1u << index)))
+        index++;
+    return index;
+}
+
+DeviceGroup::DeviceGroup(const LogicalDevice &device, GroupRenderMode mode) {
+    deviceCount = static_cast<uint32_t>(std::max<size_t>(device.groupDevices.size(), 1));
+    if (deviceCount > 32) {
+        throw std::runtime_error("device masks only cover 32 devices");
+    }
+    this->mode = deviceCount > 1 ? mode : GroupRenderMode::Single;
+    if (this->mode != mode)
+        std::cout << "Only one device in the group, rendering on it alone" << std::endl;
+}
+
+GroupRenderMode DeviceGroup::Mode() {
+    return mode;
+}
+
+uint32_t DeviceGroup::DeviceCount() {
+    return deviceCount;
+}
+
+uint32_t DeviceGroup::AllDevicesMask() {
+    return deviceCount == 32 ? ~0u : (1u << deviceCount) - 1;
+}
+
+// Single keeps the other devices idle, split frame uses all of them every frame
+uint32_t DeviceGroup::FrameDeviceMask(uint64_t frameNumber) {
+    switch (mode) {
+        case GroupRenderMode::AlternateFrame:
+            return 1u << (frameNumber % deviceCount);
+        case GroupRenderMode::SplitFrame:
+            return AllDevicesMask();
+        default:
+            return 1;
+    }
+}
+
+// Bands differ by at most one row, the first ones get the remainder
+std::vector<VkRect2D> DeviceGroup::SplitAreas(VkRect2D area) {
+    std::vector<VkRect2D> areas(deviceCount, area);
+    uint32_t band = area.extent.height / deviceCount;
+    uint32_t remainder = area.extent.height % deviceCount;
+    int32_t y = area.offset.y;
+    for (uint32_t i = 0; i < deviceCount; i++) {
+        areas[i].offset.y = y;
+        areas[i].extent.height = band + (i < remainder ? 1 : 0);
+        y += static_cast<int32_t>(areas[i].extent.height);
+    }
+    return areas;
+}
+
+DeviceGroup::BeginInfo DeviceGroup::CommandBufferBegin(uint32_t deviceMask) {
+    BeginInfo info;
+    info.chained = deviceCount > 1;
+    info.group.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_COMMAND_BUFFER_BEGIN_INFO;
+    info.group.deviceMask = deviceMask;
+    return info;
+}
+
+DeviceGroup::RenderPassInfo DeviceGroup::RenderPassBegin(uint32_t deviceMask, VkRect2D area) {
+    RenderPassInfo info;
+    info.chained = deviceCount > 1;
+    info.group.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_RENDER_PASS_BEGIN_INFO;
+    info.group.deviceMask = deviceMask;
+    // One area per device in the group, devices outside the mask don't look at theirs
+    info.areas = mode == GroupRenderMode::SplitFrame ? SplitAreas(area) : std::vector<VkRect2D>(deviceCount, area);
+    return info;
+}
+
+DeviceGroup::SubmitInfo DeviceGroup::Submit(uint32_t deviceMask, uint32_t commandBufferCount, uint32_t waitCount, uint32_t signalCount) {
+    SubmitInfo info;
+    info.chained = deviceCount > 1;
+    info.group.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO;
+    info.waitIndices.assign(waitCount, lowestDevice(deviceMask));
+    info.commandBufferMasks.assign(commandBufferCount, deviceMask);
+    info.signalIndices.assign(signalCount, lowestDevice(deviceMask));
+    return info;
+}
+
+// Recorded only for real groups, a group of one has nothing to narrow down
+void DeviceGroup::SetDeviceMask(VkCommandBuffer commandBuffer, uint32_t deviceMask) {
+    if (deviceCount > 1)
+        vkCmdSetDeviceMask(commandBuffer, deviceMask);
+}
+
+const void* DeviceGroup::BeginInfo::Next() {
+    return chained ? &group : nullptr;
+}
+
+const void* DeviceGroup::RenderPassInfo::Next() {
+    group.deviceRenderAreaCount = static_cast<uint32_t>(areas.size());
+    group.pDeviceRenderAreas = areas.data();
+    return chained ? &group : nullptr;
+}
+
+const void* DeviceGroup::SubmitInfo::Next() {
+    group.waitSemaphoreCount = static_cast<uint32_t>(waitIndices.size());
+    group.pWaitSemaphoreDeviceIndices = waitIndices.data();
+    group.commandBufferCount = static_cast<uint32_t>(commandBufferMasks.size());
+    group.pCommandBufferDeviceMasks = commandBufferMasks.data();
+    group.signalSemaphoreCount = static_cast<uint32_t>(signalIndices.size());
+    group.pSignalSemaphoreDeviceIndices = signalIndices.data();
+    return chained ? &group : nullptr;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <vector>
+#include "logicaldevice.h"
+
+enum class GroupRenderMode {
+    Single,          // Everything on device 0
+    SplitFrame,      // Every frame on all devices, each renders its own band of the render area
+    AlternateFrame,  // Frame N on device N % count only
+};
+
+// Device masks for a LogicalDevice built from a device group. The frame's mask goes in when its command buffer is
+// begun and again when it's submitted, commands only run on the devices in both. Inside a frame SetDeviceMask()
+// narrows work down to some of the devices, e.g. one band each for split frame rendering. Render passes get their
+// per device render areas from RenderPassBegin(). Transfers like clears and copies have no render area, what a device
+// works on is up to the regions recorded under its mask.
+//
+// With a group of one every mode degrades to Single and no device group structs are chained at all, so the same
+// code runs on a single GPU or a software ICD.
+class DeviceGroup {
+    private:
+    GroupRenderMode mode;
+    uint32_t deviceCount;
+
+    public:
+    // Kept alive by the caller until vkBeginCommandBuffer
+    struct BeginInfo {
+        VkDeviceGroupCommandBufferBeginInfo group{};
+        bool chained = false;
+        // Goes into VkCommandBufferBeginInfo::pNext, null for a group of one
+        const void* Next();
+    };
+
+    // Kept alive by the caller until vkCmdBeginRenderPass
+    struct RenderPassInfo {
+        VkDeviceGroupRenderPassBeginInfo group{};
+        bool chained = false;
+        std::vector<VkRect2D> areas;
+        // Goes into VkRenderPassBeginInfo::pNext, null for a group of one. Points group at areas, so call it last.
+        const void* Next();
+    };
+
+    // Kept alive by the caller until vkQueueSubmit
+    struct SubmitInfo {
+        VkDeviceGroupSubmitInfo group{};
+        bool chained = false;
+        std::vector<uint32_t> waitIndices;
+        std::vector<uint32_t> commandBufferMasks;
+        std::vector<uint32_t> signalIndices;
+        // Goes into VkSubmitInfo::pNext, null for a group of one. Points group at the vectors, so call it last.
+        const void* Next();
+    };
+
+    DeviceGroup(const LogicalDevice &device, GroupRenderMode mode);
+
+    GroupRenderMode Mode();
+    uint32_t DeviceCount();
+    uint32_t AllDevicesMask();
+    uint32_t FrameDeviceMask(uint64_t frameNumber);
+    // Horizontal bands of area, one per device in the order of device indices
+    std::vector<VkRect2D> SplitAreas(VkRect2D area);
+
+    BeginInfo CommandBufferBegin(uint32_t deviceMask);
+    // Split frame gets one band per device, the other modes the whole area on every device
+    RenderPassInfo RenderPassBegin(uint32_t deviceMask, VkRect2D area);
+    // Semaphores are waited on and signalled by the lowest device in the mask
+    SubmitInfo Submit(uint32_t deviceMask, uint32_t commandBufferCount, uint32_t waitCount, uint32_t signalCount);
+    void SetDeviceMask(VkCommandBuffer commandBuffer, uint32_t deviceMask);
+};
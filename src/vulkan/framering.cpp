@@ -0,0 +1,176 @@
+#include "framering.h"
+
+#include "profiler/cpuprofiler.h"
+
+FrameRing::FrameRing(const LogicalDevice &device, MemoryAllocator &allocator, uint32_t framesInFlight, VkDeviceSize transientSize) : device(device), allocator(allocator) {
+    if (framesInFlight == 0) {
+        throw std::runtime_error("at least one frame in flight is needed");
+    }
+    this->transientSize = transientSize;
+
+    frames.resize(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        FrameContext &frame = frames[i];
+        frame.index = i;
+
+        // Transient pool, the whole pool is reset at once when the frame comes around again
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+        if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &frame.commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("error creating frame command pool");
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(device.device, &allocInfo, &frame.commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("error allocating frame command buffer");
+        }
+
+        // Created signalled so the first BeginFrame doesn't wait
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        if (vkCreateFence(device.device, &fenceInfo, nullptr, &frame.inFlight) != VK_SUCCESS) {
+            throw std::runtime_error("error creating frame fence");
+        }
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        if (vkCreateSemaphore(device.device, &semaphoreInfo, nullptr, &frame.imageAvailable) != VK_SUCCESS) {
+            throw std::runtime_error("error creating frame semaphore");
+        }
+
+        if (transientSize > 0) {
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = transientSize;
+            bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            // Device local and host visible (BAR/UMA) when there is one, plain host memory otherwise
+            frame.transientBuffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.transientAllocation);
+        }
+    }
+
+    lastBegin = std::chrono::steady_clock::now();
+}
+
+FrameRing::~FrameRing() {
+    WaitIdle();
+    for (FrameContext &frame: frames) {
+        if (frame.transientBuffer != VK_NULL_HANDLE)
+            allocator.DestroyBuffer(frame.transientBuffer, frame.transientAllocation);
+        vkDestroySemaphore(device.device, frame.imageAvailable, nullptr);
+        vkDestroyFence(device.device, frame.inFlight, nullptr);
+        vkDestroyCommandPool(device.device, frame.commandPool, nullptr);
+    }
+}
+
+// Waits until the GPU is done with the next frame context, recycles its resources and starts its command buffer
+FrameContext& FrameRing::BeginFrame() {
+    PROFILE_ZONE("BeginFrame");
+    FrameContext &frame = frames[current];
+
+    auto begin = std::chrono::steady_clock::now();
+    vkWaitForFences(device.device, 1, &frame.inFlight, VK_TRUE, UINT64_MAX);
+    auto waited = std::chrono::steady_clock::now();
+
+    lastTimings = FrameTimings();
+    lastTimings.cpuWaitMs = std::chrono::duration<double, std::milli>(waited - begin).count();
+    lastTimings.cpuFrameMs = std::chrono::duration<double, std::milli>(begin - lastBegin).count();
+    lastBegin = begin;
+
+    vkResetFences(device.device, 1, &frame.inFlight);
+    vkResetCommandPool(device.device, frame.commandPool, 0);
+    frame.transientOffset = 0;
+    frame.frameNumber = frameNumber++;
+    frame.deviceMask = deviceGroup ? deviceGroup->FrameDeviceMask(frame.frameNumber) : 1;
+
+    DeviceGroup::BeginInfo groupBegin;
+    if (deviceGroup)
+        groupBegin = deviceGroup->CommandBufferBegin(frame.deviceMask);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.pNext = groupBegin.Next();
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
+    return frame;
+}
+
+// Ends and submits the current frame's command buffer on the graphics queue and moves on to the next context
+void FrameRing::EndFrame(VkSemaphore waitSemaphore, VkPipelineStageFlags waitStage, VkSemaphore signalSemaphore) {
+    PROFILE_ZONE("EndFrame");
+    FrameContext &frame = frames[current];
+
+    vkEndCommandBuffer(frame.commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    if (waitSemaphore != VK_NULL_HANDLE) {
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &waitSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
+    if (signalSemaphore != VK_NULL_HANDLE) {
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &signalSemaphore;
+    }
+    DeviceGroup::SubmitInfo groupSubmit;
+    if (deviceGroup) {
+        groupSubmit = deviceGroup->Submit(frame.deviceMask, 1, submitInfo.waitSemaphoreCount, submitInfo.signalSemaphoreCount);
+        submitInfo.pNext = groupSubmit.Next();
+    }
+
+    if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, frame.inFlight) != VK_SUCCESS) {
+        throw std::runtime_error("error submitting frame");
+    }
+    current = (current + 1) % frames.size();
+}
+
+void FrameRing::SetDeviceGroup(DeviceGroup *group) {
+    deviceGroup = group;
+}
+
+// Bump allocation from the current frame's transient buffer, valid until the frame comes around again
+TransientAllocation FrameRing::AllocateTransient(VkDeviceSize size, VkDeviceSize alignment) {
+    FrameContext &frame = frames[current];
+    VkDeviceSize offset = (frame.transientOffset + alignment - 1) / alignment * alignment;
+    if (offset + size > transientSize) {
+        throw std::runtime_error("frame transient buffer exhausted");
+    }
+    frame.transientOffset = offset + size;
+
+    TransientAllocation allocation;
+    allocation.buffer = frame.transientBuffer;
+    allocation.offset = offset;
+    allocation.mapped = static_cast<uint8_t*>(frame.transientAllocation.mapped) + offset;
+    return allocation;
+}
+
+void FrameRing::WaitIdle() {
+    std::vector<VkFence> fences;
+    for (FrameContext &frame: frames) {
+        fences.push_back(frame.inFlight);
+    }
+    vkWaitForFences(device.device, static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, UINT64_MAX);
+}
+
+FrameContext& FrameRing::Current() {
+    return frames[current];
+}
+
+uint32_t FrameRing::FramesInFlight() {
+    return static_cast<uint32_t>(frames.size());
+}
+
+const FrameTimings& FrameRing::LastTimings() {
+    return lastTimings;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <chrono>
+#include <vector>
+#include "logicaldevice.h"
+#include "memoryallocator.h"
+#include "devicegroup.h"
+
+// Everything a frame needs that can't be touched again until the GPU is done with that frame
+struct FrameContext {
+    uint32_t index = 0;
+    uint64_t frameNumber = 0;
+    // Devices of the group that run this frame, always 1 without SetDeviceGroup()
+    uint32_t deviceMask = 1;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence inFlight = VK_NULL_HANDLE;
+    VkSemaphore imageAvailable = VK_NULL_HANDLE;
+
+    // Host visible scratch memory, rewound every time the frame comes around
+    VkBuffer transientBuffer = VK_NULL_HANDLE;
+    Allocation transientAllocation;
+    VkDeviceSize transientOffset = 0;
+};
+
+struct TransientAllocation {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    void *mapped = nullptr;
+};
+
+// GPU times come from GpuProfiler, which owns all timestamp queries
+struct FrameTimings {
+    double cpuWaitMs = 0.0;   // Blocked in BeginFrame waiting for the GPU to release the frame
+    double cpuFrameMs = 0.0;  // Between two BeginFrame calls
+};
+
+// Ring of N frame contexts so the CPU can record frame N+1 while the GPU is still running frame N.
+// BeginFrame() blocks only if the GPU is more than N frames behind.
+class FrameRing {
+    private:
+    const LogicalDevice &device;
+    MemoryAllocator &allocator;
+    std::vector<FrameContext> frames;
+    uint32_t current = 0;
+    uint64_t frameNumber = 0;
+    VkDeviceSize transientSize;
+    DeviceGroup *deviceGroup = nullptr;
+
+    std::chrono::steady_clock::time_point lastBegin;
+    FrameTimings lastTimings;
+
+    public:
+    FrameRing(const LogicalDevice &device, MemoryAllocator &allocator, uint32_t framesInFlight = 2, VkDeviceSize transientSize = 4 * 1024 * 1024);
+    ~FrameRing();
+
+    FrameContext& BeginFrame();
+    void EndFrame(VkSemaphore waitSemaphore = VK_NULL_HANDLE, VkPipelineStageFlags waitStage = 0, VkSemaphore signalSemaphore = VK_NULL_HANDLE);
+    // Frames from the next BeginFrame() on run on the devices the group's mode picks for them
+    void SetDeviceGroup(DeviceGroup *group);
+    TransientAllocation AllocateTransient(VkDeviceSize size, VkDeviceSize alignment = 256);
+    void WaitIdle();
+
+    FrameContext& Current();
+    uint32_t FramesInFlight();
+    const FrameTimings& LastTimings();
+};
@@ -0,0 +1,220 @@
+#include "gpuculling.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+const uint32_t CULL_WORKGROUP_SIZE = 64;
+
+GpuCulling::GpuCulling(const LogicalDevice &device, MemoryAllocator &allocator, const std::vector<uint32_t> &cullSpirv, uint32_t maxInstances,
+    uint32_t maxMeshes, VkPipelineCache pipelineCache) : device(device), allocator(allocator) {
+    // The instance index only reaches the vertex shader through firstInstance
+    if (!device.features.drawIndirectFirstInstance) {
+        throw std::runtime_error("GPU culling needs the drawIndirectFirstInstance feature");
+    }
+    this->maxInstances = maxInstances;
+    this->maxMeshes = maxMeshes;
+    this->compact = device.features.drawIndirectCount;
+
+    kernel = new ComputeKernel(device, cullSpirv, {CULL_WORKGROUP_SIZE, 0, 0}, pipelineCache);
+    if (kernel->Bindings().size() != 4 || kernel->PushConstantSize() != sizeof(PushConstants)) {
+        throw std::runtime_error("culling kernel doesn't match GpuCulling");
+    }
+
+    instances = createBuffer(sizeof(CullInstance) * maxInstances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true, instancesAllocation);
+    meshes = createBuffer(sizeof(CullMesh) * maxMeshes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true, meshesAllocation);
+    draws = createBuffer(sizeof(VkDrawIndexedIndirectCommand) * maxInstances,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, false, drawsAllocation);
+    drawCount = createBuffer(sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        false, drawCountAllocation);
+
+    // The buffers never change, so one set written once is enough
+    VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4};
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    if (vkCreateDescriptorPool(device.device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("error creating culling descriptor pool");
+    }
+    VkDescriptorSetLayout setLayout = kernel->SetLayout();
+    VkDescriptorSetAllocateInfo setInfo{};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setInfo.descriptorPool = descriptorPool;
+    setInfo.descriptorSetCount = 1;
+    setInfo.pSetLayouts = &setLayout;
+    if (vkAllocateDescriptorSets(device.device, &setInfo, &descriptorSet) != VK_SUCCESS) {
+        throw std::runtime_error("error allocating culling descriptor set");
+    }
+
+    VkDescriptorBufferInfo bufferInfos[] = {
+        {instances, 0, VK_WHOLE_SIZE},
+        {meshes, 0, VK_WHOLE_SIZE},
+        {draws, 0, VK_WHOLE_SIZE},
+        {drawCount, 0, VK_WHOLE_SIZE},
+    };
+    VkWriteDescriptorSet writes[4]{};
+    for (uint32_t i = 0; i < 4; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = kernel->Bindings()[i].binding;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    vkUpdateDescriptorSets(device.device, 4, writes, 0, nullptr);
+}
+
+GpuCulling::~GpuCulling() {
+    vkDestroyDescriptorPool(device.device, descriptorPool, nullptr);
+    allocator.DestroyBuffer(drawCount, drawCountAllocation);
+    allocator.DestroyBuffer(draws, drawsAllocation);
+    allocator.DestroyBuffer(meshes, meshesAllocation);
+    allocator.DestroyBuffer(instances, instancesAllocation);
+    delete kernel;
+}
+
+void GpuCulling::SetMeshes(const std::vector<CullMesh> &meshes) {
+    if (meshes.size() > maxMeshes) {
+        throw std::runtime_error("too many meshes for GPU culling");
+    }
+    if (meshes.size() < meshesUsed) {
+        throw std::runtime_error("current instances use a mesh past the new meshes");
+    }
+    memcpy(meshesAllocation.mapped, meshes.data(), meshes.size() * sizeof(CullMesh));
+    meshCount = static_cast<uint32_t>(meshes.size());
+}
+
+void GpuCulling::SetInstances(const std::vector<CullInstance> &instances) {
+    if (instances.size() > maxInstances) {
+        throw std::runtime_error("too many instances for GPU culling");
+    }
+    uint32_t used = 0;
+    for (const CullInstance &instance: instances) {
+        if (instance.mesh >= meshCount) {
+            throw std::runtime_error("instance mesh index out of range for GPU culling");
+        }
+        used = std::max(used, instance.mesh + 1);
+    }
+    memcpy(instancesAllocation.mapped, instances.data(), instances.size() * sizeof(CullInstance));
+    instanceCount = static_cast<uint32_t>(instances.size());
+    meshesUsed = used;
+}
+
+void GpuCulling::RecordCull(VkCommandBuffer commandBuffer, const glm::mat4 &viewProjection) {
+    if (instanceCount == 0)
+        return;
+
+    // The previous frame's draws may still be reading the commands this overwrites
+    VkMemoryBarrier afterDraws{};
+    afterDraws.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &afterDraws, 0, nullptr, 0, nullptr);
+    if (compact) {
+        vkCmdFillBuffer(commandBuffer, drawCount, 0, sizeof(uint32_t), 0);
+        VkMemoryBarrier cleared{};
+        cleared.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        cleared.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        cleared.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &cleared, 0, nullptr, 0, nullptr);
+    }
+
+    PushConstants constants{};
+    std::array<glm::vec4, 6> planes = FrustumPlanes(viewProjection);
+    std::copy(planes.begin(), planes.end(), constants.planes);
+    constants.instanceCount = instanceCount;
+    constants.compact = compact ? 1 : 0;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->Pipeline());
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->Layout(), 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, kernel->Layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(commandBuffer, kernel->GroupsFor(instanceCount)[0], 1, 1);
+
+    VkMemoryBarrier culled{};
+    culled.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    culled.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    culled.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &culled, 0, nullptr, 0, nullptr);
+}
+
+void GpuCulling::RecordDraw(VkCommandBuffer commandBuffer) {
+    if (instanceCount == 0)
+        return;
+
+    uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    if (compact) {
+        device.cmdDrawIndexedIndirectCount(commandBuffer, draws, 0, drawCount, 0, instanceCount, stride);
+    } else if (device.features.multiDrawIndirect) {
+        vkCmdDrawIndexedIndirect(commandBuffer, draws, 0, instanceCount, stride);
+    } else {
+        // Still culled on the GPU, but the CPU cost grows with the instance count again
+        for (uint32_t i = 0; i < instanceCount; i++)
+            vkCmdDrawIndexedIndirect(commandBuffer, draws, i * stride, 1, stride);
+    }
+}
+
+VkBuffer GpuCulling::InstanceBuffer() {
+    return instances;
+}
+
+VkBuffer GpuCulling::DrawBuffer() {
+    return draws;
+}
+
+VkBuffer GpuCulling::DrawCountBuffer() {
+    return drawCount;
+}
+
+uint32_t GpuCulling::InstanceCount() {
+    return instanceCount;
+}
+
+bool GpuCulling::Compacted() {
+    return compact;
+}
+
+// Gribb and Hartmann: each plane is the last row of the matrix plus or minus another row, near is the third row alone
+// because clip space depth starts at 0
+std::array<glm::vec4, 6> GpuCulling::FrustumPlanes(const glm::mat4 &viewProjection) {
+    glm::mat4 rows = glm::transpose(viewProjection);
+    std::array<glm::vec4, 6> planes = {
+        rows[3] + rows[0],
+        rows[3] - rows[0],
+        rows[3] + rows[1],
+        rows[3] - rows[1],
+        rows[2],
+        rows[3] - rows[2],
+    };
+    for (glm::vec4 &plane: planes)
+        plane /= glm::length(glm::vec3(plane));
+    return planes;
+}
+
+// Same test as the shader, for CPU side culling and checking the GPU
+bool GpuCulling::Visible(const std::array<glm::vec4, 6> &planes, const CullInstance &instance) {
+    const glm::mat4 &transform = instance.transform;
+    glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(instance.boundingSphere), 1.0f));
+    float scale = glm::sqrt(glm::max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+        glm::max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])))));
+    float radius = instance.boundingSphere.w * scale;
+    for (const glm::vec4 &plane: planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+            return false;
+    }
+    return true;
+}
+
+VkBuffer GpuCulling::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible, Allocation &allocation) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (hostVisible) {
+        return allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+    }
+    return allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, allocation);
+}
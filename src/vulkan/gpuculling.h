@@ -0,0 +1,89 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <array>
+#include <vector>
+#include <glm/glm.hpp>
+#include "logicaldevice.h"
+#include "memoryallocator.h"
+#include "computerunner.h"
+
+// Both match the std430 structs in shaders/cull.comp
+struct CullInstance {
+    glm::mat4 transform = glm::mat4(1.0f);
+    glm::vec4 boundingSphere = glm::vec4(0.0f);  // Object space center and radius
+    uint32_t mesh = 0;
+    uint32_t padding[3] = {};
+};
+
+struct CullMesh {
+    uint32_t indexCount = 0;
+    uint32_t firstIndex = 0;
+    int32_t vertexOffset = 0;
+    uint32_t padding = 0;
+};
+
+// GPU driven draws. A compute pass tests every instance's bounding sphere against the camera frustum and writes an
+// indexed indirect command for it, with firstInstance set to the instance index so the vertex shader finds its
+// transform in InstanceBuffer() through gl_InstanceIndex. With drawIndirectCount the survivors are compacted and
+// drawn by a single vkCmdDrawIndexedIndirectCount, otherwise culled instances keep their slot with instanceCount 0.
+// Either way the CPU records the same handful of commands for a thousand instances or a million.
+//
+// Instances and meshes are host visible and written directly, don't change them while a frame using them is in flight.
+class GpuCulling {
+    private:
+    struct PushConstants {
+        glm::vec4 planes[6];
+        uint32_t instanceCount;
+        uint32_t compact;
+    };
+
+    const LogicalDevice &device;
+    MemoryAllocator &allocator;
+    ComputeKernel *kernel = nullptr;
+    uint32_t maxInstances;
+    uint32_t maxMeshes;
+    uint32_t instanceCount = 0;
+    uint32_t meshCount = 0;
+    // One past the highest mesh index the current instances use
+    uint32_t meshesUsed = 0;
+    bool compact;
+
+    VkBuffer instances = VK_NULL_HANDLE;
+    Allocation instancesAllocation;
+    VkBuffer meshes = VK_NULL_HANDLE;
+    Allocation meshesAllocation;
+    VkBuffer draws = VK_NULL_HANDLE;
+    Allocation drawsAllocation;
+    VkBuffer drawCount = VK_NULL_HANDLE;
+    Allocation drawCountAllocation;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    public:
+    GpuCulling(const LogicalDevice &device, MemoryAllocator &allocator, const std::vector<uint32_t> &cullSpirv, uint32_t maxInstances,
+        uint32_t maxMeshes = 1024, VkPipelineCache pipelineCache = VK_NULL_HANDLE);
+    ~GpuCulling();
+
+    // Both throw when an instance would index past the meshes, the shader reads meshes[instance.mesh] unchecked
+    void SetMeshes(const std::vector<CullMesh> &meshes);
+    void SetInstances(const std::vector<CullInstance> &instances);
+    // Outside a render pass, leaves the draw commands ready for the draw indirect stage
+    void RecordCull(VkCommandBuffer commandBuffer, const glm::mat4 &viewProjection);
+    // Inside a render pass, with a pipeline, vertex and index buffers bound
+    void RecordDraw(VkCommandBuffer commandBuffer);
+
+    VkBuffer InstanceBuffer();
+    VkBuffer DrawBuffer();
+    // Only written when Compacted()
+    VkBuffer DrawCountBuffer();
+    uint32_t InstanceCount();
+    bool Compacted();
+
+    // Vulkan clip space, depth 0 to 1 (perspectiveRH_ZO and friends). Normals point inside.
+    static std::array<glm::vec4, 6> FrustumPlanes(const glm::mat4 &viewProjection);
+    static bool Visible(const std::array<glm::vec4, 6> &planes, const CullInstance &instance);
+
+    private:
+    VkBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible, Allocation &allocation);
+};
@@ -0,0 +1,260 @@
+#include "gpuprofiler.h"
+
+#include <iomanip>
+#include <iostream>
+
+GpuProfiler::GpuProfiler(const LogicalDevice &device, uint32_t framesInFlight, TraceWriter *trace, uint32_t maxScopes) : device(device) {
+    this->trace = trace;
+    this->maxQueries = maxScopes * 2;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device.physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device.physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.physicalDevice, &queueFamilyCount, queueFamilies.data());
+    uint32_t validBits = queueFamilies[device.queueFamilies.graphicsFamily.value()].timestampValidBits;
+    if (validBits == 0) {
+        std::cout << "Graphics queue has no timestamps, GPU profiling disabled" << std::endl;
+        return;
+    }
+    timestampMask = validBits >= 64 ? ~0ULL : ((1ULL << validBits) - 1);
+
+    frames.resize(framesInFlight);
+    for (FrameQueries &frame: frames) {
+        VkQueryPoolCreateInfo queryInfo{};
+        queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryInfo.queryCount = maxQueries;
+        if (vkCreateQueryPool(device.device, &queryInfo, nullptr, &frame.pool) != VK_SUCCESS) {
+            throw std::runtime_error("error creating profiler query pool");
+        }
+    }
+
+    if (trace)
+        calibrate();
+}
+
+GpuProfiler::~GpuProfiler() {
+    for (FrameQueries &frame: frames) {
+        vkDestroyQueryPool(device.device, frame.pool, nullptr);
+    }
+}
+
+// Must be called at the start of the frame's command buffer, after the fence of the last submission of frameIndex
+// has been waited on
+void GpuProfiler::BeginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    if (Enabled() && frames[frameIndex].pending)
+        readResults(frames[frameIndex]);
+    // Counted even without timestamps, the CPU times still get reported
+    if (++reportedFrames >= REPORT_WINDOW)
+        report();
+    if (!Enabled())
+        return;
+
+    current = frameIndex;
+    FrameQueries &frame = frames[current];
+
+    frame.scopes.clear();
+    frame.used = 0;
+    frame.pending = true;
+    openScopes.clear();
+    vkCmdResetQueryPool(commandBuffer, frame.pool, 0, maxQueries);
+}
+
+void GpuProfiler::BeginScope(VkCommandBuffer commandBuffer, const char *name) {
+    if (!Enabled())
+        return;
+
+    FrameQueries &frame = frames[current];
+    // Keep the nesting balanced even when out of queries, the scope is just not timed
+    if (frame.used + 2 > maxQueries) {
+        if (!overflowed)
+            std::cout << "GPU profiler out of queries, increase maxScopes" << std::endl;
+        overflowed = true;
+        openScopes.push_back(UINT32_MAX);
+        return;
+    }
+
+    Scope scope;
+    scope.name = name;
+    scope.depth = static_cast<uint32_t>(openScopes.size());
+    scope.beginQuery = frame.used++;
+    // Reserve the end query now so queries stay in scope order
+    frame.used++;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.pool, scope.beginQuery);
+
+    openScopes.push_back(static_cast<uint32_t>(frame.scopes.size()));
+    frame.scopes.push_back(scope);
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer commandBuffer) {
+    if (!Enabled())
+        return;
+    if (openScopes.empty()) {
+        throw std::runtime_error("GPU profiler scope ended without a begin");
+    }
+
+    uint32_t index = openScopes.back();
+    openScopes.pop_back();
+    if (index == UINT32_MAX)
+        return;
+
+    Scope &scope = frames[current].scopes[index];
+    scope.endQuery = scope.beginQuery + 1;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frames[current].pool, scope.endQuery);
+}
+
+void GpuProfiler::AddCpuTimes(double frameMs, double waitMs) {
+    cpuFrameMs += frameMs;
+    cpuWaitMs += waitMs;
+    cpuFrames++;
+}
+
+bool GpuProfiler::Enabled() {
+    return !frames.empty();
+}
+
+const std::vector<GpuScopeResult>& GpuProfiler::LastResults() {
+    return lastResults;
+}
+
+// Writes a single timestamp and notes the trace time at which it was observed. The submission latency ends up as a
+// constant offset between the CPU and GPU tracks, which is good enough to line them up by eye.
+void GpuProfiler::calibrate() {
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+    VkCommandPool pool;
+    if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("error creating profiler command pool");
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = pool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    vkCmdResetQueryPool(commandBuffer, frames[0].pool, 0, 1);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frames[0].pool, 0);
+    vkEndCommandBuffer(commandBuffer);
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence;
+    vkCreateFence(device.device, &fenceInfo, nullptr, &fence);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    double submitted = TraceWriter::NowUs();
+    if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("error submitting profiler calibration");
+    }
+    vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
+    double completed = TraceWriter::NowUs();
+
+    vkGetQueryPoolResults(device.device, frames[0].pool, 0, 1, sizeof(calibrationTicks), &calibrationTicks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    calibrationTicks &= timestampMask;
+    calibrationUs = (submitted + completed) / 2.0;
+
+    vkDestroyFence(device.device, fence, nullptr);
+    vkDestroyCommandPool(device.device, pool, nullptr);
+}
+
+void GpuProfiler::readResults(FrameQueries &frame) {
+    frame.pending = false;
+    if (frame.used == 0)
+        return;
+
+    std::vector<uint64_t> ticks(frame.used);
+    VkResult result = vkGetQueryPoolResults(device.device, frame.pool, 0, frame.used, ticks.size() * sizeof(uint64_t), ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS)
+        return;
+
+    lastResults.clear();
+    std::vector<TraceEvent> events;
+    for (const Scope &scope: frame.scopes) {
+        // Left open when the frame was cut short, nothing to measure
+        if (scope.endQuery == UINT32_MAX)
+            continue;
+
+        uint64_t begin = ticks[scope.beginQuery] & timestampMask;
+        uint64_t elapsed = ((ticks[scope.endQuery] & timestampMask) - begin) & timestampMask;
+        GpuScopeResult scopeResult;
+        scopeResult.name = scope.name;
+        scopeResult.depth = scope.depth;
+        scopeResult.ms = elapsed * timestampPeriod / 1e6;
+        lastResults.push_back(scopeResult);
+
+        if (trace) {
+            TraceEvent event;
+            event.track = "GPU graphics queue";
+            event.name = scope.name;
+            event.startUs = calibrationUs + ((begin - calibrationTicks) & timestampMask) * timestampPeriod / 1e3;
+            event.durationUs = elapsed * timestampPeriod / 1e3;
+            events.push_back(event);
+        }
+    }
+    if (trace)
+        trace->Add(events);
+
+    accumulate();
+}
+
+void GpuProfiler::accumulate() {
+    for (const GpuScopeResult &scopeResult: lastResults) {
+        std::string key = std::to_string(scopeResult.depth) + "/" + scopeResult.name;
+        auto found = passIndex.find(key);
+        if (found == passIndex.end()) {
+            found = passIndex.emplace(key, passTotals.size()).first;
+            PassTotal total;
+            total.name = scopeResult.name;
+            total.depth = scopeResult.depth;
+            passTotals.push_back(total);
+        }
+        PassTotal &total = passTotals[found->second];
+        total.totalMs += scopeResult.ms;
+        total.count++;
+    }
+}
+
+// Prints the averages over the last REPORT_WINDOW frames. When the CPU spends a noticeable part of the frame waiting
+// on fences the GPU is the bottleneck, otherwise the CPU is. Passes are indented by nesting depth, the depth 0 scopes
+// are the GPU frame time.
+void GpuProfiler::report() {
+    if (cpuFrames > 0) {
+        double frame = cpuFrameMs / cpuFrames;
+        double wait = cpuWaitMs / cpuFrames;
+        std::cout << "Frame " << frame << "ms, CPU wait " << wait << "ms (" << (wait > frame * 0.1 ? "GPU" : "CPU") << " bound)" << std::endl;
+        cpuFrameMs = 0.0;
+        cpuWaitMs = 0.0;
+        cpuFrames = 0;
+    }
+    reportedFrames = 0;
+    if (passTotals.empty())
+        return;
+
+    std::cout << "GPU passes, average over " << REPORT_WINDOW << " frames:" << std::endl;
+    for (PassTotal &total: passTotals) {
+        if (total.count == 0)
+            continue;
+        std::string label = std::string(total.depth * 2, ' ') + total.name;
+        std::cout << "  " << std::left << std::setw(32) << label << std::right << std::fixed << std::setprecision(3)
+                  << total.totalMs / total.count << "ms" << std::endl;
+        total.totalMs = 0.0;
+        total.count = 0;
+    }
+    std::cout << std::defaultfloat;
+}
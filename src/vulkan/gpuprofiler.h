@@ -0,0 +1,100 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "logicaldevice.h"
+#include "profiler/trace.h"
+
+struct GpuScopeResult {
+    std::string name;
+    uint32_t depth = 0;
+    double ms = 0.0;
+};
+
+// Named, nestable GPU timing scopes built on timestamp queries. There is one query pool per frame in flight and a
+// frame's results are read back when that frame comes around again, after its fence, so reading never stalls.
+// Results feed a per-pass table printed every REPORT_WINDOW frames and, optionally, a trace. The profiler owns all GPU
+// timestamps, frame times included: record a depth 0 scope around the frame to get them.
+class GpuProfiler {
+    private:
+    struct Scope {
+        std::string name;
+        uint32_t depth = 0;
+        uint32_t beginQuery = 0;
+        uint32_t endQuery = UINT32_MAX;
+    };
+
+    struct FrameQueries {
+        VkQueryPool pool = VK_NULL_HANDLE;
+        std::vector<Scope> scopes;
+        uint32_t used = 0;
+        bool pending = false;
+    };
+
+    struct PassTotal {
+        std::string name;
+        uint32_t depth = 0;
+        double totalMs = 0.0;
+        uint32_t count = 0;
+    };
+
+    const LogicalDevice &device;
+    TraceWriter *trace;
+    std::vector<FrameQueries> frames;
+    uint32_t maxQueries;
+    uint32_t current = 0;
+    std::vector<uint32_t> openScopes;
+    bool overflowed = false;
+
+    float timestampPeriod = 0.0f;
+    uint64_t timestampMask = 0;
+    // A GPU tick and the trace time it was read at, to put GPU scopes on the CPU timeline
+    uint64_t calibrationTicks = 0;
+    double calibrationUs = 0.0;
+
+    std::vector<GpuScopeResult> lastResults;
+    std::vector<PassTotal> passTotals;
+    std::unordered_map<std::string, size_t> passIndex;
+    uint32_t reportedFrames = 0;
+    double cpuFrameMs = 0.0;
+    double cpuWaitMs = 0.0;
+    uint32_t cpuFrames = 0;
+
+    public:
+    static const uint32_t REPORT_WINDOW = 240;
+
+    GpuProfiler(const LogicalDevice &device, uint32_t framesInFlight, TraceWriter *trace = nullptr, uint32_t maxScopes = 128);
+    ~GpuProfiler();
+
+    void BeginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    // CPU side of the frame, from FrameRing::LastTimings(), so the report can say which side is the bottleneck
+    void AddCpuTimes(double frameMs, double waitMs);
+    void BeginScope(VkCommandBuffer commandBuffer, const char *name);
+    void EndScope(VkCommandBuffer commandBuffer);
+
+    bool Enabled();
+    const std::vector<GpuScopeResult>& LastResults();
+
+    private:
+    void calibrate();
+    void readResults(FrameQueries &frame);
+    void accumulate();
+    void report();
+};
+
+// Convenience for scopes that end with the C++ scope
+class GpuScope {
+    private:
+    GpuProfiler &profiler;
+    VkCommandBuffer commandBuffer;
+
+    public:
+    GpuScope(GpuProfiler &profiler, VkCommandBuffer commandBuffer, const char *name) : profiler(profiler), commandBuffer(commandBuffer) {
+        profiler.BeginScope(commandBuffer, name);
+    }
+    ~GpuScope() {
+        profiler.EndScope(commandBuffer);
+    }
+};
@@ -0,0 +1,62 @@
+#include "instancecapabilities.h"
+
+InstanceCapabilities::InstanceCapabilities() {
+    auto start = std::chrono::steady_clock::now();
+    VulkanLoader::Initialize();
+
+    // vkEnumerateInstanceVersion only exists in 1.1+ loaders, a missing entry point means 1.0
+    auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion"));
+    if (enumerateInstanceVersion != nullptr)
+        enumerateInstanceVersion(&apiVersion);
+
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+    extensions.resize(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+    extensions.resize(extensionCount);
+
+    uint32_t layerCount = 0;
+    vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+    layers.resize(layerCount);
+    vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+    layers.resize(layerCount);
+
+    enumerationTime = std::chrono::steady_clock::now() - start;
+
+    for (const auto &extension: extensions) {
+        extensionNames.insert(extension.extensionName);
+    }
+    for (const auto &layer: layers) {
+        layerNames.insert(layer.layerName);
+    }
+}
+
+// Function local static, so the first caller pays for the enumeration and initialization is thread safe
+const InstanceCapabilities& InstanceCapabilities::Get() {
+    static InstanceCapabilities capabilities;
+    return capabilities;
+}
+
+bool InstanceCapabilities::SupportsExtension(const char *name) const {
+    return extensionNames.count(name) > 0;
+}
+
+bool InstanceCapabilities::SupportsLayer(const char *name) const {
+    return layerNames.count(name) > 0;
+}
+
+uint32_t InstanceCapabilities::ApiVersion() const {
+    return apiVersion;
+}
+
+const std::vector<VkExtensionProperties>& InstanceCapabilities::Extensions() const {
+    return extensions;
+}
+
+const std::vector<VkLayerProperties>& InstanceCapabilities::Layers() const {
+    return layers;
+}
+
+std::chrono::steady_clock::duration InstanceCapabilities::EnumerationTime() const {
+    return enumerationTime;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <chrono>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Instance level extensions, layers and version, enumerated once per process. Asking the loader is not free, it scans
+// every layer manifest each time, so everything that needs to know what the instance supports should come here.
+class InstanceCapabilities {
+    private:
+    uint32_t apiVersion = VK_API_VERSION_1_0;
+    std::vector<VkExtensionProperties> extensions;
+    std::vector<VkLayerProperties> layers;
+    std::unordered_set<std::string> extensionNames;
+    std::unordered_set<std::string> layerNames;
+    std::chrono::steady_clock::duration enumerationTime;
+
+    InstanceCapabilities();
+
+    public:
+    static const InstanceCapabilities& Get();
+
+    bool SupportsExtension(const char *name) const;
+    bool SupportsLayer(const char *name) const;
+    uint32_t ApiVersion() const;
+    const std::vector<VkExtensionProperties>& Extensions() const;
+    const std::vector<VkLayerProperties>& Layers() const;
+    std::chrono::steady_clock::duration EnumerationTime() const;
+};
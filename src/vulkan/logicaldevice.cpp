@@ -0,0 +1,329 @@
+#include "logicaldevice.h"
+
+#include <algorithm>
+
+LogicalDeviceBuilder::LogicalDeviceBuilder(VkPhysicalDevice physicalDevice, uint32_t instanceApiVersion) {
+    this->physicalDevice = physicalDevice;
+    this->instanceApiVersion = instanceApiVersion;
+}
+
+LogicalDevice LogicalDeviceBuilder::Build() {
+    LogicalDevice logicalDevice;
+    logicalDevice.physicalDevice = physicalDevice;
+
+    // The usable version is the lowest of what the instance asked for and what the device implements
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    logicalDevice.apiVersion = std::min(instanceApiVersion, properties.apiVersion);
+
+    // A group of one is a plain device. Bigger ones need 1.1, below that only the first GPU is used.
+    logicalDevice.groupDevices = {physicalDevice};
+    if (groupDevices.size() > 1) {
+        if (logicalDevice.apiVersion >= VK_API_VERSION_1_1)
+            logicalDevice.groupDevices = groupDevices;
+        else
+            std::cout << "Device groups need Vulkan 1.1, using one of the " << groupDevices.size() << " devices" << std::endl;
+    }
+
+    std::unordered_set<std::string> extensions = getPhysicalDeviceExtensions();
+    for (auto req: this->requiredExtensions) {
+        if (extensions.count(req) == 0)
+            throw std::runtime_error(std::string("required device extension not supported: ") + req);
+    }
+    logicalDevice.enabledExtensions = this->requiredExtensions;
+
+    // Both chains have the same shape, the supported one is filled by the driver and the enabled one by negotiateFeatures
+    FeatureChain supported;
+    buildChain(supported, logicalDevice.apiVersion, extensions);
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &supported.features2);
+    FeatureChain enabled;
+    buildChain(enabled, logicalDevice.apiVersion, extensions);
+    logicalDevice.features = negotiateFeatures(supported, enabled, logicalDevice.apiVersion, extensions, logicalDevice.enabledExtensions);
+
+    logicalDevice.queueFamilies = findQueueFamilies(physicalDevice);
+    if (!logicalDevice.queueFamilies.isComplete()) {
+        throw std::runtime_error("physical device is missing required queue families");
+    }
+
+    float queuePriority = 1.0f;
+    std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+    for (uint32_t family: logicalDevice.queueFamilies.uniqueFamilies()) {
+        VkDeviceQueueCreateInfo queueCreateInfo{};
+        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfo.queueFamilyIndex = family;
+        queueCreateInfo.queueCount = 1;
+        queueCreateInfo.pQueuePriorities = &queuePriority;
+        queueCreateInfos.push_back(queueCreateInfo);
+    }
+
+    VkDeviceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = &enabled.features2;
+    VkDeviceGroupDeviceCreateInfo groupInfo{};
+    groupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_DEVICE_CREATE_INFO;
+    if (logicalDevice.groupDevices.size() > 1) {
+        groupInfo.pNext = &enabled.features2;
+        groupInfo.physicalDeviceCount = static_cast<uint32_t>(logicalDevice.groupDevices.size());
+        groupInfo.pPhysicalDevices = logicalDevice.groupDevices.data();
+        createInfo.pNext = &groupInfo;
+    }
+    createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+    createInfo.pQueueCreateInfos = queueCreateInfos.data();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(logicalDevice.enabledExtensions.size());
+    createInfo.ppEnabledExtensionNames = logicalDevice.enabledExtensions.data();
+    // Core features go through features2 in the pNext chain, pEnabledFeatures must stay null
+    createInfo.pEnabledFeatures = nullptr;
+
+    VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &logicalDevice.device);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("error creating logical device");
+    }
+    VulkanLoader::LoadDevice(logicalDevice.device);
+
+    // Roles that share a family get the same queue
+    QueueFamilyIndices &families = logicalDevice.queueFamilies;
+    vkGetDeviceQueue(logicalDevice.device, families.graphicsFamily.value(), 0, &logicalDevice.graphicsQueue);
+    vkGetDeviceQueue(logicalDevice.device, families.computeFamily.value(), 0, &logicalDevice.computeQueue);
+    vkGetDeviceQueue(logicalDevice.device, families.transferFamily.value(), 0, &logicalDevice.transferQueue);
+    if (families.sparsebindingFamily.has_value())
+        vkGetDeviceQueue(logicalDevice.device, families.sparsebindingFamily.value(), 0, &logicalDevice.sparsebindingQueue);
+
+    if (logicalDevice.features.timelineSemaphore) {
+        bool core12 = logicalDevice.apiVersion >= VK_API_VERSION_1_2;
+        logicalDevice.getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValue>(
+            vkGetDeviceProcAddr(logicalDevice.device, core12 ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR"));
+        logicalDevice.waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphores>(
+            vkGetDeviceProcAddr(logicalDevice.device, core12 ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR"));
+        logicalDevice.signalSemaphore = reinterpret_cast<PFN_vkSignalSemaphore>(
+            vkGetDeviceProcAddr(logicalDevice.device, core12 ? "vkSignalSemaphore" : "vkSignalSemaphoreKHR"));
+    }
+    if (logicalDevice.features.drawIndirectCount) {
+        bool core12 = logicalDevice.apiVersion >= VK_API_VERSION_1_2;
+        logicalDevice.cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCount>(
+            vkGetDeviceProcAddr(logicalDevice.device, core12 ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirectCountKHR"));
+    }
+    if (logicalDevice.features.synchronization2) {
+        bool core13 = logicalDevice.apiVersion >= VK_API_VERSION_1_3;
+        logicalDevice.cmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2>(
+            vkGetDeviceProcAddr(logicalDevice.device, core13 ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier2KHR"));
+    }
+
+    std::cout << "Device API " << VK_VERSION_MAJOR(logicalDevice.apiVersion) << "." << VK_VERSION_MINOR(logicalDevice.apiVersion) << ", features:" << std::endl;
+    std::cout << "- timeline semaphores: " << (logicalDevice.features.timelineSemaphore ? "yes" : "no") << std::endl;
+    std::cout << "- descriptor indexing: " << (logicalDevice.features.descriptorIndexing ? "yes" : "no") << std::endl;
+    std::cout << "- buffer device address: " << (logicalDevice.features.bufferDeviceAddress ? "yes" : "no") << std::endl;
+    std::cout << "- synchronization2: " << (logicalDevice.features.synchronization2 ? "yes" : "no") << std::endl;
+    std::cout << "- dynamic rendering: " << (logicalDevice.features.dynamicRendering ? "yes" : "no") << std::endl;
+    std::cout << "- draw indirect count: " << (logicalDevice.features.drawIndirectCount ? "yes" : "no") << std::endl;
+    std::cout << "- sparse residency: " << (logicalDevice.features.sparseResidency && logicalDevice.sparsebindingQueue != VK_NULL_HANDLE ? "yes" : "no") << std::endl;
+    std::cout << "- swapchain present fences: " << (logicalDevice.features.swapchainMaintenance1 ? "yes" : "no") << std::endl;
+    std::cout << "- devices in group: " << logicalDevice.groupDevices.size() << std::endl;
+
+    return logicalDevice;
+}
+
+LogicalDeviceBuilder& LogicalDeviceBuilder::RequireExtension(const char *extension) {
+    this->requiredExtensions.push_back(extension);
+    return *this;
+}
+
+// The builder's physical device must be in the group, it's the one features, queues and properties come from
+LogicalDeviceBuilder& LogicalDeviceBuilder::SetDeviceGroup(const PhysicalDeviceGroup &group) {
+    if (std::find(group.devices.begin(), group.devices.end(), physicalDevice) == group.devices.end()) {
+        throw std::runtime_error("physical device is not part of the device group");
+    }
+    // Its position decides the device indices, physicalDevice goes first so index 0 is the one we know most about
+    this->groupDevices = {physicalDevice};
+    for (VkPhysicalDevice device: group.devices) {
+        if (device != physicalDevice)
+            this->groupDevices.push_back(device);
+    }
+    return *this;
+}
+
+LogicalDeviceBuilder& LogicalDeviceBuilder::AllowSwapchainMaintenance() {
+    this->swapchainMaintenance = true;
+    return *this;
+}
+
+LogicalDeviceBuilder& LogicalDeviceBuilder::RequireExtensions(std::vector<const char*> extensions) {
+    this->requiredExtensions.insert(this->requiredExtensions.end(), extensions.begin(), extensions.end());
+    return *this;
+}
+
+// Links the feature structs that make sense for this API version. Promoted features are read from the VulkanXY structs,
+// older devices fall back to the per extension structs, which are only chained when the extension is there.
+void LogicalDeviceBuilder::buildChain(FeatureChain &chain, uint32_t apiVersion, const std::unordered_set<std::string> &extensions) {
+    void **next = &chain.features2.pNext;
+    auto link = [&next](auto &feature, VkStructureType type) {
+        feature.sType = type;
+        *next = &feature;
+        next = &feature.pNext;
+    };
+
+    chain.features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+
+    if (apiVersion >= VK_API_VERSION_1_2) {
+        link(chain.vulkan11, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES);
+        link(chain.vulkan12, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES);
+    } else {
+        if (extensions.count(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+            link(chain.timelineSemaphore, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES);
+        if (extensions.count(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+            link(chain.descriptorIndexing, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES);
+        if (extensions.count(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME))
+            link(chain.bufferDeviceAddress, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES);
+    }
+
+    if (apiVersion >= VK_API_VERSION_1_3) {
+        link(chain.vulkan13, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES);
+    } else {
+        if (extensions.count(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME))
+            link(chain.synchronization2, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR);
+        // Before 1.2 dynamic rendering also needs the extensions it depends on
+        bool dynamicRenderingDeps = apiVersion >= VK_API_VERSION_1_2 ||
+            (extensions.count(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME) && extensions.count(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME));
+        if (extensions.count(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) && dynamicRenderingDeps)
+            link(chain.dynamicRendering, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR);
+    }
+
+    // Not promoted, and only usable when the instance has the surface half of it
+    if (swapchainMaintenance && extensions.count(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME))
+        link(chain.swapchainMaintenance1, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT);
+}
+
+// Enables each wanted feature the device reports as supported, through the core struct when the feature is promoted
+// in this API version or through its extension otherwise. Unsupported features are simply left off.
+DeviceFeatures LogicalDeviceBuilder::negotiateFeatures(FeatureChain &supported, FeatureChain &enabled, uint32_t apiVersion, const std::unordered_set<std::string> &extensions, std::vector<const char*> &enabledExtensions) {
+    DeviceFeatures features;
+    bool core12 = apiVersion >= VK_API_VERSION_1_2;
+    bool core13 = apiVersion >= VK_API_VERSION_1_3;
+
+    auto enableExtension = [&enabledExtensions](const char *name) {
+        for (auto ext: enabledExtensions) {
+            if (std::string(ext) == name)
+                return;
+        }
+        enabledExtensions.push_back(name);
+    };
+
+    // Timeline semaphores
+    if (core12 && supported.vulkan12.timelineSemaphore) {
+        enabled.vulkan12.timelineSemaphore = VK_TRUE;
+        features.timelineSemaphore = true;
+    } else if (!core12 && supported.timelineSemaphore.timelineSemaphore) {
+        enabled.timelineSemaphore.timelineSemaphore = VK_TRUE;
+        enableExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+        features.timelineSemaphore = true;
+    }
+
+    // Descriptor indexing, only the subset needed for bindless style descriptor arrays. Member names are the same
+    // in the 1.2 core struct and the extension struct.
+    auto enableDescriptorIndexing = [](const auto &supportedFeatures, auto &enabledFeatures) {
+        bool available = supportedFeatures.shaderSampledImageArrayNonUniformIndexing &&
+            supportedFeatures.shaderStorageBufferArrayNonUniformIndexing &&
+            supportedFeatures.runtimeDescriptorArray &&
+            supportedFeatures.descriptorBindingPartiallyBound &&
+            supportedFeatures.descriptorBindingVariableDescriptorCount &&
+            supportedFeatures.descriptorBindingSampledImageUpdateAfterBind;
+        if (!available)
+            return false;
+        enabledFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        enabledFeatures.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+        enabledFeatures.runtimeDescriptorArray = VK_TRUE;
+        enabledFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        enabledFeatures.descriptorBindingVariableDescriptorCount = VK_TRUE;
+        enabledFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        return true;
+    };
+    if (core12) {
+        features.descriptorIndexing = enableDescriptorIndexing(supported.vulkan12, enabled.vulkan12);
+        if (features.descriptorIndexing)
+            enabled.vulkan12.descriptorIndexing = VK_TRUE;
+    } else if (enableDescriptorIndexing(supported.descriptorIndexing, enabled.descriptorIndexing)) {
+        enableExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        enableExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        features.descriptorIndexing = true;
+    }
+
+    // Buffer device address
+    if (core12 && supported.vulkan12.bufferDeviceAddress) {
+        enabled.vulkan12.bufferDeviceAddress = VK_TRUE;
+        features.bufferDeviceAddress = true;
+    } else if (!core12 && supported.bufferDeviceAddress.bufferDeviceAddress) {
+        enabled.bufferDeviceAddress.bufferDeviceAddress = VK_TRUE;
+        enableExtension(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+        features.bufferDeviceAddress = true;
+    }
+
+    // Synchronization2
+    if (core13 && supported.vulkan13.synchronization2) {
+        enabled.vulkan13.synchronization2 = VK_TRUE;
+        features.synchronization2 = true;
+    } else if (!core13 && supported.synchronization2.synchronization2) {
+        enabled.synchronization2.synchronization2 = VK_TRUE;
+        enableExtension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+        features.synchronization2 = true;
+    }
+
+    // Dynamic rendering
+    if (core13 && supported.vulkan13.dynamicRendering) {
+        enabled.vulkan13.dynamicRendering = VK_TRUE;
+        features.dynamicRendering = true;
+    } else if (!core13 && supported.dynamicRendering.dynamicRendering) {
+        enabled.dynamicRendering.dynamicRendering = VK_TRUE;
+        if (!core12) {
+            enableExtension(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+            enableExtension(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME);
+        }
+        enableExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+        features.dynamicRendering = true;
+    }
+
+    // Indirect draws, for GPU driven rendering
+    if (supported.features2.features.multiDrawIndirect) {
+        enabled.features2.features.multiDrawIndirect = VK_TRUE;
+        features.multiDrawIndirect = true;
+    }
+    if (supported.features2.features.drawIndirectFirstInstance) {
+        enabled.features2.features.drawIndirectFirstInstance = VK_TRUE;
+        features.drawIndirectFirstInstance = true;
+    }
+    // The extension has no feature struct, being there is enough
+    if (core12 && supported.vulkan12.drawIndirectCount) {
+        enabled.vulkan12.drawIndirectCount = VK_TRUE;
+        features.drawIndirectCount = true;
+    } else if (!core12 && extensions.count(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+        enableExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        features.drawIndirectCount = true;
+    }
+
+    // Sparse residency, for virtual texturing
+    if (supported.features2.features.sparseBinding && supported.features2.features.sparseResidencyImage2D) {
+        enabled.features2.features.sparseBinding = VK_TRUE;
+        enabled.features2.features.sparseResidencyImage2D = VK_TRUE;
+        features.sparseResidency = true;
+    }
+
+    // Present fences, so retired swapchains can go as soon as their presents are done
+    if (supported.swapchainMaintenance1.swapchainMaintenance1) {
+        enabled.swapchainMaintenance1.swapchainMaintenance1 = VK_TRUE;
+        enableExtension(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME);
+        features.swapchainMaintenance1 = true;
+    }
+
+    return features;
+}
+
+std::unordered_set<std::string> LogicalDeviceBuilder::getPhysicalDeviceExtensions() {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+    std::unordered_set<std::string> names;
+    for (const auto &extension: extensions) {
+        names.insert(extension.extensionName);
+    }
+    return names;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "physicaldevice.h"
+
+// Performance relevant features the rest of the engine can check before taking a fast path.
+// Every flag is only true if the device supports it and it was enabled at device creation.
+struct DeviceFeatures {
+    bool timelineSemaphore = false;
+    bool descriptorIndexing = false;
+    bool bufferDeviceAddress = false;
+    bool synchronization2 = false;
+    bool dynamicRendering = false;
+    bool multiDrawIndirect = false;
+    bool drawIndirectFirstInstance = false;
+    bool drawIndirectCount = false;
+    // sparseBinding and sparseResidencyImage2D, still needs LogicalDevice::sparsebindingQueue to be any use
+    bool sparseResidency = false;
+    // VK_EXT_swapchain_maintenance1, for present fences. Only with AllowSwapchainMaintenance().
+    bool swapchainMaintenance1 = false;
+};
+
+struct LogicalDevice {
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    // Every GPU behind the device, physicalDevice first. Only more than one when built with SetDeviceGroup().
+    std::vector<VkPhysicalDevice> groupDevices;
+    uint32_t apiVersion = 0;
+    QueueFamilyIndices queueFamilies;
+    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    VkQueue computeQueue = VK_NULL_HANDLE;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    VkQueue sparsebindingQueue = VK_NULL_HANDLE;
+    DeviceFeatures features;
+    std::vector<const char*> enabledExtensions;
+
+    // Timeline semaphore entry points, core in 1.2 and KHR suffixed before. Only set when features.timelineSemaphore is.
+    PFN_vkGetSemaphoreCounterValue getSemaphoreCounterValue = nullptr;
+    PFN_vkWaitSemaphores waitSemaphores = nullptr;
+    PFN_vkSignalSemaphore signalSemaphore = nullptr;
+    // synchronization2 barriers, core in 1.3 and KHR suffixed before. Only set when features.synchronization2 is.
+    PFN_vkCmdPipelineBarrier2 cmdPipelineBarrier2 = nullptr;
+    // Core in 1.2, KHR suffixed before. Only set when features.drawIndirectCount is.
+    PFN_vkCmdDrawIndexedIndirectCount cmdDrawIndexedIndirectCount = nullptr;
+};
+
+class LogicalDeviceBuilder {
+    private:
+    VkPhysicalDevice physicalDevice;
+    uint32_t instanceApiVersion;
+    std::vector<const char*> requiredExtensions;
+    std::vector<VkPhysicalDevice> groupDevices;
+    bool swapchainMaintenance = false;
+
+    // Feature structs are chained through pNext, so they must outlive Build()'s call to vkCreateDevice
+    struct FeatureChain {
+        VkPhysicalDeviceFeatures2 features2{};
+        VkPhysicalDeviceVulkan11Features vulkan11{};
+        VkPhysicalDeviceVulkan12Features vulkan12{};
+        VkPhysicalDeviceVulkan13Features vulkan13{};
+        VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphore{};
+        VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexing{};
+        VkPhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddress{};
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2{};
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRendering{};
+        VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT swapchainMaintenance1{};
+    };
+
+    public:
+    LogicalDevice Build();
+    LogicalDeviceBuilder& RequireExtension(const char *extension);
+    LogicalDeviceBuilder& RequireExtensions(std::vector<const char*> extensions);
+    LogicalDeviceBuilder& SetDeviceGroup(const PhysicalDeviceGroup &group);
+    // The instance enabled VK_EXT_surface_maintenance1, so the device may enable swapchain maintenance if it has it
+    LogicalDeviceBuilder& AllowSwapchainMaintenance();
+    LogicalDeviceBuilder(VkPhysicalDevice physicalDevice, uint32_t instanceApiVersion);
+
+    private:
+    void buildChain(FeatureChain &chain, uint32_t apiVersion, const std::unordered_set<std::string> &extensions);
+    DeviceFeatures negotiateFeatures(FeatureChain &supported, FeatureChain &enabled, uint32_t apiVersion, const std::unordered_set<std::string> &extensions, std::vector<const char*> &enabledExtensions);
+    std::unordered_set<std::string> getPhysicalDeviceExtensions();
+};
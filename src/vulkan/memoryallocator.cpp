@@ -0,0 +1,385 @@
+#include "memoryallocator.h"
+
+#include <algorithm>
+#include <iostream>
+
+MemoryAllocator::BuddyBlock::BuddyBlock(VkDeviceMemory memory, VkDeviceSize size, void *mapped) {
+    this->memory = memory;
+    this->size = size;
+    this->mapped = mapped;
+    maxOrder = orderFor(size);
+    freeLists.resize(maxOrder + 1);
+    freeLists[maxOrder].insert(0);
+}
+
+uint32_t MemoryAllocator::BuddyBlock::orderFor(VkDeviceSize size) const {
+    uint32_t order = 0;
+    while ((MIN_CHUNK_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+bool MemoryAllocator::BuddyBlock::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset) {
+    // Chunks are aligned to their own size, so asking for at least `alignment` bytes takes care of alignment
+    uint32_t order = orderFor(std::max(size, alignment));
+    if (order > maxOrder)
+        return false;
+
+    uint32_t available = order;
+    while (available <= maxOrder && freeLists[available].empty()) {
+        available++;
+    }
+    if (available > maxOrder)
+        return false;
+
+    // Split the smallest free chunk that fits until it has the right size, freeing the upper halves
+    offset = *freeLists[available].begin();
+    freeLists[available].erase(freeLists[available].begin());
+    while (available > order) {
+        available--;
+        freeLists[available].insert(offset + (MIN_CHUNK_SIZE << available));
+    }
+
+    allocated[offset] = {order, size};
+    used += MIN_CHUNK_SIZE << order;
+    requested += size;
+    return true;
+}
+
+void MemoryAllocator::BuddyBlock::Free(VkDeviceSize offset) {
+    auto found = allocated.find(offset);
+    if (found == allocated.end())
+        throw std::runtime_error("freeing memory that was not allocated from this block");
+
+    uint32_t order = found->second.first;
+    used -= MIN_CHUNK_SIZE << order;
+    requested -= found->second.second;
+    allocated.erase(found);
+
+    // Merge with the buddy as long as it is free too
+    while (order < maxOrder) {
+        VkDeviceSize buddy = offset ^ (MIN_CHUNK_SIZE << order);
+        auto buddyFree = freeLists[order].find(buddy);
+        if (buddyFree == freeLists[order].end())
+            break;
+        freeLists[order].erase(buddyFree);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    freeLists[order].insert(offset);
+}
+
+VkDeviceSize MemoryAllocator::BuddyBlock::LargestFreeRange() const {
+    for (uint32_t order = maxOrder + 1; order > 0; order--) {
+        if (!freeLists[order - 1].empty())
+            return MIN_CHUNK_SIZE << (order - 1);
+    }
+    return 0;
+}
+
+size_t MemoryAllocator::BuddyBlock::AllocationCount() const {
+    return allocated.size();
+}
+
+MemoryAllocator::MemoryAllocator(const LogicalDevice &device, VkDeviceSize blockSize) {
+    this->device = device.device;
+    this->deviceAddress = device.features.bufferDeviceAddress;
+
+    // Buddy blocks must be a power of two
+    this->blockSize = MIN_CHUNK_SIZE;
+    while (this->blockSize * 2 <= blockSize) {
+        this->blockSize *= 2;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device.physicalDevice, &properties);
+    bufferImageGranularity = properties.limits.bufferImageGranularity;
+    maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+    vkGetPhysicalDeviceMemoryProperties(device.physicalDevice, &memoryProperties);
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    MemoryStats stats = Stats();
+    if (stats.allocationCount > 0) {
+        std::cout << "MemoryAllocator destroyed with " << stats.allocationCount << " live allocations" << std::endl;
+    }
+
+    for (auto &pool: pools) {
+        for (auto &block: pool.second.blocks) {
+            if (block)
+                vkFreeMemory(device, block->memory, nullptr);
+        }
+    }
+    for (auto &dedicated: dedicatedAllocations) {
+        vkFreeMemory(device, dedicated.first, nullptr);
+    }
+}
+
+VkBuffer MemoryAllocator::CreateBuffer(const VkBufferCreateInfo &createInfo, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, Allocation &allocation) {
+    VkBuffer buffer;
+    if (vkCreateBuffer(device, &createInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("error creating buffer");
+    }
+
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+    VkMemoryRequirements2 requirements{};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+    VkBufferMemoryRequirementsInfo2 requirementsInfo{};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+    requirementsInfo.buffer = buffer;
+    vkGetBufferMemoryRequirements2(device, &requirementsInfo, &requirements);
+
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.buffer = buffer;
+    bool preferDedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+
+    try {
+        allocation = allocate(requirements.memoryRequirements, required, preferred, true, preferDedicated, &dedicatedInfo);
+    } catch (std::runtime_error&) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        throw;
+    }
+    vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+    return buffer;
+}
+
+VkImage MemoryAllocator::CreateImage(const VkImageCreateInfo &createInfo, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, Allocation &allocation) {
+    VkImage image;
+    if (vkCreateImage(device, &createInfo, nullptr, &image) != VK_SUCCESS) {
+        throw std::runtime_error("error creating image");
+    }
+
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+    VkMemoryRequirements2 requirements{};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+    VkImageMemoryRequirementsInfo2 requirementsInfo{};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+    requirementsInfo.image = image;
+    vkGetImageMemoryRequirements2(device, &requirementsInfo, &requirements);
+
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.image = image;
+    bool preferDedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+    bool linear = createInfo.tiling == VK_IMAGE_TILING_LINEAR;
+
+    try {
+        allocation = allocate(requirements.memoryRequirements, required, preferred, linear, preferDedicated, &dedicatedInfo);
+    } catch (std::runtime_error&) {
+        vkDestroyImage(device, image, nullptr);
+        throw;
+    }
+    vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+    return image;
+}
+
+void MemoryAllocator::DestroyBuffer(VkBuffer buffer, Allocation &allocation) {
+    vkDestroyBuffer(device, buffer, nullptr);
+    Free(allocation);
+}
+
+void MemoryAllocator::DestroyImage(VkImage image, Allocation &allocation) {
+    vkDestroyImage(device, image, nullptr);
+    Free(allocation);
+}
+
+Allocation MemoryAllocator::Allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool linear, bool preferDedicated) {
+    return allocate(requirements, required, preferred, linear, preferDedicated, nullptr);
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool linear, bool preferDedicated, const VkMemoryDedicatedAllocateInfo *dedicatedInfo) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, required, preferred);
+    VkDeviceSize typeBlockSize = blockSizeFor(memoryType);
+
+    // Anything bigger than half a block would waste most of it
+    if (preferDedicated || std::max(requirements.size, requirements.alignment) > typeBlockSize / 2)
+        return allocateDedicated(memoryType, requirements.size, dedicatedInfo);
+
+    uint32_t poolKey = memoryType * 2 + ((linear && bufferImageGranularity > 1) ? 1 : 0);
+    Pool &pool = pools[poolKey];
+    pool.memoryType = memoryType;
+
+    Allocation allocation;
+    allocation.memoryType = memoryType;
+    allocation.size = requirements.size;
+    allocation.pool = poolKey;
+
+    for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+        BuddyBlock *block = pool.blocks[i].get();
+        if (block && block->Allocate(requirements.size, requirements.alignment, allocation.offset)) {
+            allocation.memory = block->memory;
+            allocation.block = i;
+            allocation.mapped = block->mapped ? static_cast<uint8_t*>(block->mapped) + allocation.offset : nullptr;
+            return allocation;
+        }
+    }
+
+    // No room in the existing blocks, reuse a released slot or add a new one
+    void *mapped = nullptr;
+    VkMemoryAllocateFlagsInfo flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+    VkDeviceMemory memory = allocateDeviceMemory(memoryType, typeBlockSize, deviceAddress ? &flagsInfo : nullptr, &mapped);
+
+    auto slot = std::find(pool.blocks.begin(), pool.blocks.end(), nullptr);
+    if (slot == pool.blocks.end())
+        slot = pool.blocks.insert(pool.blocks.end(), nullptr);
+    *slot = std::make_unique<BuddyBlock>(memory, typeBlockSize, mapped);
+
+    BuddyBlock *block = slot->get();
+    block->Allocate(requirements.size, requirements.alignment, allocation.offset);
+    allocation.memory = block->memory;
+    allocation.block = static_cast<uint32_t>(slot - pool.blocks.begin());
+    allocation.mapped = mapped ? static_cast<uint8_t*>(mapped) + allocation.offset : nullptr;
+    return allocation;
+}
+
+Allocation MemoryAllocator::allocateDedicated(uint32_t memoryType, VkDeviceSize size, const VkMemoryDedicatedAllocateInfo *dedicatedInfo) {
+    VkMemoryAllocateFlagsInfo flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+    const void *pNext = nullptr;
+    if (deviceAddress) {
+        flagsInfo.pNext = dedicatedInfo;
+        pNext = &flagsInfo;
+    } else {
+        pNext = dedicatedInfo;
+    }
+
+    Allocation allocation;
+    allocation.memoryType = memoryType;
+    allocation.size = size;
+    allocation.dedicated = true;
+    allocation.memory = allocateDeviceMemory(memoryType, size, pNext, &allocation.mapped);
+    dedicatedAllocations[allocation.memory] = size;
+    dedicatedBytes += size;
+    return allocation;
+}
+
+void MemoryAllocator::Free(Allocation &allocation) {
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (allocation.dedicated) {
+        dedicatedBytes -= dedicatedAllocations[allocation.memory];
+        dedicatedAllocations.erase(allocation.memory);
+        vkFreeMemory(device, allocation.memory, nullptr);
+        liveAllocationCount--;
+        allocation = Allocation();
+        return;
+    }
+
+    Pool &pool = pools[allocation.pool];
+    std::unique_ptr<BuddyBlock> &block = pool.blocks[allocation.block];
+    block->Free(allocation.offset);
+
+    // Give empty blocks back to the driver, but keep at least one per pool to avoid thrashing on alloc/free cycles
+    if (block->AllocationCount() == 0) {
+        size_t liveBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(), [](const std::unique_ptr<BuddyBlock> &b) { return b != nullptr; });
+        if (liveBlocks > 1) {
+            vkFreeMemory(device, block->memory, nullptr);
+            block.reset();
+            liveAllocationCount--;
+        }
+    }
+    allocation = Allocation();
+}
+
+MemoryStats MemoryAllocator::Stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    MemoryStats stats;
+    for (auto &pool: pools) {
+        for (auto &block: pool.second.blocks) {
+            if (!block)
+                continue;
+            stats.blockCount++;
+            stats.allocationCount += static_cast<uint32_t>(block->AllocationCount());
+            stats.bytesReserved += block->size;
+            stats.bytesUsed += block->used;
+            stats.bytesRequested += block->requested;
+            stats.bytesFree += block->size - block->used;
+            stats.largestFreeRange = std::max(stats.largestFreeRange, block->LargestFreeRange());
+        }
+    }
+    stats.dedicatedCount = static_cast<uint32_t>(dedicatedAllocations.size());
+    stats.allocationCount += stats.dedicatedCount;
+    stats.bytesReserved += dedicatedBytes;
+    stats.bytesUsed += dedicatedBytes;
+    stats.bytesRequested += dedicatedBytes;
+
+    if (stats.bytesFree > 0)
+        stats.externalFragmentation = 1.0 - static_cast<double>(stats.largestFreeRange) / stats.bytesFree;
+    if (stats.bytesUsed > 0)
+        stats.internalFragmentation = 1.0 - static_cast<double>(stats.bytesRequested) / stats.bytesUsed;
+    return stats;
+}
+
+void MemoryAllocator::PrintStats() {
+    MemoryStats stats = Stats();
+    std::cout << "Device memory: " << stats.allocationCount << " allocations in " << stats.blockCount << " blocks + "
+              << stats.dedicatedCount << " dedicated, " << stats.bytesUsed / 1024 << "/" << stats.bytesReserved / 1024 << " KiB used, "
+              << "largest free range " << stats.largestFreeRange / 1024 << " KiB, "
+              << "fragmentation " << static_cast<int>(stats.externalFragmentation * 100) << "% external "
+              << static_cast<int>(stats.internalFragmentation * 100) << "% internal" << std::endl;
+}
+
+// Prefers a type with all the preferred flags, falls back to one with only the required ones
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+    for (VkMemoryPropertyFlags flags: {required | preferred, required}) {
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+                return i;
+        }
+    }
+    throw std::runtime_error("no suitable memory type");
+}
+
+// Small heaps (integrated GPUs, BAR memory) get smaller blocks so a single block doesn't eat a big share of the heap
+VkDeviceSize MemoryAllocator::blockSizeFor(uint32_t memoryType) {
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize size = blockSize;
+    while (size > MIN_CHUNK_SIZE && size > heapSize / 8) {
+        size /= 2;
+    }
+    return size;
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, const void *pNext, void **mapped) {
+    if (liveAllocationCount >= maxMemoryAllocationCount) {
+        throw std::runtime_error("device memory allocation count limit reached");
+    }
+
+    VkMemoryAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.pNext = pNext;
+    allocateInfo.allocationSize = size;
+    allocateInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device, &allocateInfo, nullptr, &memory) != VK_SUCCESS) {
+        throw std::runtime_error("error allocating device memory");
+    }
+    liveAllocationCount++;
+
+    // Host visible memory stays mapped for its whole life, mapping is not free and callers want a pointer anyway
+    *mapped = nullptr;
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+            vkFreeMemory(device, memory, nullptr);
+            liveAllocationCount--;
+            throw std::runtime_error("error mapping device memory");
+        }
+    }
+    return memory;
+}
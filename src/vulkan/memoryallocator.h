@@ -0,0 +1,112 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "logicaldevice.h"
+
+// A piece of device memory handed out by MemoryAllocator. Bind resources at memory + offset.
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = 0;
+    // Persistently mapped pointer to offset, only set for host visible memory
+    void *mapped = nullptr;
+    bool dedicated = false;
+
+    // Where the allocation came from, used by Free()
+    uint32_t pool = 0;
+    uint32_t block = 0;
+};
+
+struct MemoryStats {
+    uint32_t blockCount = 0;
+    uint32_t dedicatedCount = 0;
+    uint32_t allocationCount = 0;
+    VkDeviceSize bytesReserved = 0;   // Held in VkDeviceMemory blocks
+    VkDeviceSize bytesRequested = 0;  // Asked for by callers
+    VkDeviceSize bytesUsed = 0;       // Handed out, after rounding to power of two sizes
+    VkDeviceSize bytesFree = 0;
+    VkDeviceSize largestFreeRange = 0;
+    // 0 when all free memory is one range, close to 1 when it is scattered in small pieces
+    double externalFragmentation = 0.0;
+    // Share of used memory lost to power of two rounding
+    double internalFragmentation = 0.0;
+};
+
+// Sub-allocates buffers and images from large VkDeviceMemory blocks, one set of blocks per memory type, using a buddy
+// allocator inside each block. Big resources, and those the driver says prefer it, get a dedicated allocation instead.
+// Linear and optimal resources never share a block when bufferImageGranularity is bigger than 1, so they can't end up
+// on the same granularity page.
+class MemoryAllocator {
+    private:
+    // One VkDeviceMemory split in power of two sized chunks. Chunks of order k are (minChunkSize << k) bytes and start
+    // at a multiple of their size, which is what makes them naturally aligned.
+    class BuddyBlock {
+        public:
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        void *mapped = nullptr;
+        VkDeviceSize used = 0;
+        VkDeviceSize requested = 0;
+
+        BuddyBlock(VkDeviceMemory memory, VkDeviceSize size, void *mapped);
+        bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+        void Free(VkDeviceSize offset);
+        VkDeviceSize LargestFreeRange() const;
+        size_t AllocationCount() const;
+
+        private:
+        uint32_t maxOrder;
+        std::vector<std::set<VkDeviceSize>> freeLists;
+        std::unordered_map<VkDeviceSize, std::pair<uint32_t, VkDeviceSize>> allocated; // offset -> order, requested size
+        uint32_t orderFor(VkDeviceSize size) const;
+    };
+
+    struct Pool {
+        uint32_t memoryType;
+        std::vector<std::unique_ptr<BuddyBlock>> blocks;
+    };
+
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize bufferImageGranularity;
+    uint32_t maxMemoryAllocationCount;
+    bool deviceAddress;
+    VkDeviceSize blockSize;
+
+    std::mutex mutex;
+    uint32_t liveAllocationCount = 0;
+    std::map<uint32_t, Pool> pools;
+    std::unordered_map<VkDeviceMemory, VkDeviceSize> dedicatedAllocations;
+    VkDeviceSize dedicatedBytes = 0;
+
+    public:
+    static const VkDeviceSize MIN_CHUNK_SIZE = 256;
+
+    MemoryAllocator(const LogicalDevice &device, VkDeviceSize blockSize = 64 * 1024 * 1024);
+    ~MemoryAllocator();
+
+    VkBuffer CreateBuffer(const VkBufferCreateInfo &createInfo, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, Allocation &allocation);
+    VkImage CreateImage(const VkImageCreateInfo &createInfo, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, Allocation &allocation);
+    void DestroyBuffer(VkBuffer buffer, Allocation &allocation);
+    void DestroyImage(VkImage image, Allocation &allocation);
+
+    Allocation Allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool linear, bool preferDedicated = false);
+    void Free(Allocation &allocation);
+
+    MemoryStats Stats();
+    void PrintStats();
+
+    private:
+    uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred);
+    VkDeviceMemory allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, const void *pNext, void **mapped);
+    Allocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool linear, bool preferDedicated, const VkMemoryDedicatedAllocateInfo *dedicatedInfo);
+    Allocation allocateDedicated(uint32_t memoryType, VkDeviceSize size, const VkMemoryDedicatedAllocateInfo *dedicatedInfo);
+    VkDeviceSize blockSizeFor(uint32_t memoryType);
+};
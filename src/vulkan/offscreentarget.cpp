@@ -0,0 +1,131 @@
+#include "offscreentarget.h"
+
+#include <fstream>
+#include <iostream>
+
+OffscreenTarget::OffscreenTarget(const LogicalDevice &device, MemoryAllocator &allocator, VkExtent2D extent, uint32_t count, VkFormat format) : device(device), allocator(allocator) {
+    if (format != VK_FORMAT_R8G8B8A8_UNORM && format != VK_FORMAT_B8G8R8A8_UNORM) {
+        throw std::runtime_error("offscreen target only supports 8 bit RGBA/BGRA formats");
+    }
+    this->extent = extent;
+    this->format = format;
+
+    targets.resize(count);
+    for (Target &target: targets) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = format;
+        imageInfo.extent = {extent.width, extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        target.image = allocator.CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, target.imageAllocation);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = target.image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = format;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(device.device, &viewInfo, nullptr, &target.view) != VK_SUCCESS) {
+            throw std::runtime_error("error creating offscreen image view");
+        }
+
+        // Coherent so reading it back needs no invalidate, cached when available since the CPU reads every byte
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = ReadbackSize();
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        target.readback = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT, target.readbackAllocation);
+    }
+}
+
+OffscreenTarget::~OffscreenTarget() {
+    for (Target &target: targets) {
+        allocator.DestroyBuffer(target.readback, target.readbackAllocation);
+        vkDestroyImageView(device.device, target.view, nullptr);
+        allocator.DestroyImage(target.image, target.imageAllocation);
+    }
+}
+
+VkImage OffscreenTarget::Image(uint32_t index) {
+    return targets[index].image;
+}
+
+VkImageView OffscreenTarget::ImageView(uint32_t index) {
+    return targets[index].view;
+}
+
+VkBuffer OffscreenTarget::ReadbackBuffer(uint32_t index) {
+    return targets[index].readback;
+}
+
+VkDeviceSize OffscreenTarget::ReadbackSize() {
+    return static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+}
+
+const void* OffscreenTarget::ReadbackData(uint32_t index) {
+    return targets[index].readbackAllocation.mapped;
+}
+
+VkFormat OffscreenTarget::Format() {
+    return format;
+}
+
+VkExtent2D OffscreenTarget::Extent() {
+    return extent;
+}
+
+// Image must be in TRANSFER_SRC_OPTIMAL
+void OffscreenTarget::RecordReadback(VkCommandBuffer commandBuffer, uint32_t index) {
+    RecordReadback(commandBuffer, index, {{0, 0}, extent});
+}
+
+void OffscreenTarget::RecordReadback(VkCommandBuffer commandBuffer, uint32_t index, VkRect2D area) {
+    VkBufferImageCopy region{};
+    region.bufferOffset = (static_cast<VkDeviceSize>(area.offset.y) * extent.width + area.offset.x) * 4;
+    region.bufferRowLength = extent.width;
+    region.bufferImageHeight = extent.height;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {area.offset.x, area.offset.y, 0};
+    region.imageExtent = {area.extent.width, area.extent.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, targets[index].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, targets[index].readback, 1, &region);
+}
+
+// Binary PPM of the last readback into index, the frame that wrote it must have finished
+bool OffscreenTarget::WritePPM(uint32_t index, const std::string &path) {
+    const uint8_t *pixels = static_cast<const uint8_t*>(targets[index].readbackAllocation.mapped);
+    if (!pixels)
+        return false;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cout << "Could not write frame to " << path << std::endl;
+        return false;
+    }
+    file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+
+    bool bgra = format == VK_FORMAT_B8G8R8A8_UNORM;
+    std::vector<uint8_t> row(extent.width * 3);
+    for (uint32_t y = 0; y < extent.height; y++) {
+        const uint8_t *source = pixels + static_cast<size_t>(y) * extent.width * 4;
+        for (uint32_t x = 0; x < extent.width; x++) {
+            row[x * 3 + 0] = source[x * 4 + (bgra ? 2 : 0)];
+            row[x * 3 + 1] = source[x * 4 + 1];
+            row[x * 3 + 2] = source[x * 4 + (bgra ? 0 : 2)];
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+    std::cout << "Frame written to " << path << std::endl;
+    return file.good();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <string>
+#include <vector>
+#include "logicaldevice.h"
+#include "memoryallocator.h"
+
+// Stand-in for the swapchain when there is no window: one color image per frame in flight, plus a host visible
+// buffer per image the frame can be copied into for readback.
+class OffscreenTarget {
+    private:
+    struct Target {
+        VkImage image = VK_NULL_HANDLE;
+        Allocation imageAllocation;
+        VkImageView view = VK_NULL_HANDLE;
+        VkBuffer readback = VK_NULL_HANDLE;
+        Allocation readbackAllocation;
+    };
+
+    const LogicalDevice &device;
+    MemoryAllocator &allocator;
+    VkExtent2D extent;
+    VkFormat format;
+    std::vector<Target> targets;
+
+    public:
+    OffscreenTarget(const LogicalDevice &device, MemoryAllocator &allocator, VkExtent2D extent, uint32_t count, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM);
+    ~OffscreenTarget();
+
+    VkImage Image(uint32_t index);
+    VkImageView ImageView(uint32_t index);
+    VkBuffer ReadbackBuffer(uint32_t index);
+    VkDeviceSize ReadbackSize();
+    // Tightly packed rows, valid once the frame that read back into index has finished
+    const void* ReadbackData(uint32_t index);
+    VkFormat Format();
+    VkExtent2D Extent();
+
+    void RecordReadback(VkCommandBuffer commandBuffer, uint32_t index);
+    // Only area, to where it would be in a full readback
+    void RecordReadback(VkCommandBuffer commandBuffer, uint32_t index, VkRect2D area);
+    bool WritePPM(uint32_t index, const std::string &path);
+};
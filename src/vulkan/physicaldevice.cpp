@@ -1,4 +1,12 @@
 #include "physicaldevice.h"
+#include "instancecapabilities.h"
+
+#include <algorithm>
+
+// Per device after the first, enough for a linked pair to beat a lone GPU of the same type
+const uint64_t GROUP_DEVICE_SCORE = 4000;
+// Per preferred extension. The limits, memory and queue points below are capped under it so they only break ties.
+const uint64_t EXTENSION_SCORE = 10000;
 
 PhysicalDeviceBuilder::PhysicalDeviceBuilder(VkInstance instance) {
     this->instance = instance;
@@ -21,15 +29,82 @@ VkPhysicalDevice PhysicalDeviceBuilder::Build() {
         std::cout << deviceProperties.deviceID <<" "<< deviceProperties.deviceName <<" "<< deviceProperties.deviceType << std::endl;
     }
 
+    // Rank every suitable device instead of taking the first one, on hybrid laptops the integrated GPU is usually enumerated first
+    VkPhysicalDevice bestDevice = VK_NULL_HANDLE;
+    uint64_t bestScore = 0;
     for (auto physicalDevice: physicalDevices) {
-        if (isDeviceSuitable(physicalDevice)) {
-            vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
-            std::cout << "Selected device: " << deviceProperties.deviceID <<" "<< deviceProperties.deviceName <<" "<< deviceProperties.deviceType << std::endl;
-            return physicalDevice;
+        if (!isDeviceSuitable(physicalDevice))
+            continue;
+
+        uint64_t score = rateDevice(physicalDevice);
+        vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+        std::cout << "Score " << score << ": " << deviceProperties.deviceName << std::endl;
+        if (bestDevice == VK_NULL_HANDLE || score > bestScore) {
+            bestDevice = physicalDevice;
+            bestScore = score;
         }
     }
-    
-    throw std::runtime_error("no suitable physical device found");
+
+    if (bestDevice == VK_NULL_HANDLE) {
+        throw std::runtime_error("no suitable physical device found");
+    }
+
+    vkGetPhysicalDeviceProperties(bestDevice, &deviceProperties);
+    std::cout << "Selected device: " << deviceProperties.deviceID <<" "<< deviceProperties.deviceName <<" "<< deviceProperties.deviceType << std::endl;
+    return bestDevice;
+}
+
+// Device groups are core in 1.1. Before that, or without a loader that knows them, every device is a group of its own.
+// Every device in a group must be suitable, the group is rated as its first device plus a bonus per extra one.
+PhysicalDeviceGroup PhysicalDeviceBuilder::BuildGroup() {
+    PhysicalDeviceGroup bestGroup;
+    if (InstanceCapabilities::Get().ApiVersion() < VK_API_VERSION_1_1 || !vkEnumeratePhysicalDeviceGroups) {
+        bestGroup.devices.push_back(Build());
+        return bestGroup;
+    }
+
+    uint32_t groupCount = 0;
+    vkEnumeratePhysicalDeviceGroups(instance, &groupCount, nullptr);
+    if (groupCount == 0) {
+        throw std::runtime_error("no physical devices found");
+    }
+    std::vector<VkPhysicalDeviceGroupProperties> groups(groupCount);
+    for (auto &group: groups) {
+        group.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES;
+    }
+    vkEnumeratePhysicalDeviceGroups(instance, &groupCount, groups.data());
+
+    std::cout << "Device groups found: " << std::endl;
+    VkPhysicalDeviceProperties deviceProperties;
+    uint64_t bestScore = 0;
+    for (uint32_t i = 0; i < groupCount; i++) {
+        const VkPhysicalDeviceGroupProperties &group = groups[i];
+        vkGetPhysicalDeviceProperties(group.physicalDevices[0], &deviceProperties);
+        std::cout << i << ": " << group.physicalDeviceCount << "x " << deviceProperties.deviceName << std::endl;
+
+        bool suitable = true;
+        for (uint32_t j = 0; j < group.physicalDeviceCount; j++) {
+            suitable = suitable && isDeviceSuitable(group.physicalDevices[j]);
+        }
+        if (!suitable)
+            continue;
+
+        uint64_t score = rateDevice(group.physicalDevices[0]) + GROUP_DEVICE_SCORE * (group.physicalDeviceCount - 1);
+        std::cout << "Score " << score << ": group " << i << std::endl;
+        if (bestGroup.devices.empty() || score > bestScore) {
+            bestGroup.devices.assign(group.physicalDevices, group.physicalDevices + group.physicalDeviceCount);
+            bestGroup.subsetAllocation = group.subsetAllocation;
+            bestScore = score;
+        }
+    }
+
+    if (bestGroup.devices.empty()) {
+        throw std::runtime_error("no suitable physical device group found");
+    }
+
+    vkGetPhysicalDeviceProperties(bestGroup.devices[0], &deviceProperties);
+    std::cout << "Selected device group: " << bestGroup.devices.size() << "x " << deviceProperties.deviceName << std::endl;
+    return bestGroup;
 }
 
 PhysicalDeviceBuilder& PhysicalDeviceBuilder::RequireExtension(const char *extension) {
@@ -62,6 +137,13 @@ PhysicalDeviceBuilder& PhysicalDeviceBuilder::PreferDiscrete() {
     return *this;
 }
 
+// The device must be able to present to this surface from its graphics queue family
+PhysicalDeviceBuilder& PhysicalDeviceBuilder::RequirePresent(VkSurfaceKHR surface) {
+    this->presentSurface = surface;
+    this->requiredExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    return *this;
+}
+
 
 
 bool PhysicalDeviceBuilder::isDeviceSuitable(VkPhysicalDevice device){
@@ -70,37 +152,201 @@ bool PhysicalDeviceBuilder::isDeviceSuitable(VkPhysicalDevice device){
     vkGetPhysicalDeviceProperties(device, &properties);
 
     // If require_discrete and properties say this is not discrete, return false.
-    if (this->require_discrete)
-        return properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
-    
-    // TODO: support preference for discrete
+    if (this->require_discrete && properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+        return false;
 
     // Get device supported extensions
-    std::vector<VkExtensionProperties> extensions = getPhysicalDeviceExtensions(device);
+    const std::unordered_set<std::string> &extensions = getPhysicalDeviceExtensions(device);
     // If any requiredExtensions are not supported return false
     for (auto req: this->requiredExtensions) {
-        bool found = false;
-        for (auto ext: extensions) {
-            if (req == std::string(ext.extensionName)) {
-                found = true;
-                break;
-            }
-        }
-        if (!found)
+        if (extensions.count(req) == 0)
             return false;
     }
 
-    // TODO: add preferredExtensions support
-    
-    // TODO: QueueFamilies
+    if (!findQueueFamilies(device).isComplete())
+        return false;
+
+    if (this->presentSurface != VK_NULL_HANDLE && !canPresent(device))
+        return false;
 
     return true;
 }
 
-std::vector<VkExtensionProperties> PhysicalDeviceBuilder::getPhysicalDeviceExtensions(VkPhysicalDevice device) {
+// Presenting from the graphics queue avoids an ownership transfer of every swapchain image, so that's all we accept
+bool PhysicalDeviceBuilder::canPresent(VkPhysicalDevice device) {
+    QueueFamilyIndices indices = findQueueFamilies(device);
+    VkBool32 supported = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(device, indices.graphicsFamily.value(), this->presentSurface, &supported);
+    if (!supported)
+        return false;
+
+    uint32_t formatCount = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, this->presentSurface, &formatCount, nullptr);
+    uint32_t presentModeCount = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device, this->presentSurface, &presentModeCount, nullptr);
+    return formatCount > 0 && presentModeCount > 0;
+}
+
+// Higher is better. Only called for devices that already passed isDeviceSuitable, so this is about preference, not support.
+// Device type dominates, then preferred extensions, and the rest breaks ties between similar devices. Each type step is
+// worth more than every preferred extension together, so extensions can't lift a device over a better type.
+uint64_t PhysicalDeviceBuilder::rateDevice(VkPhysicalDevice device) {
+    uint64_t score = 0;
+
+    // Subgroup properties need vkGetPhysicalDeviceProperties2, which a 1.0 instance doesn't have
+    VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+    subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    if (InstanceCapabilities::Get().ApiVersion() >= VK_API_VERSION_1_1) {
+        properties2.pNext = &subgroupProperties;
+        vkGetPhysicalDeviceProperties2(device, &properties2);
+    } else {
+        vkGetPhysicalDeviceProperties(device, &properties2.properties);
+    }
+    const VkPhysicalDeviceProperties &properties = properties2.properties;
+
+    // Device type, discrete already ranks first so PreferDiscrete() only widens the gap
+    uint64_t typeRank = 0;
+    switch (properties.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+            typeRank = this->prefer_discrete ? 8 : 4;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+            typeRank = 3;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+            typeRank = 2;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:
+            typeRank = 1;
+            break;
+        default:
+            break;
+    }
+    uint64_t typeScore = typeRank * EXTENSION_SCORE * (this->preferredExtensions.size() + 1);
+
+    // Preferred extensions
+    uint64_t extensionScore = 0;
+    const std::unordered_set<std::string> &extensions = getPhysicalDeviceExtensions(device);
+    for (auto pref: this->preferredExtensions) {
+        if (extensions.count(pref) > 0)
+            extensionScore += EXTENSION_SCORE;
+    }
+
+    // Device local memory, 1 point per 64MiB of the biggest heap, capped at 64GiB
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+    VkDeviceSize deviceLocalSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            deviceLocalSize = std::max(deviceLocalSize, memoryProperties.memoryHeaps[i].size);
+    }
+    score += std::min<uint64_t>(deviceLocalSize / (64 * 1024 * 1024), 1024);
+
+    // Limits
+    score += properties.limits.maxComputeWorkGroupInvocations / 64;
+    if (properties.limits.timestampComputeAndGraphics && properties.limits.timestampPeriod > 0.0f) {
+        score += 100;
+        // Finer than 1ns per tick is as good as it gets
+        if (properties.limits.timestampPeriod <= 1.0f)
+            score += 50;
+    }
+    if (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT)
+        score += subgroupProperties.subgroupSize * 2;
+
+    // Queue families, dedicated compute and transfer families let work overlap with graphics
+    QueueFamilyIndices indices = findQueueFamilies(device);
+    if (indices.hasDedicatedCompute())
+        score += 200;
+    if (indices.hasDedicatedTransfer())
+        score += 200;
+    if (indices.sparsebindingFamily.has_value())
+        score += 50;
+
+    return typeScore + extensionScore + std::min(score, EXTENSION_SCORE - 1);
+}
+
+// Enumerated once per device, both the suitability check and the scoring look extensions up
+const std::unordered_set<std::string>& PhysicalDeviceBuilder::getPhysicalDeviceExtensions(VkPhysicalDevice device) {
+    auto cached = deviceExtensions.find(device);
+    if (cached != deviceExtensions.end())
+        return cached->second;
+
     uint32_t extensionCount;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
     std::vector<VkExtensionProperties> extensions(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
-    return extensions;
+
+    std::unordered_set<std::string> &names = deviceExtensions[device];
+    for (const auto &extension: extensions) {
+        names.insert(extension.extensionName);
+    }
+    return names;
+}
+
+// Prefers families that only do one thing: a compute family without graphics and a transfer family without graphics or
+// compute map to separate hardware queues on most desktop GPUs. Falls back to sharing the graphics family otherwise.
+QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
+    QueueFamilyIndices indices;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+    std::optional<uint32_t> anyCompute;
+    std::optional<uint32_t> anyTransfer;
+    std::optional<uint32_t> anySparse;
+    for (uint32_t i = 0; i < queueFamilyCount; i++) {
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if (queueFamilies[i].queueCount == 0)
+            continue;
+
+        bool graphics = flags & VK_QUEUE_GRAPHICS_BIT;
+        bool compute = flags & VK_QUEUE_COMPUTE_BIT;
+        // Graphics and compute families support transfers even when they don't advertise the bit
+        bool transfer = (flags & VK_QUEUE_TRANSFER_BIT) || graphics || compute;
+
+        if (graphics && !indices.graphicsFamily.has_value())
+            indices.graphicsFamily = i;
+
+        if (compute && !graphics && !indices.computeFamily.has_value())
+            indices.computeFamily = i;
+        if (compute && !anyCompute.has_value())
+            anyCompute = i;
+
+        if (transfer && !graphics && !compute && !indices.transferFamily.has_value())
+            indices.transferFamily = i;
+        if (transfer && !graphics && !anyTransfer.has_value())
+            anyTransfer = i;
+
+        if (flags & VK_QUEUE_SPARSE_BINDING_BIT) {
+            if (!graphics && !indices.sparsebindingFamily.has_value())
+                indices.sparsebindingFamily = i;
+            if (!anySparse.has_value())
+                anySparse = i;
+        }
+    }
+
+    // No dedicated family, share one that can do the job. The graphics family is preferred as fallback for compute
+    // because the spec guarantees a graphics family supporting compute if any graphics family exists.
+    if (!indices.computeFamily.has_value()) {
+        if (indices.graphicsFamily.has_value() && (queueFamilies[indices.graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT))
+            indices.computeFamily = indices.graphicsFamily;
+        else
+            indices.computeFamily = anyCompute;
+    }
+    if (!indices.transferFamily.has_value()) {
+        if (anyTransfer.has_value())
+            indices.transferFamily = anyTransfer;
+        else if (indices.computeFamily.has_value())
+            indices.transferFamily = indices.computeFamily;
+        else
+            indices.transferFamily = indices.graphicsFamily;
+    }
+    if (!indices.sparsebindingFamily.has_value())
+        indices.sparsebindingFamily = anySparse;
+
+    return indices;
 }
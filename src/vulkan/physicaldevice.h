@@ -1,9 +1,55 @@
 #pragma once
 
-#include <vulkan/vulkan.h>
+#include "vulkanloader.h"
 #include <optional>
 #include <iostream>
 #include <vector>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+struct QueueFamilyIndices {
+    std::optional<uint32_t> graphicsFamily;
+    std::optional<uint32_t> computeFamily;
+    std::optional<uint32_t> transferFamily;
+    std::optional<uint32_t> sparsebindingFamily;
+
+    // Sparse binding is optional, VirtualTexture falls back to a software page table without it
+    bool isComplete() {
+        return graphicsFamily.has_value() && computeFamily.has_value() && transferFamily.has_value();
+    }
+
+    // Compute family that does not share its queues with graphics, so async compute can overlap rendering
+    bool hasDedicatedCompute() {
+        return computeFamily.has_value() && computeFamily != graphicsFamily;
+    }
+
+    // Transfer family that is neither the graphics nor the compute one, usually backed by a DMA engine
+    bool hasDedicatedTransfer() {
+        return transferFamily.has_value() && transferFamily != graphicsFamily && transferFamily != computeFamily;
+    }
+
+    // Each family only needs one VkDeviceQueueCreateInfo, even when several roles map to it
+    std::set<uint32_t> uniqueFamilies() {
+        std::set<uint32_t> families;
+        for (auto family: {graphicsFamily, computeFamily, transferFamily, sparsebindingFamily}) {
+            if (family.has_value())
+                families.insert(family.value());
+        }
+        return families;
+    }
+};
+
+QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
+
+// Linked GPUs that can back one VkDevice, a single device when there is nothing to link it with.
+// Device masks and device indices count in the order of devices.
+struct PhysicalDeviceGroup {
+    std::vector<VkPhysicalDevice> devices;
+    // Memory can be allocated on a subset of the devices, otherwise every allocation is on all of them
+    bool subsetAllocation = false;
+};
 
 class PhysicalDeviceBuilder {
     private:
@@ -13,33 +59,28 @@ class PhysicalDeviceBuilder {
     // VkPhysicalDeviceFeatures requiredFeatures;
     // VkPhysicalDeviceFeatures preferredFeatures;
     std::vector<const char*> requiredExtensions;
-    std::vector<const char*> preferredExtensions; // Not yet supported
+    std::vector<const char*> preferredExtensions;
     bool require_discrete = false;
     bool prefer_discrete = false;
+    VkSurfaceKHR presentSurface = VK_NULL_HANDLE;
+    std::unordered_map<VkPhysicalDevice, std::unordered_set<std::string>> deviceExtensions;
 
     public:
     VkPhysicalDevice Build();
+    PhysicalDeviceGroup BuildGroup();
     PhysicalDeviceBuilder& RequireExtension(const char *extension);
-    PhysicalDeviceBuilder& PreferExtension(const char *extension); // Not yet supported
+    PhysicalDeviceBuilder& PreferExtension(const char *extension);
     PhysicalDeviceBuilder& RequireExtensions(std::vector<const char*> extensions);
-    PhysicalDeviceBuilder& PreferExtensions(std::vector<const char*> extensions); // Not yet supported
+    PhysicalDeviceBuilder& PreferExtensions(std::vector<const char*> extensions);
     PhysicalDeviceBuilder& RequireDiscrete();
-    PhysicalDeviceBuilder& PreferDiscrete(); // Not yet supported
+    PhysicalDeviceBuilder& PreferDiscrete();
+    PhysicalDeviceBuilder& RequirePresent(VkSurfaceKHR surface);
     PhysicalDeviceBuilder(VkInstance instance);
 
     private:
     bool isDeviceSuitable(VkPhysicalDevice device);
-    std::vector<VkExtensionProperties> getPhysicalDeviceExtensions(VkPhysicalDevice device);
+    bool canPresent(VkPhysicalDevice device);
+    uint64_t rateDevice(VkPhysicalDevice device);
+    const std::unordered_set<std::string>& getPhysicalDeviceExtensions(VkPhysicalDevice device);
 };
 
-
-struct QueueFamilyIndices {
-    std::optional<uint32_t> graphicsFamily;
-    std::optional<uint32_t> computeFamily;
-    std::optional<uint32_t> transferFamily;
-    std::optional<uint32_t> sparsebindingFamily;
-
-    bool isComplete() {
-        return graphicsFamily.has_value() && computeFamily.has_value() && transferFamily.has_value(); // && sparsebindingFamily.has_value();
-    }
-};
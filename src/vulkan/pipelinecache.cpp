@@ -0,0 +1,183 @@
+#include "pipelinecache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+static const uint32_t PIPELINE_CACHE_MAGIC = 0x50435654; // "TVCP"
+static const uint32_t PIPELINE_CACHE_FILE_VERSION = 1;
+
+PipelineCache::PipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, std::string path) {
+    this->device = device;
+    this->path = path;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    std::vector<uint8_t> data = load();
+    try {
+        cache = createCache(data);
+    } catch (std::runtime_error&) {
+        if (data.empty())
+            throw;
+        std::cout << "Driver rejected pipeline cache, starting empty" << std::endl;
+        cache = createCache({});
+    }
+}
+
+PipelineCache::~PipelineCache() {
+    for (auto &threadCache: threadCaches) {
+        vkDestroyPipelineCache(device, threadCache.second, nullptr);
+    }
+    vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+VkPipelineCache PipelineCache::Get() {
+    return cache;
+}
+
+VkPipelineCache PipelineCache::ThreadCache() {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = threadCaches.find(std::this_thread::get_id());
+    if (found != threadCaches.end())
+        return found->second;
+
+    VkPipelineCache threadCache = createCache({});
+    threadCaches[std::this_thread::get_id()] = threadCache;
+    return threadCache;
+}
+
+// Writes to a temporary file and renames it over the old one, so a crash mid write never leaves a truncated cache behind
+void PipelineCache::Save() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!threadCaches.empty()) {
+        std::vector<VkPipelineCache> sources;
+        for (auto &threadCache: threadCaches) {
+            sources.push_back(threadCache.second);
+        }
+        VkResult result = vkMergePipelineCaches(device, cache, static_cast<uint32_t>(sources.size()), sources.data());
+        if (result != VK_SUCCESS) {
+            std::cout << "Could not merge pipeline caches: " << result << std::endl;
+        }
+    }
+
+    size_t dataSize = 0;
+    vkGetPipelineCacheData(device, cache, &dataSize, nullptr);
+    std::vector<uint8_t> data(dataSize);
+    VkResult result = vkGetPipelineCacheData(device, cache, &dataSize, data.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "Could not read pipeline cache data: " << result << std::endl;
+        return;
+    }
+    data.resize(dataSize);
+
+    FileHeader header{};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.version = PIPELINE_CACHE_FILE_VERSION;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.checksum = checksum(data.data(), data.size());
+
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file) {
+            std::cout << "Could not write pipeline cache to " << tmpPath << std::endl;
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error) {
+        std::cout << "Could not replace pipeline cache " << path << ": " << error.message() << std::endl;
+        std::filesystem::remove(tmpPath, error);
+        return;
+    }
+    std::cout << "Pipeline cache saved: " << data.size() << " bytes" << std::endl;
+}
+
+// Returns the driver blob, or nothing if there is no usable cache on disk. A bad cache is never an error, it just
+// means a cold start.
+std::vector<uint8_t> PipelineCache::load() {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cout << "No pipeline cache found at " << path << std::endl;
+        return {};
+    }
+    std::streamoff fileSize = file.tellg();
+    file.seekg(0);
+
+    FileHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != PIPELINE_CACHE_MAGIC || header.version != PIPELINE_CACHE_FILE_VERSION) {
+        std::cout << "Ignoring pipeline cache: unknown format" << std::endl;
+        return {};
+    }
+
+    // The size is read from the file too, only trust it once it agrees with what is actually there
+    if (fileSize < static_cast<std::streamoff>(sizeof(header)) || header.dataSize != static_cast<uint64_t>(fileSize) - sizeof(header)) {
+        std::cout << "Ignoring pipeline cache: truncated or corrupt" << std::endl;
+        return {};
+    }
+    std::vector<uint8_t> data(header.dataSize);
+    file.read(reinterpret_cast<char*>(data.data()), data.size());
+    if (!file || header.checksum != checksum(data.data(), data.size())) {
+        std::cout << "Ignoring pipeline cache: truncated or corrupt" << std::endl;
+        return {};
+    }
+
+    if (!isCompatible(header, data)) {
+        std::cout << "Ignoring pipeline cache: written by a different device or driver" << std::endl;
+        return {};
+    }
+
+    std::cout << "Pipeline cache loaded: " << data.size() << " bytes" << std::endl;
+    return data;
+}
+
+bool PipelineCache::isCompatible(const FileHeader &header, const std::vector<uint8_t> &data) {
+    if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID || header.driverVersion != properties.driverVersion)
+        return false;
+    if (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        return false;
+
+    // The driver blob starts with its own header, check it agrees with ours
+    VkPipelineCacheHeaderVersionOne driverHeader{};
+    if (data.size() < sizeof(driverHeader))
+        return false;
+    memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+    return driverHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        driverHeader.vendorID == properties.vendorID &&
+        driverHeader.deviceID == properties.deviceID &&
+        memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+VkPipelineCache PipelineCache::createCache(const std::vector<uint8_t> &initialData) {
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = initialData.size();
+    createInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+    VkPipelineCache pipelineCache;
+    VkResult result = vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("error creating pipeline cache");
+    }
+    return pipelineCache;
+}
+
+// FNV-1a, only used to detect truncated or damaged files
+uint64_t PipelineCache::checksum(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// VkPipelineCache persisted to disk between runs. The blob is only reused when it was written by the same device and
+// driver, drivers are allowed to reject or even crash on blobs from another version.
+// Threads compiling pipelines should use ThreadCache(), which avoids contention on a single cache; all of them are
+// merged into the main cache on Save().
+class PipelineCache {
+    private:
+    // Prepended to the driver blob, VkPipelineCacheHeaderVersionOne has no driver version and no integrity check
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t checksum;
+    };
+
+    VkDevice device;
+    VkPhysicalDeviceProperties properties;
+    std::string path;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    std::mutex mutex;
+    std::unordered_map<std::thread::id, VkPipelineCache> threadCaches;
+
+    public:
+    PipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, std::string path);
+    ~PipelineCache();
+
+    VkPipelineCache Get();
+    VkPipelineCache ThreadCache();
+    void Save();
+
+    private:
+    std::vector<uint8_t> load();
+    bool isCompatible(const FileHeader &header, const std::vector<uint8_t> &data);
+    VkPipelineCache createCache(const std::vector<uint8_t> &initialData);
+    static uint64_t checksum(const uint8_t *data, size_t size);
+};
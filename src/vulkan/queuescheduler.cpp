@@ -0,0 +1,272 @@
+#include "queuescheduler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static VkSemaphore createTimeline(VkDevice device) {
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+    VkSemaphore semaphore;
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+        throw std::runtime_error("error creating scheduler timeline semaphore");
+    }
+    return semaphore;
+}
+
+QueueScheduler::QueueScheduler(const LogicalDevice &device) : device(device) {
+    if (!device.features.timelineSemaphore) {
+        throw std::runtime_error("queue scheduler needs timeline semaphores");
+    }
+    roleLanes[static_cast<int>(QueueRole::Graphics)] = laneFor(device.graphicsQueue);
+    roleLanes[static_cast<int>(QueueRole::Compute)] = laneFor(device.computeQueue);
+    roleLanes[static_cast<int>(QueueRole::Transfer)] = laneFor(device.transferQueue);
+    // The host never shares a lane, laneFor() would match it with any other null queue
+    Lane host;
+    host.timeline = createTimeline(device.device);
+    lanes.push_back(host);
+    roleLanes[static_cast<int>(QueueRole::Host)] = static_cast<uint32_t>(lanes.size() - 1);
+}
+
+// Releases GPU jobs still waiting on host jobs that were never completed, they would never finish otherwise. With
+// a lost device neither works, the semaphores go anyway rather than throwing out of a destructor.
+QueueScheduler::~QueueScheduler() {
+    try {
+        Lane &host = lanes[roleLanes[static_cast<int>(QueueRole::Host)]];
+        if (host.nextValue > host.completed)
+            CompleteHostJob({roleLanes[static_cast<int>(QueueRole::Host)], host.nextValue});
+        WaitIdle();
+    } catch (std::runtime_error &e) {
+        std::cout << "Queue scheduler not idle when destroyed: " << e.what() << std::endl;
+    }
+    for (Lane &lane: lanes) {
+        vkDestroySemaphore(device.device, lane.timeline, nullptr);
+    }
+}
+
+JobHandle QueueScheduler::Add(const QueueJob &job) {
+    if (job.queue == QueueRole::Host) {
+        throw std::runtime_error("host jobs go through AddHostJob");
+    }
+    uint32_t laneIndex = roleLanes[static_cast<int>(job.queue)];
+    Lane &lane = lanes[laneIndex];
+
+    // One wait per lane, for the latest value any dependency needs on it
+    std::vector<uint64_t> waitValues(lanes.size(), 0);
+    std::vector<VkPipelineStageFlags> waitStages(lanes.size(), 0);
+    for (const JobDependency &dependency: job.dependencies) {
+        const JobHandle &handle = dependency.job;
+        if (handle.lane >= lanes.size() || handle.value == 0 || handle.value > lanes[handle.lane].nextValue) {
+            throw std::runtime_error("job depends on a job that wasn't added before it");
+        }
+        if (handle.value <= lanes[handle.lane].completed)
+            continue;
+        waitValues[handle.lane] = std::max(waitValues[handle.lane], handle.value);
+        waitStages[handle.lane] |= dependency.stage;
+    }
+
+    Pending submission;
+    submission.lane = laneIndex;
+    submission.value = ++lane.nextValue;
+    submission.job = job;
+    for (uint32_t i = 0; i < lanes.size(); i++) {
+        if (waitValues[i] == 0)
+            continue;
+        submission.waitSemaphores.push_back(lanes[i].timeline);
+        submission.waitValues.push_back(waitValues[i]);
+        submission.waitStages.push_back(waitStages[i]);
+    }
+    for (const ExternalWait &wait: job.waits) {
+        submission.waitSemaphores.push_back(wait.semaphore);
+        submission.waitValues.push_back(wait.value);
+        submission.waitStages.push_back(wait.stage);
+    }
+    // Binary semaphores take a value too, it's ignored
+    submission.signalSemaphores.push_back(lane.timeline);
+    submission.signalValues.push_back(submission.value);
+    for (VkSemaphore signal: job.signals) {
+        submission.signalSemaphores.push_back(signal);
+        submission.signalValues.push_back(0);
+    }
+    pending.push_back(std::move(submission));
+    return {laneIndex, pending.back().value};
+}
+
+JobHandle QueueScheduler::AddHostJob() {
+    uint32_t laneIndex = roleLanes[static_cast<int>(QueueRole::Host)];
+    Lane &host = lanes[laneIndex];
+    host.submitted = ++host.nextValue;
+    return {laneIndex, host.submitted};
+}
+
+void QueueScheduler::CompleteHostJob(JobHandle job) {
+    if (job.lane != roleLanes[static_cast<int>(QueueRole::Host)]) {
+        throw std::runtime_error("not a host job");
+    }
+    Lane &host = lanes[job.lane];
+    if (job.value == 0 || job.value > host.nextValue) {
+        throw std::runtime_error("host job wasn't added");
+    }
+    if (job.value <= host.completed)
+        return;
+
+    VkSemaphoreSignalInfo signalInfo{};
+    signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO;
+    signalInfo.semaphore = host.timeline;
+    signalInfo.value = job.value;
+    if (device.signalSemaphore(device.device, &signalInfo) != VK_SUCCESS) {
+        throw std::runtime_error("error signalling host job");
+    }
+    host.completed = job.value;
+}
+
+// Jobs go out per queue in the order they were added. The queues themselves can be submitted in any order, timeline
+// waits are allowed to come before the signal they wait for.
+// A job only counts as submitted once its vkQueueSubmit succeeded. When one fails the jobs it and later batches held
+// stay pending, so nothing waits on a timeline value that will never be signalled.
+void QueueScheduler::Flush() {
+    std::vector<bool> flushed(pending.size(), false);
+    auto dropFlushed = [&]() {
+        std::vector<Pending> left;
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (!flushed[i])
+                left.push_back(std::move(pending[i]));
+        }
+        pending = std::move(left);
+    };
+
+    for (uint32_t laneIndex = 0; laneIndex < lanes.size(); laneIndex++) {
+        Lane &lane = lanes[laneIndex];
+        std::vector<VkSubmitInfo> batch;
+        std::vector<size_t> batchJobs;
+        auto submit = [&](VkFence fence) {
+            if (vkQueueSubmit(lane.queue, static_cast<uint32_t>(batch.size()), batch.data(), fence) != VK_SUCCESS) {
+                dropFlushed();
+                throw std::runtime_error("error submitting scheduled jobs");
+            }
+            for (size_t job: batchJobs) {
+                flushed[job] = true;
+            }
+            lane.submitted = pending[batchJobs.back()].value;
+            batch.clear();
+            batchJobs.clear();
+        };
+
+        for (size_t i = 0; i < pending.size(); i++) {
+            Pending &submission = pending[i];
+            if (submission.lane != laneIndex)
+                continue;
+
+            submission.timelineInfo = {};
+            submission.timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            submission.timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(submission.waitValues.size());
+            submission.timelineInfo.pWaitSemaphoreValues = submission.waitValues.data();
+            submission.timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(submission.signalValues.size());
+            submission.timelineInfo.pSignalSemaphoreValues = submission.signalValues.data();
+
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.pNext = &submission.timelineInfo;
+            submitInfo.waitSemaphoreCount = static_cast<uint32_t>(submission.waitSemaphores.size());
+            submitInfo.pWaitSemaphores = submission.waitSemaphores.data();
+            submitInfo.pWaitDstStageMask = submission.waitStages.data();
+            submitInfo.commandBufferCount = static_cast<uint32_t>(submission.job.commandBuffers.size());
+            submitInfo.pCommandBuffers = submission.job.commandBuffers.data();
+            submitInfo.signalSemaphoreCount = static_cast<uint32_t>(submission.signalSemaphores.size());
+            submitInfo.pSignalSemaphores = submission.signalSemaphores.data();
+            batch.push_back(submitInfo);
+            batchJobs.push_back(i);
+
+            // A fence covers its whole vkQueueSubmit, so the batch ends at a job that has one
+            if (submission.job.fence != VK_NULL_HANDLE)
+                submit(submission.job.fence);
+        }
+        if (!batch.empty())
+            submit(VK_NULL_HANDLE);
+    }
+    pending.clear();
+}
+
+bool QueueScheduler::IsComplete(JobHandle job) {
+    Lane &lane = lanes[job.lane];
+    if (job.value <= lane.completed)
+        return true;
+    uint64_t value;
+    if (device.getSemaphoreCounterValue(device.device, lane.timeline, &value) != VK_SUCCESS) {
+        throw std::runtime_error("error reading scheduler timeline");
+    }
+    lane.completed = std::max(lane.completed, value);
+    return job.value <= lane.completed;
+}
+
+void QueueScheduler::Wait(JobHandle job) {
+    Wait(std::vector<JobHandle>{job});
+}
+
+// Waiting for jobs that haven't been flushed yet would never return, so they're flushed first
+void QueueScheduler::Wait(const std::vector<JobHandle> &jobs) {
+    std::vector<VkSemaphore> semaphores;
+    std::vector<uint64_t> values;
+    bool flush = false;
+    for (const JobHandle &job: jobs) {
+        if (IsComplete(job))
+            continue;
+        flush = flush || job.value > lanes[job.lane].submitted;
+        semaphores.push_back(lanes[job.lane].timeline);
+        values.push_back(job.value);
+    }
+    if (semaphores.empty())
+        return;
+    if (flush)
+        Flush();
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = static_cast<uint32_t>(semaphores.size());
+    waitInfo.pSemaphores = semaphores.data();
+    waitInfo.pValues = values.data();
+    // Without a timeout anything but success is a lost device, nothing can be marked complete then
+    if (device.waitSemaphores(device.device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("error waiting for scheduled jobs");
+    }
+    for (const JobHandle &job: jobs) {
+        lanes[job.lane].completed = std::max(lanes[job.lane].completed, job.value);
+    }
+}
+
+// Host jobs aren't waited for, only the GPU work
+void QueueScheduler::WaitIdle() {
+    Flush();
+    std::vector<JobHandle> last;
+    for (uint32_t i = 0; i < lanes.size(); i++) {
+        if (lanes[i].queue != VK_NULL_HANDLE && lanes[i].submitted > 0)
+            last.push_back({i, lanes[i].submitted});
+    }
+    Wait(last);
+}
+
+VkSemaphore QueueScheduler::Timeline(JobHandle job) {
+    return lanes[job.lane].timeline;
+}
+
+uint32_t QueueScheduler::LaneCount() {
+    return static_cast<uint32_t>(lanes.size());
+}
+
+// Roles that got the same VkQueue from LogicalDeviceBuilder share its lane
+uint32_t QueueScheduler::laneFor(VkQueue queue) {
+    for (uint32_t i = 0; i < lanes.size(); i++) {
+        if (lanes[i].queue == queue)
+            return i;
+    }
+    Lane lane;
+    lane.queue = queue;
+    lane.timeline = createTimeline(device.device);
+    lanes.push_back(lane);
+    return static_cast<uint32_t>(lanes.size() - 1);
+}
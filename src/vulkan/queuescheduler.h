@@ -0,0 +1,101 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <vector>
+#include "logicaldevice.h"
+
+enum class QueueRole {
+    Graphics,
+    Compute,
+    Transfer,
+    Host,   // CPU work, completed with CompleteHostJob()
+};
+
+// A submitted job: done once the timeline of its lane reaches value. Lanes are the distinct VkQueues plus the host.
+struct JobHandle {
+    uint32_t lane = 0;
+    uint64_t value = 0;
+};
+
+struct JobDependency {
+    JobHandle job;
+    // Stages of this job that have to wait for it
+    VkPipelineStageFlags stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+};
+
+// Semaphores that aren't the scheduler's: swapchain acquire (binary, value ignored), StagingRing::Timeline()...
+struct ExternalWait {
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    uint64_t value = 0;
+    VkPipelineStageFlags stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+};
+
+struct QueueJob {
+    QueueRole queue = QueueRole::Graphics;
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<JobDependency> dependencies;
+    std::vector<ExternalWait> waits;
+    // Binary, for present
+    std::vector<VkSemaphore> signals;
+    VkFence fence = VK_NULL_HANDLE;
+};
+
+// Work on the graphics, compute and transfer queues and on the CPU as a DAG. Every lane has one timeline semaphore
+// and every job on it the next value, so a dependency is a wait for one value on one semaphore whichever queues
+// are involved, several dependencies on the same lane fold into the latest, and the CPU waits on the same values.
+// Roles that map to the same VkQueue share a lane, which keeps their jobs in the order they were added.
+//
+// Add() only queues the job, Flush() submits everything queued with one vkQueueSubmit per queue. Dependencies must
+// be added before the jobs that use them, which is what keeps it acyclic. Queue family ownership transfers are still
+// up to the command buffers. Not thread safe.
+class QueueScheduler {
+    private:
+    struct Lane {
+        VkQueue queue = VK_NULL_HANDLE;
+        VkSemaphore timeline = VK_NULL_HANDLE;
+        uint64_t nextValue = 0;
+        uint64_t submitted = 0;
+        // Last value seen on the GPU, waits for anything up to it are dropped
+        uint64_t completed = 0;
+    };
+
+    // Lives until Flush() so the pointers in VkSubmitInfo stay valid
+    struct Pending {
+        uint32_t lane;
+        uint64_t value;
+        QueueJob job;
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<uint64_t> waitValues;
+        std::vector<VkPipelineStageFlags> waitStages;
+        std::vector<VkSemaphore> signalSemaphores;
+        std::vector<uint64_t> signalValues;
+        VkTimelineSemaphoreSubmitInfo timelineInfo;
+    };
+
+    const LogicalDevice &device;
+    std::vector<Lane> lanes;
+    uint32_t roleLanes[4];
+    std::vector<Pending> pending;
+
+    public:
+    QueueScheduler(const LogicalDevice &device);
+    ~QueueScheduler();
+
+    JobHandle Add(const QueueJob &job);
+    // Starts a CPU job, it can wait on GPU jobs with Wait() and GPU jobs can depend on it. Host jobs complete in the
+    // order they were added, completing one completes all the earlier ones. Completing one that wasn't added throws.
+    JobHandle AddHostJob();
+    void CompleteHostJob(JobHandle job);
+    void Flush();
+
+    bool IsComplete(JobHandle job);
+    void Wait(JobHandle job);
+    void Wait(const std::vector<JobHandle> &jobs);
+    void WaitIdle();
+
+    VkSemaphore Timeline(JobHandle job);
+    uint32_t LaneCount();
+
+    private:
+    uint32_t laneFor(VkQueue queue);
+};
@@ -0,0 +1,653 @@
+#include "rendergraph.h"
+
+#include <algorithm>
+#include "profiler/cpuprofiler.h"
+
+ResourceUsage ResourceUsage::ColorAttachment() {
+    ResourceUsage usage;
+    usage.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    usage.access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    usage.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    usage.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    usage.write = true;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::DepthAttachment() {
+    ResourceUsage usage;
+    usage.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    usage.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    usage.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    usage.imageUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    usage.write = true;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::Sampled(VkPipelineStageFlags2 stages) {
+    ResourceUsage usage;
+    usage.stages = stages;
+    usage.access = VK_ACCESS_SHADER_READ_BIT;
+    usage.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    usage.imageUsage = VK_IMAGE_USAGE_SAMPLED_BIT;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::StorageRead(VkPipelineStageFlags2 stages) {
+    ResourceUsage usage;
+    usage.stages = stages;
+    usage.access = VK_ACCESS_SHADER_READ_BIT;
+    usage.layout = VK_IMAGE_LAYOUT_GENERAL;
+    usage.imageUsage = VK_IMAGE_USAGE_STORAGE_BIT;
+    usage.bufferUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::StorageWrite(VkPipelineStageFlags2 stages) {
+    ResourceUsage usage = StorageRead(stages);
+    usage.access |= VK_ACCESS_SHADER_WRITE_BIT;
+    usage.write = true;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::UniformRead(VkPipelineStageFlags2 stages) {
+    ResourceUsage usage;
+    usage.stages = stages;
+    usage.access = VK_ACCESS_UNIFORM_READ_BIT;
+    usage.bufferUsage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::VertexRead() {
+    ResourceUsage usage;
+    usage.stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    usage.access = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    usage.bufferUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::IndexRead() {
+    ResourceUsage usage;
+    usage.stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    usage.access = VK_ACCESS_INDEX_READ_BIT;
+    usage.bufferUsage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::IndirectRead() {
+    ResourceUsage usage;
+    usage.stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+    usage.access = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    usage.bufferUsage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::TransferRead() {
+    ResourceUsage usage;
+    usage.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    usage.access = VK_ACCESS_TRANSFER_READ_BIT;
+    usage.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    usage.imageUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    usage.bufferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    return usage;
+}
+
+ResourceUsage ResourceUsage::TransferWrite() {
+    ResourceUsage usage;
+    usage.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    usage.access = VK_ACCESS_TRANSFER_WRITE_BIT;
+    usage.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    usage.imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    usage.bufferUsage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    usage.write = true;
+    return usage;
+}
+
+PassBuilder::PassBuilder(RenderGraph &graph, uint32_t pass) : graph(graph) {
+    this->pass = pass;
+}
+
+PassBuilder& PassBuilder::Read(ResourceHandle resource, ResourceUsage usage) {
+    usage.write = false;
+    return use(resource, usage);
+}
+
+PassBuilder& PassBuilder::Write(ResourceHandle resource, ResourceUsage usage) {
+    usage.write = true;
+    return use(resource, usage);
+}
+
+PassBuilder& PassBuilder::SideEffect() {
+    graph.passes[pass].sideEffect = true;
+    return *this;
+}
+
+PassBuilder& PassBuilder::Execute(PassFunction execute) {
+    graph.passes[pass].execute = execute;
+    return *this;
+}
+
+// A pass touching the same resource twice gets one merged access, a resource can only be in one layout per pass
+PassBuilder& PassBuilder::use(ResourceHandle resource, ResourceUsage usage) {
+    if (resource >= graph.resources.size()) {
+        throw std::runtime_error("render graph pass uses an unknown resource");
+    }
+
+    RenderGraph::Pass &target = graph.passes[pass];
+    for (RenderGraph::Access &access: target.accesses) {
+        if (access.resource != resource)
+            continue;
+        if (graph.resources[resource].image && access.usage.layout != usage.layout) {
+            throw std::runtime_error("render graph pass " + target.name + " uses " + graph.resources[resource].name + " in two layouts");
+        }
+        access.usage.stages |= usage.stages;
+        access.usage.access |= usage.access;
+        access.usage.imageUsage |= usage.imageUsage;
+        access.usage.bufferUsage |= usage.bufferUsage;
+        access.usage.write = access.usage.write || usage.write;
+        return *this;
+    }
+    target.accesses.push_back({resource, usage});
+    graph.compiled = false;
+    return *this;
+}
+
+RenderGraph::RenderGraph(const LogicalDevice &device, MemoryAllocator &allocator) : device(device), allocator(allocator) {
+}
+
+RenderGraph::~RenderGraph() {
+    releaseTransients();
+}
+
+ResourceHandle RenderGraph::CreateImage(const std::string &name, const GraphImageDesc &desc) {
+    Resource resource;
+    resource.name = name;
+    resource.image = true;
+    resource.imageDesc = desc;
+    resources.push_back(resource);
+    compiled = false;
+    return static_cast<ResourceHandle>(resources.size() - 1);
+}
+
+ResourceHandle RenderGraph::CreateBuffer(const std::string &name, const GraphBufferDesc &desc) {
+    Resource resource;
+    resource.name = name;
+    resource.image = false;
+    resource.bufferDesc = desc;
+    resources.push_back(resource);
+    compiled = false;
+    return static_cast<ResourceHandle>(resources.size() - 1);
+}
+
+ResourceHandle RenderGraph::ImportImage(const std::string &name, const GraphImageDesc &desc, const ImportedState &state) {
+    ResourceHandle handle = CreateImage(name, desc);
+    resources[handle].imported = true;
+    resources[handle].importedState = state;
+    return handle;
+}
+
+ResourceHandle RenderGraph::ImportBuffer(const std::string &name, const GraphBufferDesc &desc, const ImportedState &state) {
+    ResourceHandle handle = CreateBuffer(name, desc);
+    resources[handle].imported = true;
+    resources[handle].importedState = state;
+    return handle;
+}
+
+void RenderGraph::SetImportedImage(ResourceHandle resource, VkImage image, VkImageView view, VkExtent2D extent) {
+    resources[resource].vkImage = image;
+    resources[resource].vkImageView = view;
+    resources[resource].imageDesc.extent = extent;
+}
+
+void RenderGraph::SetImportedBuffer(ResourceHandle resource, VkBuffer buffer) {
+    resources[resource].vkBuffer = buffer;
+}
+
+// Keeps the passes producing a transient alive even though no pass in the graph reads it
+void RenderGraph::MarkOutput(ResourceHandle resource) {
+    resources[resource].output = true;
+    compiled = false;
+}
+
+// Every pass gets a GPU timing scope named after it
+void RenderGraph::SetProfiler(GpuProfiler *profiler) {
+    this->profiler = profiler;
+}
+
+PassBuilder RenderGraph::AddPass(const std::string &name) {
+    Pass pass;
+    pass.name = name;
+    passes.push_back(pass);
+    compiled = false;
+    return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+void RenderGraph::Compile() {
+    releaseTransients();
+    stats = RenderGraphStats();
+    stats.passCount = static_cast<uint32_t>(passes.size());
+    cull();
+    computeLifetimes();
+    allocateTransients();
+    planBarriers();
+    compiled = true;
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer) {
+    PROFILE_ZONE("RenderGraph");
+    if (!compiled) {
+        throw std::runtime_error("render graph executed without compiling");
+    }
+
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        Pass &pass = passes[i];
+        if (!pass.alive)
+            continue;
+        recordBarriers(commandBuffer, passBarriers[i]);
+        if (profiler)
+            profiler->BeginScope(commandBuffer, pass.name.c_str());
+        if (pass.execute)
+            pass.execute(commandBuffer, *this);
+        if (profiler)
+            profiler->EndScope(commandBuffer);
+    }
+    recordBarriers(commandBuffer, finalBarriers);
+}
+
+VkImage RenderGraph::Image(ResourceHandle resource) {
+    return resources[resource].vkImage;
+}
+
+VkImageView RenderGraph::ImageView(ResourceHandle resource) {
+    return resources[resource].vkImageView;
+}
+
+VkBuffer RenderGraph::Buffer(ResourceHandle resource) {
+    return resources[resource].vkBuffer;
+}
+
+const GraphImageDesc& RenderGraph::ImageDesc(ResourceHandle resource) {
+    return resources[resource].imageDesc;
+}
+
+const RenderGraphStats& RenderGraph::Stats() {
+    return stats;
+}
+
+// Walks backwards from what leaves the graph (imported resources, outputs) and keeps only the passes that write
+// something a kept pass or the outside world reads
+void RenderGraph::cull() {
+    std::vector<bool> needed(resources.size());
+    for (size_t i = 0; i < resources.size(); i++) {
+        needed[i] = resources[i].imported || resources[i].output;
+    }
+
+    for (size_t i = passes.size(); i-- > 0;) {
+        Pass &pass = passes[i];
+        pass.alive = pass.sideEffect;
+        for (const Access &access: pass.accesses) {
+            if (access.usage.write && needed[access.resource])
+                pass.alive = true;
+        }
+        if (!pass.alive) {
+            stats.culledPasses++;
+            continue;
+        }
+        for (const Access &access: pass.accesses) {
+            needed[access.resource] = true;
+        }
+    }
+}
+
+void RenderGraph::computeLifetimes() {
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        if (!passes[i].alive)
+            continue;
+        for (const Access &access: passes[i].accesses) {
+            Resource &resource = resources[access.resource];
+            resource.firstPass = std::min(resource.firstPass, i);
+            resource.lastPass = std::max(resource.lastPass, i);
+            resource.imageUsage |= access.usage.imageUsage;
+            resource.bufferUsage |= access.usage.bufferUsage;
+            resource.allStages |= access.usage.stages;
+            if (access.usage.write)
+                resource.allWrites |= access.usage.access;
+        }
+    }
+}
+
+// Creates the transients and packs them into as few allocations as possible: largest first, each one goes into the
+// first slot of its kind whose occupants are all dead by the time it's first used, or don't start until it's dead.
+// Resources in a slot are bound at the same offset, so the slot is as large as its largest occupant.
+void RenderGraph::allocateTransients() {
+    std::vector<ResourceHandle> transients;
+    for (ResourceHandle i = 0; i < resources.size(); i++) {
+        Resource &resource = resources[i];
+        if (resource.imported || resource.firstPass == UINT32_MAX)
+            continue;
+
+        if (resource.image) {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = resource.imageDesc.format;
+            imageInfo.extent = {resource.imageDesc.extent.width, resource.imageDesc.extent.height, 1};
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = resource.imageUsage;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            if (vkCreateImage(device.device, &imageInfo, nullptr, &resource.vkImage) != VK_SUCCESS) {
+                throw std::runtime_error("error creating render graph image " + resource.name);
+            }
+            vkGetImageMemoryRequirements(device.device, resource.vkImage, &resource.requirements);
+        } else {
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = resource.bufferDesc.size;
+            bufferInfo.usage = resource.bufferUsage;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            if (vkCreateBuffer(device.device, &bufferInfo, nullptr, &resource.vkBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("error creating render graph buffer " + resource.name);
+            }
+            vkGetBufferMemoryRequirements(device.device, resource.vkBuffer, &resource.requirements);
+        }
+        transients.push_back(i);
+    }
+
+    std::sort(transients.begin(), transients.end(), [this](ResourceHandle a, ResourceHandle b) {
+        return resources[a].requirements.size > resources[b].requirements.size;
+    });
+
+    std::vector<VkMemoryRequirements> slotRequirements;
+    for (ResourceHandle handle: transients) {
+        Resource &resource = resources[handle];
+        stats.unaliasedBytes += resource.requirements.size;
+
+        for (uint32_t s = 0; s < slots.size() && resource.slot == UINT32_MAX; s++) {
+            if (slots[s].image != resource.image || (slotRequirements[s].memoryTypeBits & resource.requirements.memoryTypeBits) == 0)
+                continue;
+            bool overlaps = false;
+            for (ResourceHandle occupant: slots[s].occupants) {
+                const Resource &other = resources[occupant];
+                if (resource.firstPass <= other.lastPass && other.firstPass <= resource.lastPass)
+                    overlaps = true;
+            }
+            if (overlaps)
+                continue;
+
+            resource.slot = s;
+            slots[s].occupants.push_back(handle);
+            slotRequirements[s].memoryTypeBits &= resource.requirements.memoryTypeBits;
+            slotRequirements[s].alignment = std::max(slotRequirements[s].alignment, resource.requirements.alignment);
+        }
+
+        if (resource.slot == UINT32_MAX) {
+            resource.slot = static_cast<uint32_t>(slots.size());
+            MemorySlot slot;
+            slot.image = resource.image;
+            slot.occupants.push_back(handle);
+            slots.push_back(slot);
+            slotRequirements.push_back(resource.requirements);
+        }
+    }
+
+    stats.transientCount = static_cast<uint32_t>(transients.size());
+    stats.allocationCount = static_cast<uint32_t>(slots.size());
+    for (uint32_t s = 0; s < slots.size(); s++) {
+        MemorySlot &slot = slots[s];
+        slot.allocation = allocator.Allocate(slotRequirements[s], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, !slot.image);
+        stats.aliasedBytes += slotRequirements[s].size;
+
+        std::sort(slot.occupants.begin(), slot.occupants.end(), [this](ResourceHandle a, ResourceHandle b) {
+            return resources[a].firstPass < resources[b].firstPass;
+        });
+        for (ResourceHandle occupant: slot.occupants) {
+            Resource &resource = resources[occupant];
+            if (resource.image) {
+                vkBindImageMemory(device.device, resource.vkImage, slot.allocation.memory, slot.allocation.offset);
+
+                VkImageViewCreateInfo viewInfo{};
+                viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                viewInfo.image = resource.vkImage;
+                viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+                viewInfo.format = resource.imageDesc.format;
+                viewInfo.subresourceRange.aspectMask = resource.imageDesc.aspect;
+                viewInfo.subresourceRange.levelCount = 1;
+                viewInfo.subresourceRange.layerCount = 1;
+                if (vkCreateImageView(device.device, &viewInfo, nullptr, &resource.vkImageView) != VK_SUCCESS) {
+                    throw std::runtime_error("error creating render graph image view " + resource.name);
+                }
+            } else {
+                vkBindBufferMemory(device.device, resource.vkBuffer, slot.allocation.memory, slot.allocation.offset);
+            }
+        }
+    }
+}
+
+void RenderGraph::releaseTransients() {
+    for (Resource &resource: resources) {
+        if (!resource.imported) {
+            if (resource.vkImageView != VK_NULL_HANDLE)
+                vkDestroyImageView(device.device, resource.vkImageView, nullptr);
+            if (resource.vkImage != VK_NULL_HANDLE)
+                vkDestroyImage(device.device, resource.vkImage, nullptr);
+            if (resource.vkBuffer != VK_NULL_HANDLE)
+                vkDestroyBuffer(device.device, resource.vkBuffer, nullptr);
+            resource.vkImageView = VK_NULL_HANDLE;
+            resource.vkImage = VK_NULL_HANDLE;
+            resource.vkBuffer = VK_NULL_HANDLE;
+        }
+        resource.firstPass = UINT32_MAX;
+        resource.lastPass = 0;
+        resource.slot = UINT32_MAX;
+        resource.imageUsage = 0;
+        resource.bufferUsage = 0;
+        resource.allStages = 0;
+        resource.allWrites = 0;
+    }
+    for (MemorySlot &slot: slots) {
+        allocator.Free(slot.allocation);
+    }
+    slots.clear();
+    compiled = false;
+}
+
+// Simulates every resource's state through the kept passes and records a barrier only where there is a hazard:
+// a read of something written and not yet visible to that stage, a write after anything, or a layout change.
+// Reads after reads don't wait on each other.
+void RenderGraph::planBarriers() {
+    struct State {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 writeStages = 0;
+        VkAccessFlags2 writeAccess = 0;
+        VkPipelineStageFlags2 readStages = 0;
+        VkPipelineStageFlags2 visibleStages = 0;
+        VkAccessFlags2 visibleAccess = 0;
+    };
+
+    std::vector<State> states(resources.size());
+    for (ResourceHandle i = 0; i < resources.size(); i++) {
+        Resource &resource = resources[i];
+        State &state = states[i];
+        if (resource.imported) {
+            state.layout = resource.importedState.initialLayout;
+            state.writeStages = resource.importedState.initialStages;
+            state.writeAccess = resource.importedState.initialAccess;
+        } else if (resource.slot != UINT32_MAX) {
+            // Contents are discarded, but the memory was last used by the previous occupant of the slot (or, for the
+            // first one, by the last occupant in the previous frame) and that has to finish first
+            std::vector<ResourceHandle> &occupants = slots[resource.slot].occupants;
+            size_t position = std::find(occupants.begin(), occupants.end(), i) - occupants.begin();
+            const Resource &previous = resources[occupants[(position + occupants.size() - 1) % occupants.size()]];
+            state.writeStages = previous.allStages;
+            state.writeAccess = previous.allWrites;
+        }
+    }
+
+    passBarriers.assign(passes.size(), {});
+    for (uint32_t p = 0; p < passes.size(); p++) {
+        if (!passes[p].alive)
+            continue;
+        for (const Access &access: passes[p].accesses) {
+            const Resource &resource = resources[access.resource];
+            const ResourceUsage &usage = access.usage;
+            State &state = states[access.resource];
+
+            bool layoutChange = resource.image && state.layout != usage.layout;
+            bool needed;
+            if (usage.write)
+                needed = layoutChange || state.writeStages != 0 || state.readStages != 0;
+            else
+                needed = layoutChange || (state.writeStages != 0 && ((usage.stages & ~state.visibleStages) != 0 || (usage.access & ~state.visibleAccess) != 0));
+
+            if (needed) {
+                Barrier barrier;
+                barrier.resource = access.resource;
+                barrier.srcStages = state.writeStages | (usage.write || layoutChange ? state.readStages : 0);
+                barrier.srcAccess = state.writeAccess;
+                barrier.dstStages = usage.stages;
+                barrier.dstAccess = usage.access;
+                barrier.oldLayout = state.layout;
+                barrier.newLayout = resource.image ? usage.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+                passBarriers[p].push_back(barrier);
+            }
+
+            if (usage.write) {
+                state.writeStages = usage.stages;
+                state.writeAccess = usage.access;
+                state.readStages = 0;
+                state.visibleStages = 0;
+                state.visibleAccess = 0;
+            } else {
+                if (layoutChange) {
+                    // The transition is a write of its own, later readers in other stages have to wait for it
+                    state.writeStages = usage.stages;
+                    state.writeAccess = 0;
+                    state.readStages = 0;
+                    state.visibleStages = usage.stages;
+                    state.visibleAccess = usage.access;
+                } else if (needed) {
+                    state.visibleStages |= usage.stages;
+                    state.visibleAccess |= usage.access;
+                }
+                state.readStages |= usage.stages;
+            }
+            if (resource.image)
+                state.layout = usage.layout;
+        }
+    }
+
+    finalBarriers.clear();
+    for (ResourceHandle i = 0; i < resources.size(); i++) {
+        const Resource &resource = resources[i];
+        const State &state = states[i];
+        if (!resource.imported)
+            continue;
+        const ImportedState &imported = resource.importedState;
+        bool layoutChange = resource.image && imported.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED && imported.finalLayout != state.layout;
+        if (!layoutChange && (imported.finalAccess == 0 || state.writeAccess == 0))
+            continue;
+
+        Barrier barrier;
+        barrier.resource = i;
+        barrier.srcStages = state.writeStages | state.readStages;
+        barrier.srcAccess = state.writeAccess;
+        barrier.dstStages = imported.finalStages;
+        barrier.dstAccess = imported.finalAccess;
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = layoutChange ? imported.finalLayout : state.layout;
+        finalBarriers.push_back(barrier);
+    }
+}
+
+// One call per batch, through vkCmdPipelineBarrier2 when synchronization2 is enabled and the legacy call otherwise
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier> &barriers) {
+    if (barriers.empty())
+        return;
+
+    if (device.cmdPipelineBarrier2) {
+        std::vector<VkImageMemoryBarrier2> imageBarriers;
+        std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+        for (const Barrier &barrier: barriers) {
+            const Resource &resource = resources[barrier.resource];
+            if (resource.image) {
+                VkImageMemoryBarrier2 imageBarrier{};
+                imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+                imageBarrier.srcStageMask = barrier.srcStages;
+                imageBarrier.srcAccessMask = barrier.srcAccess;
+                imageBarrier.dstStageMask = barrier.dstStages;
+                imageBarrier.dstAccessMask = barrier.dstAccess;
+                imageBarrier.oldLayout = barrier.oldLayout;
+                imageBarrier.newLayout = barrier.newLayout;
+                imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                imageBarrier.image = resource.vkImage;
+                imageBarrier.subresourceRange = {resource.imageDesc.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
+                imageBarriers.push_back(imageBarrier);
+            } else {
+                VkBufferMemoryBarrier2 bufferBarrier{};
+                bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+                bufferBarrier.srcStageMask = barrier.srcStages;
+                bufferBarrier.srcAccessMask = barrier.srcAccess;
+                bufferBarrier.dstStageMask = barrier.dstStages;
+                bufferBarrier.dstAccessMask = barrier.dstAccess;
+                bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                bufferBarrier.buffer = resource.vkBuffer;
+                bufferBarrier.size = VK_WHOLE_SIZE;
+                bufferBarriers.push_back(bufferBarrier);
+            }
+        }
+
+        VkDependencyInfo dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+        dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+        dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+        dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        device.cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+        return;
+    }
+
+    // The legacy call has one stage mask pair for the whole batch, and no "none" stage
+    VkPipelineStageFlags srcStages = 0;
+    VkPipelineStageFlags dstStages = 0;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    for (const Barrier &barrier: barriers) {
+        const Resource &resource = resources[barrier.resource];
+        srcStages |= static_cast<VkPipelineStageFlags>(barrier.srcStages);
+        dstStages |= static_cast<VkPipelineStageFlags>(barrier.dstStages);
+        if (resource.image) {
+            VkImageMemoryBarrier imageBarrier{};
+            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarrier.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccess);
+            imageBarrier.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccess);
+            imageBarrier.oldLayout = barrier.oldLayout;
+            imageBarrier.newLayout = barrier.newLayout;
+            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.image = resource.vkImage;
+            imageBarrier.subresourceRange = {resource.imageDesc.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
+            imageBarriers.push_back(imageBarrier);
+        } else {
+            VkBufferMemoryBarrier bufferBarrier{};
+            bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            bufferBarrier.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccess);
+            bufferBarrier.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccess);
+            bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.buffer = resource.vkBuffer;
+            bufferBarrier.size = VK_WHOLE_SIZE;
+            bufferBarriers.push_back(bufferBarrier);
+        }
+    }
+    if (srcStages == 0)
+        srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    if (dstStages == 0)
+        dstStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr,
+        static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <functional>
+#include <string>
+#include <vector>
+#include "logicaldevice.h"
+#include "memoryallocator.h"
+#include "gpuprofiler.h"
+
+using ResourceHandle = uint32_t;
+
+// How a pass touches a resource. Stage and access bits are the ones shared by the legacy and synchronization2 enums,
+// so the same values work for both barrier paths.
+struct ResourceUsage {
+    VkPipelineStageFlags2 stages = 0;
+    VkAccessFlags2 access = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageUsageFlags imageUsage = 0;
+    VkBufferUsageFlags bufferUsage = 0;
+    bool write = false;
+
+    static ResourceUsage ColorAttachment();
+    static ResourceUsage DepthAttachment();
+    static ResourceUsage Sampled(VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    static ResourceUsage StorageRead(VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    static ResourceUsage StorageWrite(VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    static ResourceUsage UniformRead(VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    static ResourceUsage VertexRead();
+    static ResourceUsage IndexRead();
+    static ResourceUsage IndirectRead();
+    static ResourceUsage TransferRead();
+    static ResourceUsage TransferWrite();
+};
+
+struct GraphImageDesc {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent = {0, 0};
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+};
+
+struct GraphBufferDesc {
+    VkDeviceSize size = 0;
+};
+
+// Imported resources live outside the graph. The graph takes them from initialLayout, after whatever external work
+// ran in initialStages, and leaves them in finalLayout.
+struct ImportedState {
+    VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 initialStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkAccessFlags2 initialAccess = 0;
+    VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 finalStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    VkAccessFlags2 finalAccess = 0;
+};
+
+// What the last Compile() did
+struct RenderGraphStats {
+    uint32_t passCount = 0;
+    uint32_t culledPasses = 0;
+    uint32_t transientCount = 0;
+    uint32_t allocationCount = 0;
+    VkDeviceSize aliasedBytes = 0;    // Memory the transients take
+    VkDeviceSize unaliasedBytes = 0;  // What they would take with an allocation each
+};
+
+class RenderGraph;
+using PassFunction = std::function<void(VkCommandBuffer commandBuffer, RenderGraph &graph)>;
+
+class PassBuilder {
+    private:
+    RenderGraph &graph;
+    uint32_t pass;
+
+    public:
+    PassBuilder(RenderGraph &graph, uint32_t pass);
+    PassBuilder& Read(ResourceHandle resource, ResourceUsage usage);
+    PassBuilder& Write(ResourceHandle resource, ResourceUsage usage);
+    // Never culled, for passes whose effect the graph can't see (readbacks, queries...)
+    PassBuilder& SideEffect();
+    PassBuilder& Execute(PassFunction execute);
+
+    private:
+    PassBuilder& use(ResourceHandle resource, ResourceUsage usage);
+};
+
+// Frame graph. Passes are declared once in execution order with the resources they read and write, then Compile()
+// culls passes that don't contribute to an imported resource or an output, plans the barriers and layout transitions
+// between passes, and places transient resources whose lifetimes don't overlap in the same memory.
+// Execute() only records: the precomputed barriers, then each pass. Imported handles can be swapped every frame
+// (swapchain images), anything that changes the structure or a transient's description needs another Compile().
+class RenderGraph {
+    friend class PassBuilder;
+
+    private:
+    struct Resource {
+        std::string name;
+        bool image = true;
+        bool imported = false;
+        bool output = false;
+        GraphImageDesc imageDesc;
+        GraphBufferDesc bufferDesc;
+        ImportedState importedState;
+        VkImageUsageFlags imageUsage = 0;
+        VkBufferUsageFlags bufferUsage = 0;
+
+        VkImage vkImage = VK_NULL_HANDLE;
+        VkImageView vkImageView = VK_NULL_HANDLE;
+        VkBuffer vkBuffer = VK_NULL_HANDLE;
+
+        // Compile results, for transients
+        uint32_t firstPass = UINT32_MAX;
+        uint32_t lastPass = 0;
+        uint32_t slot = UINT32_MAX;
+        VkMemoryRequirements requirements{};
+        VkPipelineStageFlags2 allStages = 0;
+        VkAccessFlags2 allWrites = 0;
+    };
+
+    struct Access {
+        ResourceHandle resource;
+        ResourceUsage usage;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<Access> accesses;
+        PassFunction execute;
+        bool sideEffect = false;
+        bool alive = false;
+    };
+
+    struct Barrier {
+        ResourceHandle resource;
+        VkPipelineStageFlags2 srcStages;
+        VkAccessFlags2 srcAccess;
+        VkPipelineStageFlags2 dstStages;
+        VkAccessFlags2 dstAccess;
+        VkImageLayout oldLayout;
+        VkImageLayout newLayout;
+    };
+
+    // Transients sharing one allocation, never alive at the same time. Occupants in order of first use.
+    struct MemorySlot {
+        Allocation allocation;
+        bool image = true;
+        std::vector<ResourceHandle> occupants;
+    };
+
+    const LogicalDevice &device;
+    MemoryAllocator &allocator;
+    GpuProfiler *profiler = nullptr;
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<MemorySlot> slots;
+    std::vector<std::vector<Barrier>> passBarriers;
+    std::vector<Barrier> finalBarriers;
+    RenderGraphStats stats;
+    bool compiled = false;
+
+    public:
+    RenderGraph(const LogicalDevice &device, MemoryAllocator &allocator);
+    ~RenderGraph();
+
+    ResourceHandle CreateImage(const std::string &name, const GraphImageDesc &desc);
+    ResourceHandle CreateBuffer(const std::string &name, const GraphBufferDesc &desc);
+    ResourceHandle ImportImage(const std::string &name, const GraphImageDesc &desc, const ImportedState &state);
+    ResourceHandle ImportBuffer(const std::string &name, const GraphBufferDesc &desc, const ImportedState &state);
+    void SetImportedImage(ResourceHandle resource, VkImage image, VkImageView view, VkExtent2D extent);
+    void SetImportedBuffer(ResourceHandle resource, VkBuffer buffer);
+    void MarkOutput(ResourceHandle resource);
+    void SetProfiler(GpuProfiler *profiler);
+
+    PassBuilder AddPass(const std::string &name);
+    void Compile();
+    void Execute(VkCommandBuffer commandBuffer);
+
+    VkImage Image(ResourceHandle resource);
+    VkImageView ImageView(ResourceHandle resource);
+    VkBuffer Buffer(ResourceHandle resource);
+    const GraphImageDesc& ImageDesc(ResourceHandle resource);
+    const RenderGraphStats& Stats();
+
+    private:
+    void cull();
+    void computeLifetimes();
+    void allocateTransients();
+    void releaseTransients();
+    void planBarriers();
+    void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier> &barriers);
+};
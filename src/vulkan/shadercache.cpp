@@ -0,0 +1,230 @@
+#include "shadercache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "childprocess.h"
+#include "profiler/cpuprofiler.h"
+
+static const uint32_t SPIRV_MAGIC = 0x07230203;
+
+ShaderCache::ShaderCache(VkDevice device, std::string directory, uint32_t threadCount) {
+    this->device = device;
+    this->directory = directory;
+    // Overridable so a specific SDK's compiler can be picked
+    const char *glslc = std::getenv("GLSLC");
+    this->compiler = glslc ? glslc : "glslc";
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    for (uint32_t i = 0; i < std::max(threadCount, 1u); i++) {
+        workers.emplace_back(&ShaderCache::workerLoop, this);
+    }
+}
+
+ShaderCache::~ShaderCache() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    for (std::thread &worker: workers) {
+        worker.join();
+    }
+
+    for (auto &module: modules) {
+        try {
+            VkShaderModule shaderModule = module.second.get();
+            if (shaderModule != VK_NULL_HANDLE)
+                vkDestroyShaderModule(device, shaderModule, nullptr);
+        } catch (std::exception&) {
+            // Failed compiles have nothing to destroy
+        }
+    }
+}
+
+// Returns once the source is read and hashed, the module is created on a worker. Asking for the same source again
+// while it's still pending or after it's done returns the same future. Compile errors, and a missing file, surface as
+// an exception from get().
+std::shared_future<VkShaderModule> ShaderCache::Load(const ShaderSource &source) {
+    auto promise = std::make_shared<std::promise<VkShaderModule>>();
+    std::shared_future<VkShaderModule> future = promise->get_future().share();
+
+    uint64_t hash;
+    try {
+        hash = hashSource(source, readSource(source.path));
+    } catch (...) {
+        promise->set_exception(std::current_exception());
+        return future;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = modules.find(hash);
+        if (found != modules.end())
+            return found->second;
+        modules[hash] = future;
+    }
+
+    enqueue([this, source, hash, promise] {
+        try {
+            std::vector<uint32_t> code = compile(source, hash);
+            VkShaderModuleCreateInfo createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            createInfo.codeSize = code.size() * sizeof(uint32_t);
+            createInfo.pCode = code.data();
+            VkShaderModule shaderModule;
+            if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+                throw std::runtime_error("error creating shader module for " + source.path);
+            }
+            promise->set_value(shaderModule);
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return future;
+}
+
+// Just the SPIR-V, for callers that reflect on it or create the module themselves
+std::shared_future<std::vector<uint32_t>> ShaderCache::Compile(const ShaderSource &source) {
+    auto promise = std::make_shared<std::promise<std::vector<uint32_t>>>();
+    std::shared_future<std::vector<uint32_t>> future = promise->get_future().share();
+
+    enqueue([this, source, promise] {
+        try {
+            std::string text = readSource(source.path);
+            promise->set_value(compile(source, hashSource(source, text)));
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return future;
+}
+
+void ShaderCache::workerLoop() {
+    PROFILE_THREAD("Shader compiler");
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueChanged.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping && jobs.empty())
+                return;
+            job = std::move(jobs.front());
+            jobs.pop();
+        }
+        job();
+    }
+}
+
+void ShaderCache::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        jobs.push(std::move(job));
+    }
+    queueChanged.notify_one();
+}
+
+std::string ShaderCache::readSource(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("error opening shader " + path);
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+// Cached blob when there is one for this exact input, otherwise runs the compiler and stores the result. The compiler
+// reads the file again, an edit in between only costs a blob stored under the old hash.
+std::vector<uint32_t> ShaderCache::compile(const ShaderSource &source, uint64_t hash) {
+    PROFILE_ZONE("CompileShader");
+    std::string path = blobPath(hash);
+    std::vector<uint32_t> code = readBlob(path);
+    if (!code.empty())
+        return code;
+
+    // Unique per job, two workers can be compiling the same shader
+    std::string tmpPath = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    std::vector<std::string> args = {compiler, "--target-env=" + source.targetEnv, "-fentry-point=" + source.entryPoint};
+    if (!source.stage.empty())
+        args.push_back("-fshader-stage=" + source.stage);
+    if (std::filesystem::path(source.path).extension() == ".hlsl") {
+        args.push_back("-x");
+        args.push_back("hlsl");
+    }
+    for (const auto &define: source.defines) {
+        args.push_back("-D" + define.first + (define.second.empty() ? "" : "=" + define.second));
+    }
+    args.push_back("-o");
+    args.push_back(tmpPath);
+    args.push_back(source.path);
+
+    if (RunProcess(args) != 0) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("error compiling shader " + source.path);
+    }
+
+    code = readBlob(tmpPath);
+    if (code.empty()) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("compiler produced no SPIR-V for " + source.path);
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error) {
+        std::cout << "Could not store shader blob " << path << ": " << error.message() << std::endl;
+        std::remove(tmpPath.c_str());
+    }
+    return code;
+}
+
+// Empty when missing or not SPIR-V
+std::vector<uint32_t> ShaderCache::readBlob(const std::string &path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return {};
+
+    std::streamsize size = file.tellg();
+    if (size <= 0 || size % sizeof(uint32_t) != 0)
+        return {};
+    std::vector<uint32_t> code(size / sizeof(uint32_t));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(code.data()), size) || code[0] != SPIRV_MAGIC)
+        return {};
+    return code;
+}
+
+std::string ShaderCache::blobPath(uint64_t hash) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(hash));
+    return (std::filesystem::path(directory) / name).string();
+}
+
+// FNV-1a over everything that goes into the compile, with separators so fields can't run into each other
+uint64_t ShaderCache::hashSource(const ShaderSource &source, const std::string &text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto add = [&hash](const std::string &value) {
+        for (char c: value) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 0x100000001b3ULL;
+        }
+        hash ^= 0xff;
+        hash *= 0x100000001b3ULL;
+    };
+
+    add(text);
+    add(std::filesystem::path(source.path).extension().string());
+    add(source.stage);
+    add(source.entryPoint);
+    add(source.targetEnv);
+    for (const auto &define: source.defines) {
+        add(define.first);
+        add(define.second);
+    }
+    return hash;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A GLSL or HLSL (by file extension) shader and everything that changes its SPIR-V
+struct ShaderSource {
+    std::string path;
+    std::string stage;       // glslc -fshader-stage value, only needed when the extension doesn't say (HLSL)
+    std::string entryPoint = "main";
+    std::string targetEnv = "vulkan1.0";
+    std::vector<std::pair<std::string, std::string>> defines;
+};
+
+// Compiles shaders to SPIR-V with glslc on worker threads and caches both the blobs, on disk, and the shader modules,
+// in memory. Both are keyed by a hash of the source text, defines, entry point, stage and target environment, so an
+// unchanged shader is only read from disk and an edited one is recompiled. Files pulled in with #include are not
+// part of the hash, touch the including file to rebuild.
+class ShaderCache {
+    private:
+    VkDevice device;
+    std::string directory;
+    std::string compiler;
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::shared_future<VkShaderModule>> modules;
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::queue<std::function<void()>> jobs;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    public:
+    ShaderCache(VkDevice device, std::string directory = "shadercache", uint32_t threadCount = 2);
+    ~ShaderCache();
+
+    std::shared_future<VkShaderModule> Load(const ShaderSource &source);
+    std::shared_future<std::vector<uint32_t>> Compile(const ShaderSource &source);
+
+    private:
+    void workerLoop();
+    void enqueue(std::function<void()> job);
+    std::string readSource(const std::string &path);
+    std::vector<uint32_t> compile(const ShaderSource &source, uint64_t hash);
+    std::vector<uint32_t> readBlob(const std::string &path);
+    std::string blobPath(uint64_t hash);
+    static uint64_t hashSource(const ShaderSource &source, const std::string &text);
+};
@@ -0,0 +1,246 @@
+#include "spirvreflection.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+    const uint32_t SPIRV_MAGIC = 0x07230203;
+
+    // Opcodes, decorations and enums from the SPIR-V spec, only the ones looked at
+    enum Op : uint32_t {
+        OpExecutionMode = 16,
+        OpTypeInt = 21,
+        OpTypeFloat = 22,
+        OpTypeVector = 23,
+        OpTypeMatrix = 24,
+        OpTypeArray = 28,
+        OpTypeRuntimeArray = 29,
+        OpTypeStruct = 30,
+        OpTypePointer = 32,
+        OpConstant = 43,
+        OpConstantComposite = 44,
+        OpSpecConstant = 50,
+        OpSpecConstantComposite = 51,
+        OpVariable = 59,
+        OpDecorate = 71,
+        OpMemberDecorate = 72,
+        OpExecutionModeId = 331,
+    };
+    const uint32_t DecorationSpecId = 1;
+    const uint32_t DecorationArrayStride = 6;
+    const uint32_t DecorationMatrixStride = 7;
+    const uint32_t DecorationOffset = 35;
+    const uint32_t DecorationBlock = 2;
+    const uint32_t DecorationBufferBlock = 3;
+    const uint32_t DecorationBuiltIn = 11;
+    const uint32_t DecorationBinding = 33;
+    const uint32_t DecorationDescriptorSet = 34;
+    const uint32_t BuiltInWorkgroupSize = 25;
+    const uint32_t ExecutionModeLocalSize = 17;
+    const uint32_t ExecutionModeLocalSizeId = 38;
+    const uint32_t StorageClassUniformConstant = 0;
+    const uint32_t StorageClassUniform = 2;
+    const uint32_t StorageClassPushConstant = 9;
+    const uint32_t StorageClassStorageBuffer = 12;
+
+    struct Decorations {
+        int64_t set = -1;
+        int64_t binding = -1;
+        int64_t specId = -1;
+        uint32_t arrayStride = 0;
+        bool block = false;
+        bool bufferBlock = false;
+        bool workgroupSize = false;
+    };
+
+    struct Member {
+        uint32_t offset = 0;
+        uint32_t matrixStride = 0;
+    };
+
+    // Enough of every result id to follow variables to their types and constants to their values
+    struct Id {
+        uint32_t opcode = 0;
+        std::vector<uint32_t> operands;   // Everything after the result id
+    };
+}
+
+SpirvReflection::SpirvReflection(const std::vector<uint32_t> &spirv) {
+    if (spirv.size() < 5 || spirv[0] != SPIRV_MAGIC) {
+        throw std::runtime_error("not a SPIR-V module");
+    }
+
+    std::unordered_map<uint32_t, Decorations> decorations;
+    std::unordered_map<uint32_t, std::vector<Member>> members;
+    std::unordered_map<uint32_t, Id> ids;
+    std::vector<uint32_t> variables;
+    std::vector<uint32_t> localSizeIds;
+    bool literalLocalSize = false;
+
+    for (size_t i = 5; i < spirv.size();) {
+        uint32_t wordCount = spirv[i] >> 16;
+        uint32_t opcode = spirv[i] & 0xffff;
+        if (wordCount == 0 || i + wordCount > spirv.size()) {
+            throw std::runtime_error("truncated SPIR-V module");
+        }
+        const uint32_t *words = &spirv[i + 1];
+        uint32_t operandCount = wordCount - 1;
+
+        switch (opcode) {
+        case OpDecorate: {
+            Decorations &decoration = decorations[words[0]];
+            uint32_t kind = words[1];
+            if (kind == DecorationSpecId) decoration.specId = words[2];
+            if (kind == DecorationBlock) decoration.block = true;
+            if (kind == DecorationBufferBlock) decoration.bufferBlock = true;
+            if (kind == DecorationBuiltIn && words[2] == BuiltInWorkgroupSize) decoration.workgroupSize = true;
+            if (kind == DecorationBinding) decoration.binding = words[2];
+            if (kind == DecorationDescriptorSet) decoration.set = words[2];
+            if (kind == DecorationArrayStride) decoration.arrayStride = words[2];
+            break;
+        }
+        case OpMemberDecorate: {
+            std::vector<Member> &structMembers = members[words[0]];
+            if (structMembers.size() <= words[1])
+                structMembers.resize(words[1] + 1);
+            if (words[2] == DecorationOffset) structMembers[words[1]].offset = words[3];
+            if (words[2] == DecorationMatrixStride) structMembers[words[1]].matrixStride = words[3];
+            break;
+        }
+        case OpExecutionMode:
+            if (words[1] == ExecutionModeLocalSize) {
+                localSize = {words[2], words[3], words[4]};
+                literalLocalSize = true;
+            }
+            break;
+        case OpExecutionModeId:
+            if (words[1] == ExecutionModeLocalSizeId)
+                localSizeIds.assign(words + 2, words + 5);
+            break;
+        // Types have the result id first, constants and variables after the result type
+        case OpTypeInt:
+        case OpTypeFloat:
+        case OpTypeVector:
+        case OpTypeMatrix:
+        case OpTypeArray:
+        case OpTypeRuntimeArray:
+        case OpTypeStruct:
+        case OpTypePointer:
+            ids[words[0]] = {opcode, std::vector<uint32_t>(words + 1, words + operandCount)};
+            break;
+        case OpConstant:
+        case OpConstantComposite:
+        case OpSpecConstant:
+        case OpSpecConstantComposite:
+            ids[words[1]] = {opcode, std::vector<uint32_t>(words + 2, words + operandCount)};
+            break;
+        // Pointer type and storage class
+        case OpVariable:
+            ids[words[1]] = {opcode, {words[0], words[2]}};
+            variables.push_back(words[1]);
+            break;
+        }
+        i += wordCount;
+    }
+
+    // The WorkgroupSize builtin wins over the execution modes, that's where local_size_x_id ends up
+    for (auto &[id, decoration]: decorations) {
+        if (!decoration.workgroupSize)
+            continue;
+        auto composite = ids.find(id);
+        if (composite != ids.end() && composite->second.operands.size() == 3)
+            localSizeIds = composite->second.operands;
+    }
+    if (!localSizeIds.empty()) {
+        for (uint32_t dimension = 0; dimension < 3; dimension++) {
+            auto constant = ids.find(localSizeIds[dimension]);
+            if (constant == ids.end() || constant->second.operands.empty())
+                continue;
+            localSize[dimension] = constant->second.operands[0];
+            if (constant->second.opcode == OpSpecConstant && decorations[localSizeIds[dimension]].specId >= 0)
+                localSizeSpecIds[dimension] = static_cast<int32_t>(decorations[localSizeIds[dimension]].specId);
+        }
+    } else if (!literalLocalSize) {
+        throw std::runtime_error("SPIR-V module has no workgroup size, is it a compute shader?");
+    }
+
+    // Explicit layouts always decorate offsets and strides, only matrices need their stride passed down from the member
+    std::function<uint32_t(uint32_t, uint32_t)> typeSize = [&](uint32_t type, uint32_t matrixStride) -> uint32_t {
+        const Id &id = ids[type];
+        switch (id.opcode) {
+        case OpTypeInt:
+        case OpTypeFloat:
+            return id.operands[0] / 8;
+        case OpTypeVector:
+            return id.operands[1] * typeSize(id.operands[0], 0);
+        case OpTypeMatrix:
+            return id.operands[1] * (matrixStride ? matrixStride : typeSize(id.operands[0], 0));
+        case OpTypeArray:
+            return ids[id.operands[1]].operands.at(0) * decorations[type].arrayStride;
+        case OpTypeStruct: {
+            uint32_t size = 0;
+            const std::vector<Member> &structMembers = members[type];
+            for (size_t i = 0; i < id.operands.size() && i < structMembers.size(); i++)
+                size = std::max(size, structMembers[i].offset + typeSize(id.operands[i], structMembers[i].matrixStride));
+            return size;
+        }
+        default:
+            throw std::runtime_error("unsupported type in SPIR-V push constant block");
+        }
+    };
+
+    for (uint32_t variable: variables) {
+        if (ids[variable].operands[1] == StorageClassPushConstant) {
+            const Id &pointer = ids[ids[variable].operands[0]];
+            pushConstantSize = typeSize(pointer.operands[1], 0);
+            continue;
+        }
+
+        const Decorations &decoration = decorations[variable];
+        if (decoration.binding < 0)
+            continue;
+
+        // Variable -> pointer -> the block struct
+        const Id &pointer = ids[ids[variable].operands[0]];
+        uint32_t storageClass = ids[variable].operands[1];
+        uint32_t pointee = pointer.operands.size() > 1 ? pointer.operands[1] : 0;
+        if (ids[pointee].opcode == OpTypeArray || ids[pointee].opcode == OpTypeRuntimeArray) {
+            throw std::runtime_error("descriptor arrays are not supported in compute kernels");
+        }
+
+        SpirvBinding binding;
+        binding.set = static_cast<uint32_t>(std::max<int64_t>(decoration.set, 0));
+        binding.binding = static_cast<uint32_t>(decoration.binding);
+        if (storageClass == StorageClassStorageBuffer || (storageClass == StorageClassUniform && decorations[pointee].bufferBlock)) {
+            binding.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        } else if (storageClass == StorageClassUniform) {
+            binding.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        } else if (storageClass == StorageClassUniformConstant) {
+            throw std::runtime_error("images and samplers are not supported in compute kernels");
+        } else {
+            continue;
+        }
+        bindings.push_back(binding);
+    }
+    std::sort(bindings.begin(), bindings.end(), [](const SpirvBinding &a, const SpirvBinding &b) {
+        return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+}
+
+const std::vector<SpirvBinding>& SpirvReflection::Bindings() const {
+    return bindings;
+}
+
+std::array<uint32_t, 3> SpirvReflection::LocalSize() const {
+    return localSize;
+}
+
+std::array<int32_t, 3> SpirvReflection::LocalSizeSpecIds() const {
+    return localSizeSpecIds;
+}
+
+uint32_t SpirvReflection::PushConstantSize() const {
+    return pushConstantSize;
+}
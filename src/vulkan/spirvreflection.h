@@ -0,0 +1,34 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+struct SpirvBinding {
+    uint32_t set = 0;
+    uint32_t binding = 0;
+    VkDescriptorType type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+};
+
+// Just enough SPIR-V parsing to build pipelines for compute kernels: the buffer bindings and the workgroup size,
+// including which specialization constants set it (local_size_x_id and friends in GLSL).
+// Images, samplers and descriptor arrays aren't supported and throw. Push constants are only measured.
+class SpirvReflection {
+    private:
+    std::vector<SpirvBinding> bindings;
+    std::array<uint32_t, 3> localSize = {1, 1, 1};
+    // -1 when the dimension is a literal in the shader
+    std::array<int32_t, 3> localSizeSpecIds = {-1, -1, -1};
+    uint32_t pushConstantSize = 0;
+
+    public:
+    SpirvReflection(const std::vector<uint32_t> &spirv);
+
+    // Sorted by set, then binding
+    const std::vector<SpirvBinding>& Bindings() const;
+    std::array<uint32_t, 3> LocalSize() const;
+    std::array<int32_t, 3> LocalSizeSpecIds() const;
+    // Bytes up to the end of the last push constant member, 0 without a push constant block
+    uint32_t PushConstantSize() const;
+};
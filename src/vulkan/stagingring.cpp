@@ -0,0 +1,295 @@
+#include "stagingring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+StagingRing::StagingRing(const LogicalDevice &device, MemoryAllocator &allocator, VkDeviceSize capacity) : device(device), allocator(allocator) {
+    if (!device.features.timelineSemaphore) {
+        throw std::runtime_error("staging ring requires timeline semaphores");
+    }
+
+    this->capacity = capacity;
+    transferFamily = device.queueFamilies.transferFamily.value();
+    graphicsFamily = device.queueFamilies.graphicsFamily.value();
+    ownershipTransfer = transferFamily != graphicsFamily;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device.physicalDevice, &properties);
+    optimalCopyAlignment = std::max<VkDeviceSize>(properties.limits.optimalBufferCopyOffsetAlignment, 4);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = capacity;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, allocation);
+    mapped = static_cast<uint8_t*>(allocation.mapped);
+
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+    if (vkCreateSemaphore(device.device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS) {
+        throw std::runtime_error("error creating staging timeline semaphore");
+    }
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = transferFamily;
+    if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("error creating staging command pool");
+    }
+}
+
+StagingRing::~StagingRing() {
+    try {
+        if (recording != VK_NULL_HANDLE)
+            Flush();
+        Wait(timelineValue);
+    } catch (std::runtime_error &e) {
+        std::cout << "Staging ring not idle when destroyed: " << e.what() << std::endl;
+    }
+
+    vkDestroyCommandPool(device.device, commandPool, nullptr);
+    vkDestroySemaphore(device.device, timeline, nullptr);
+    allocator.DestroyBuffer(buffer, allocation);
+}
+
+// Buffers bigger than a quarter of the ring are split, so a piece always fits even after wrapping and alignment
+void StagingRing::UploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size) {
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    VkDeviceSize maxChunk = capacity / 4;
+    for (VkDeviceSize done = 0; done < size; ) {
+        VkDeviceSize chunk = std::min(size - done, maxChunk);
+        VkDeviceSize offset = reserve(chunk, optimalCopyAlignment);
+        memcpy(mapped + offset % capacity, bytes + done, chunk);
+
+        VkBufferCopy region{};
+        region.srcOffset = offset % capacity;
+        region.dstOffset = dstOffset + done;
+        region.size = chunk;
+        vkCmdCopyBuffer(commandBuffer(), buffer, dst, 1, &region);
+        done += chunk;
+    }
+
+    if (ownershipTransfer) {
+        // Release on the transfer queue, the matching acquire is recorded by the consumer in RecordAcquireBarriers
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.srcQueueFamilyIndex = transferFamily;
+        barrier.dstQueueFamilyIndex = graphicsFamily;
+        barrier.buffer = dst;
+        barrier.offset = dstOffset;
+        barrier.size = size;
+        vkCmdPipelineBarrier(commandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        bufferAcquires.push_back(barrier);
+    }
+    // Same family: the timeline semaphore wait already makes the copy visible to the consumer
+}
+
+void StagingRing::UploadImage(VkImage dst, VkImageLayout finalLayout, VkExtent3D extent, VkImageSubresourceLayers subresource, const void *data, VkDeviceSize size) {
+    if (size > capacity / 4) {
+        throw std::runtime_error("image upload bigger than the staging ring");
+    }
+
+    VkDeviceSize offset = reserve(size, optimalCopyAlignment);
+    memcpy(mapped + offset % capacity, data, size);
+
+    VkImageSubresourceRange range{};
+    range.aspectMask = subresource.aspectMask;
+    range.baseMipLevel = subresource.mipLevel;
+    range.levelCount = 1;
+    range.baseArrayLayer = subresource.baseArrayLayer;
+    range.layerCount = subresource.layerCount;
+
+    VkImageMemoryBarrier toTransfer{};
+    toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toTransfer.srcAccessMask = 0;
+    toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = dst;
+    toTransfer.subresourceRange = range;
+    vkCmdPipelineBarrier(commandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = offset % capacity;
+    region.imageSubresource = subresource;
+    region.imageExtent = extent;
+    vkCmdCopyBufferToImage(commandBuffer(), buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    // The layout transition to finalLayout happens in the release barrier and must be repeated in the acquire one
+    VkImageMemoryBarrier release{};
+    release.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    release.dstAccessMask = 0;
+    release.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    release.newLayout = finalLayout;
+    release.srcQueueFamilyIndex = ownershipTransfer ? transferFamily : VK_QUEUE_FAMILY_IGNORED;
+    release.dstQueueFamilyIndex = ownershipTransfer ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+    release.image = dst;
+    release.subresourceRange = range;
+    vkCmdPipelineBarrier(commandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &release);
+
+    if (ownershipTransfer) {
+        VkImageMemoryBarrier acquire = release;
+        acquire.srcAccessMask = 0;
+        acquire.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        imageAcquires.push_back(acquire);
+    }
+}
+
+// Submits everything recorded since the last flush. Returns the timeline value signalled when the copies are done,
+// or the last one if there was nothing to submit.
+uint64_t StagingRing::Flush() {
+    if (recording == VK_NULL_HANDLE)
+        return timelineValue;
+
+    vkEndCommandBuffer(recording);
+    timelineValue++;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &timelineValue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &recording;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &timeline;
+    if (vkQueueSubmit(device.transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("error submitting staging copies");
+    }
+
+    inFlight.push_back({recording, timelineValue, head});
+    recording = VK_NULL_HANDLE;
+    return timelineValue;
+}
+
+// Acquire half of the queue family ownership transfers for everything flushed so far. Must be recorded on the
+// graphics queue in a submission that waits for the value Flush() returned. All commands as the source stage chains
+// the barrier, and the layout change it repeats, after that wait whatever stage it was made at.
+void StagingRing::RecordAcquireBarriers(VkCommandBuffer commandBuffer) {
+    if (bufferAcquires.empty() && imageAcquires.empty())
+        return;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+        0, nullptr,
+        static_cast<uint32_t>(bufferAcquires.size()), bufferAcquires.data(),
+        static_cast<uint32_t>(imageAcquires.size()), imageAcquires.data());
+    bufferAcquires.clear();
+    imageAcquires.clear();
+}
+
+VkSemaphore StagingRing::Timeline() {
+    return timeline;
+}
+
+bool StagingRing::IsComplete(uint64_t value) {
+    uint64_t completed = 0;
+    if (device.getSemaphoreCounterValue(device.device, timeline, &completed) != VK_SUCCESS) {
+        throw std::runtime_error("error reading staging timeline");
+    }
+    return completed >= value;
+}
+
+void StagingRing::Wait(uint64_t value) {
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &value;
+    if (device.waitSemaphores(device.device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("error waiting for staging copies");
+    }
+    reclaim(false);
+}
+
+// Returns a monotonic offset, callers use offset % capacity inside the buffer. Allocations never wrap around the end.
+VkDeviceSize StagingRing::reserve(VkDeviceSize size, VkDeviceSize alignment) {
+    VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+    if (offset % capacity + size > capacity)
+        offset = (offset / capacity + 1) * capacity;
+
+    reclaim(false);
+    while (offset + size - tail > capacity) {
+        // Out of space, the pending copies have to go out before their space can come back
+        if (inFlight.empty())
+            Flush();
+        reclaim(true);
+    }
+
+    head = offset + size;
+    return offset;
+}
+
+// Moves tail past every batch the GPU has finished, optionally blocking for the oldest one
+void StagingRing::reclaim(bool block) {
+    if (inFlight.empty())
+        return;
+
+    if (block) {
+        uint64_t value = inFlight.front().timelineValue;
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timeline;
+        waitInfo.pValues = &value;
+        if (device.waitSemaphores(device.device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("error waiting for staging copies");
+        }
+    }
+
+    uint64_t completed = 0;
+    if (device.getSemaphoreCounterValue(device.device, timeline, &completed) != VK_SUCCESS) {
+        throw std::runtime_error("error reading staging timeline");
+    }
+    while (!inFlight.empty() && inFlight.front().timelineValue <= completed) {
+        tail = inFlight.front().end;
+        freeCommandBuffers.push_back(inFlight.front().commandBuffer);
+        inFlight.pop_front();
+    }
+    if (inFlight.empty() && recording == VK_NULL_HANDLE)
+        tail = head;
+}
+
+VkCommandBuffer StagingRing::commandBuffer() {
+    if (recording != VK_NULL_HANDLE)
+        return recording;
+
+    if (freeCommandBuffers.empty()) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(device.device, &allocInfo, &recording) != VK_SUCCESS) {
+            throw std::runtime_error("error allocating staging command buffer");
+        }
+    } else {
+        recording = freeCommandBuffers.back();
+        freeCommandBuffers.pop_back();
+        vkResetCommandBuffer(recording, 0);
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(recording, &beginInfo);
+    return recording;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <deque>
+#include <vector>
+#include "logicaldevice.h"
+#include "memoryallocator.h"
+
+// Persistently mapped ring buffer that batches CPU to GPU copies and submits them on the transfer queue.
+// Space is handed out front to back and reclaimed once the timeline semaphore says the copies reading it are done,
+// so uploads only block when the ring is full.
+//
+// Usage: Upload*() as many times as needed, Flush() to submit, then make the consumer queue wait on Timeline() for
+// the returned value and record RecordAcquireBarriers() at the start of its command buffer. Not thread safe.
+class StagingRing {
+    private:
+    struct Batch {
+        VkCommandBuffer commandBuffer;
+        uint64_t timelineValue;
+        VkDeviceSize end;
+    };
+
+    const LogicalDevice &device;
+    MemoryAllocator &allocator;
+    uint32_t transferFamily;
+    uint32_t graphicsFamily;
+    bool ownershipTransfer;
+    VkDeviceSize optimalCopyAlignment;
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation allocation;
+    uint8_t *mapped = nullptr;
+    VkDeviceSize capacity;
+    // Both grow forever, the ring position is value % capacity
+    VkDeviceSize head = 0;
+    VkDeviceSize tail = 0;
+
+    VkSemaphore timeline = VK_NULL_HANDLE;
+    uint64_t timelineValue = 0;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer recording = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+    std::deque<Batch> inFlight;
+    std::vector<VkBufferMemoryBarrier> bufferAcquires;
+    std::vector<VkImageMemoryBarrier> imageAcquires;
+
+    public:
+    StagingRing(const LogicalDevice &device, MemoryAllocator &allocator, VkDeviceSize capacity = 32 * 1024 * 1024);
+    ~StagingRing();
+
+    void UploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size);
+    void UploadImage(VkImage dst, VkImageLayout finalLayout, VkExtent3D extent, VkImageSubresourceLayers subresource, const void *data, VkDeviceSize size);
+    uint64_t Flush();
+    void RecordAcquireBarriers(VkCommandBuffer commandBuffer);
+
+    VkSemaphore Timeline();
+    bool IsComplete(uint64_t value);
+    void Wait(uint64_t value);
+
+    private:
+    VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize alignment);
+    void reclaim(bool block);
+    VkCommandBuffer commandBuffer();
+};
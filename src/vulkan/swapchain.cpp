@@ -0,0 +1,309 @@
+#include "swapchain.h"
+
+#include <algorithm>
+#include <iostream>
+#include "profiler/cpuprofiler.h"
+
+Swapchain::Swapchain(const LogicalDevice &device, VkSurfaceKHR surface, VkExtent2D extent, PresentPolicy policy, VkImageUsageFlags imageUsage) : device(device) {
+    this->surface = surface;
+    this->policy = policy;
+    this->imageUsage = imageUsage;
+    surfaceFormat = chooseSurfaceFormat();
+    presentMode = choosePresentMode();
+    create(extent, VK_NULL_HANDLE);
+}
+
+Swapchain::~Swapchain() {
+    // The owner waits for the device before destroying us, which covers the submissions. Present fences, when there
+    // are any, cover the presents.
+    for (Retired &old: retired) {
+        releasePresentFences(old.presentFences, true);
+        destroy(old.swapchain, old.imageViews, old.renderFinished);
+    }
+    releasePresentFences(presentFences, true);
+    destroy(swapchain, imageViews, renderFinished);
+    for (VkFence fence: freePresentFences) {
+        vkDestroyFence(device.device, fence, nullptr);
+    }
+}
+
+// Returns false when the swapchain no longer matches the surface and has to be recreated. In that case
+// imageAvailable is not signalled. A suboptimal swapchain still acquires and is recreated after presenting.
+bool Swapchain::Acquire(VkSemaphore imageAvailable, uint32_t &imageIndex) {
+    PROFILE_ZONE("Acquire");
+    VkResult result = vkAcquireNextImageKHR(device.device, swapchain, UINT64_MAX, imageAvailable, VK_NULL_HANDLE, &imageIndex);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+        return false;
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        throw std::runtime_error("error acquiring swapchain image");
+    }
+    return true;
+}
+
+// Presents from the graphics queue once RenderFinished(imageIndex) is signalled. Returns false if the swapchain should
+// be recreated.
+bool Swapchain::Present(uint32_t imageIndex) {
+    PROFILE_ZONE("Present");
+    VkPresentInfoKHR presentInfo{};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &renderFinished[imageIndex];
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &swapchain;
+    presentInfo.pImageIndices = &imageIndex;
+
+    VkSwapchainPresentFenceInfoEXT fenceInfo{};
+    VkFence fence = VK_NULL_HANDLE;
+    if (device.features.swapchainMaintenance1) {
+        // Keeps the list down to the presents still in flight
+        releasePresentFences(presentFences, false);
+        fence = presentFence();
+        fenceInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
+        fenceInfo.swapchainCount = 1;
+        fenceInfo.pFences = &fence;
+        presentInfo.pNext = &fenceInfo;
+    }
+
+    VkResult result = vkQueuePresentKHR(device.graphicsQueue, &presentInfo);
+    // An out of date present is still queued and signals its fence, a failed one never does
+    if (fence != VK_NULL_HANDLE) {
+        if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR)
+            presentFences.push_back(fence);
+        else
+            freePresentFences.push_back(fence);
+    }
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+        return false;
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("error presenting swapchain image");
+    }
+    return true;
+}
+
+// Everything that used the current swapchain must already be submitted or presented
+void Swapchain::Recreate(VkExtent2D extent) {
+    Retired old;
+    old.swapchain = swapchain;
+    old.imageViews = std::move(imageViews);
+    old.renderFinished = std::move(renderFinished);
+    old.presentFences = std::move(presentFences);
+
+    imageViews.clear();
+    renderFinished.clear();
+    presentFences.clear();
+    create(extent, old.swapchain);
+    retired.push_back(std::move(old));
+}
+
+// Call after every submission to the graphics queue with the fence it signals. Only used without present fences, a
+// submit fence doesn't cover the presents queued before it but says they were queued at least.
+void Swapchain::Submitted(VkFence fence) {
+    for (Retired &old: retired) {
+        if (old.fence == VK_NULL_HANDLE)
+            old.fence = fence;
+    }
+}
+
+void Swapchain::ReleaseRetired() {
+    if (device.features.swapchainMaintenance1) {
+        while (!retired.empty() && releasePresentFences(retired.front().presentFences, false)) {
+            Retired &old = retired.front();
+            destroy(old.swapchain, old.imageViews, old.renderFinished);
+            retired.pop_front();
+        }
+        return;
+    }
+
+    // Nothing signals when a present is done with the old swapchain and its semaphores. Once a submission made after
+    // retiring has completed, its presents are queued and waiting for the queue to go idle is the only way left to
+    // know they finished. That stalls once per resize, not every frame.
+    // Frame fences get reset and reused, a reset one reads as unsignalled until its next submission completes. That only
+    // delays the release, the later submission comes after the old swapchain's presents too.
+    bool waited = false;
+    while (!retired.empty() && retired.front().fence != VK_NULL_HANDLE && vkGetFenceStatus(device.device, retired.front().fence) == VK_SUCCESS) {
+        if (!waited && vkQueueWaitIdle(device.graphicsQueue) != VK_SUCCESS) {
+            throw std::runtime_error("error waiting for presents of a retired swapchain");
+        }
+        waited = true;
+        Retired &old = retired.front();
+        destroy(old.swapchain, old.imageViews, old.renderFinished);
+        retired.pop_front();
+    }
+}
+
+VkImage Swapchain::Image(uint32_t imageIndex) {
+    return images[imageIndex];
+}
+
+VkImageView Swapchain::ImageView(uint32_t imageIndex) {
+    return imageViews[imageIndex];
+}
+
+VkSemaphore Swapchain::RenderFinished(uint32_t imageIndex) {
+    return renderFinished[imageIndex];
+}
+
+VkFormat Swapchain::Format() {
+    return surfaceFormat.format;
+}
+
+VkExtent2D Swapchain::Extent() {
+    return extent;
+}
+
+VkPresentModeKHR Swapchain::PresentMode() {
+    return presentMode;
+}
+
+void Swapchain::create(VkExtent2D requestedExtent, VkSwapchainKHR oldSwapchain) {
+    VkSurfaceCapabilitiesKHR capabilities;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device.physicalDevice, surface, &capabilities);
+
+    // 0xFFFFFFFF means the surface takes whatever size the swapchain has
+    if (capabilities.currentExtent.width != UINT32_MAX) {
+        extent = capabilities.currentExtent;
+    } else {
+        extent.width = std::clamp(requestedExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+        extent.height = std::clamp(requestedExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+    }
+
+    if ((capabilities.supportedUsageFlags & imageUsage) != imageUsage) {
+        throw std::runtime_error("surface doesn't support the requested swapchain image usage");
+    }
+
+    // One more than the minimum so we never wait on the driver to release an image, mailbox needs it to have a spare
+    uint32_t imageCount = capabilities.minImageCount + 1;
+    if (capabilities.maxImageCount > 0)
+        imageCount = std::min(imageCount, capabilities.maxImageCount);
+
+    VkSwapchainCreateInfoKHR createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    createInfo.surface = surface;
+    createInfo.minImageCount = imageCount;
+    createInfo.imageFormat = surfaceFormat.format;
+    createInfo.imageColorSpace = surfaceFormat.colorSpace;
+    createInfo.imageExtent = extent;
+    createInfo.imageArrayLayers = 1;
+    createInfo.imageUsage = imageUsage;
+    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.preTransform = capabilities.currentTransform;
+    createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    createInfo.presentMode = presentMode;
+    createInfo.clipped = VK_TRUE;
+    createInfo.oldSwapchain = oldSwapchain;
+
+    if (vkCreateSwapchainKHR(device.device, &createInfo, nullptr, &swapchain) != VK_SUCCESS) {
+        throw std::runtime_error("error creating swapchain");
+    }
+
+    vkGetSwapchainImagesKHR(device.device, swapchain, &imageCount, nullptr);
+    images.resize(imageCount);
+    vkGetSwapchainImagesKHR(device.device, swapchain, &imageCount, images.data());
+
+    for (VkImage image: images) {
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = surfaceFormat.format;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        VkImageView view;
+        if (vkCreateImageView(device.device, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+            throw std::runtime_error("error creating swapchain image view");
+        }
+        imageViews.push_back(view);
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        VkSemaphore semaphore;
+        if (vkCreateSemaphore(device.device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+            throw std::runtime_error("error creating swapchain semaphore");
+        }
+        renderFinished.push_back(semaphore);
+    }
+
+    std::cout << "Swapchain " << extent.width << "x" << extent.height << ", " << imageCount << " images, present mode " << presentMode << std::endl;
+}
+
+VkSurfaceFormatKHR Swapchain::chooseSurfaceFormat() {
+    uint32_t formatCount = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device.physicalDevice, surface, &formatCount, nullptr);
+    std::vector<VkSurfaceFormatKHR> formats(formatCount);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device.physicalDevice, surface, &formatCount, formats.data());
+
+    for (const auto &format: formats) {
+        if (format.format == VK_FORMAT_B8G8R8A8_SRGB && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+            return format;
+    }
+    return formats[0];
+}
+
+VkPresentModeKHR Swapchain::choosePresentMode() {
+    uint32_t presentModeCount = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device.physicalDevice, surface, &presentModeCount, nullptr);
+    std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device.physicalDevice, surface, &presentModeCount, presentModes.data());
+
+    std::vector<VkPresentModeKHR> preferred;
+    switch (policy) {
+        case PresentPolicy::LowLatency:
+            preferred = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+            break;
+        case PresentPolicy::Throughput:
+            preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+            break;
+        case PresentPolicy::VSync:
+            preferred = {VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+            break;
+    }
+
+    for (VkPresentModeKHR mode: preferred) {
+        if (std::find(presentModes.begin(), presentModes.end(), mode) != presentModes.end())
+            return mode;
+    }
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+VkFence Swapchain::presentFence() {
+    VkFence fence;
+    if (!freePresentFences.empty()) {
+        fence = freePresentFences.back();
+        freePresentFences.pop_back();
+        vkResetFences(device.device, 1, &fence);
+        return fence;
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(device.device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("error creating present fence");
+    }
+    return fence;
+}
+
+// Recycles the fences of finished presents, optionally waiting for all of them. True once none are pending.
+bool Swapchain::releasePresentFences(std::vector<VkFence> &fences, bool wait) {
+    if (wait && !fences.empty())
+        vkWaitForFences(device.device, static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, UINT64_MAX);
+    std::vector<VkFence> pending;
+    for (VkFence fence: fences) {
+        if (vkGetFenceStatus(device.device, fence) == VK_SUCCESS)
+            freePresentFences.push_back(fence);
+        else
+            pending.push_back(fence);
+    }
+    fences = std::move(pending);
+    return fences.empty();
+}
+
+void Swapchain::destroy(VkSwapchainKHR swapchain, std::vector<VkImageView> &imageViews, std::vector<VkSemaphore> &renderFinished) {
+    for (VkSemaphore semaphore: renderFinished) {
+        vkDestroySemaphore(device.device, semaphore, nullptr);
+    }
+    for (VkImageView view: imageViews) {
+        vkDestroyImageView(device.device, view, nullptr);
+    }
+    vkDestroySwapchainKHR(device.device, swapchain, nullptr);
+}
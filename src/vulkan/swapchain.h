@@ -0,0 +1,75 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <deque>
+#include <vector>
+#include "logicaldevice.h"
+
+// How to trade latency, tearing and power when picking a present mode. FIFO is the fallback for all of them since
+// it is the only mode every driver has to support.
+enum class PresentPolicy {
+    LowLatency,  // MAILBOX, then IMMEDIATE: newest frame wins, no tearing with mailbox
+    Throughput,  // IMMEDIATE, then MAILBOX: never wait for vblank, for benchmarks
+    VSync,       // FIFO_RELAXED: vsync, but tear instead of stalling when a frame is late
+};
+
+// Owns the swapchain and its per image resources. Resizing hands the current swapchain to the new one through
+// oldSwapchain and keeps the old one alive until its presents are done. With VK_EXT_swapchain_maintenance1 every
+// present gets a fence that says so. Without it nothing does, and the old one goes once a submission made after it
+// was retired has completed and the graphics queue has been waited idle, one stall per resize.
+class Swapchain {
+    private:
+    struct Retired {
+        VkSwapchainKHR swapchain;
+        std::vector<VkImageView> imageViews;
+        std::vector<VkSemaphore> renderFinished;
+        // Of its presents that weren't known to be done when it was retired, swapchain maintenance only
+        std::vector<VkFence> presentFences;
+        // Of the first submission after retiring, null until there was one
+        VkFence fence = VK_NULL_HANDLE;
+    };
+
+    const LogicalDevice &device;
+    VkSurfaceKHR surface;
+    PresentPolicy policy;
+    VkImageUsageFlags imageUsage;
+
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    VkSurfaceFormatKHR surfaceFormat;
+    VkPresentModeKHR presentMode;
+    VkExtent2D extent;
+    std::vector<VkImage> images;
+    std::vector<VkImageView> imageViews;
+    // One per image rather than per frame: the presentation engine holds on to it until the image is acquired again
+    std::vector<VkSemaphore> renderFinished;
+    std::deque<Retired> retired;
+    // Swapchain maintenance only, signalled once a present no longer uses its semaphore or swapchain
+    std::vector<VkFence> presentFences;
+    std::vector<VkFence> freePresentFences;
+
+    public:
+    // imageUsage must be supported by the surface, creation throws otherwise
+    Swapchain(const LogicalDevice &device, VkSurfaceKHR surface, VkExtent2D extent, PresentPolicy policy, VkImageUsageFlags imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+    ~Swapchain();
+
+    bool Acquire(VkSemaphore imageAvailable, uint32_t &imageIndex);
+    bool Present(uint32_t imageIndex);
+    void Recreate(VkExtent2D extent);
+    void Submitted(VkFence fence);
+    void ReleaseRetired();
+
+    VkImage Image(uint32_t imageIndex);
+    VkImageView ImageView(uint32_t imageIndex);
+    VkSemaphore RenderFinished(uint32_t imageIndex);
+    VkFormat Format();
+    VkExtent2D Extent();
+    VkPresentModeKHR PresentMode();
+
+    private:
+    void create(VkExtent2D extent, VkSwapchainKHR oldSwapchain);
+    VkSurfaceFormatKHR chooseSurfaceFormat();
+    VkPresentModeKHR choosePresentMode();
+    void destroy(VkSwapchainKHR swapchain, std::vector<VkImageView> &imageViews, std::vector<VkSemaphore> &renderFinished);
+    VkFence presentFence();
+    bool releasePresentFences(std::vector<VkFence> &fences, bool wait);
+};
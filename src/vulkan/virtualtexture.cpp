@@ -0,0 +1,680 @@
+#include "virtualtexture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+// Enough for bilinear filtering across page edges in the atlas, anisotropic filtering would need more
+const uint32_t FALLBACK_PAGE_BORDER = 1;
+// Transfer source so resident pages can be copied back out, vtbench checks them that way
+const VkImageUsageFlags VIRTUAL_TEXTURE_USAGE = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+VirtualTexture::VirtualTexture(const LogicalDevice &device, MemoryAllocator &allocator, const VirtualTextureDesc &desc, PageLoader loader)
+    : device(device), allocator(allocator), desc(desc), loader(loader) {
+    if (desc.extent.width == 0 || desc.extent.height == 0 || desc.poolPages == 0 || desc.framesInFlight == 0 || desc.maxUploadsPerFrame == 0) {
+        throw std::runtime_error("invalid virtual texture description");
+    }
+    info.width = desc.extent.width;
+    info.height = desc.extent.height;
+
+    sparse = !desc.forceFallback && sparseSupported();
+    if (sparse)
+        createSparseImage();
+    else
+        createAtlas();
+    createPages();
+
+    pageTable = createBuffer(PageCount() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false, pageTableAllocation);
+    feedback.resize(desc.framesInFlight);
+    for (Feedback &frame: feedback) {
+        frame.buffer = createBuffer(PageCount() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true, frame.allocation);
+        memset(frame.allocation.mapped, 0, PageCount() * sizeof(uint32_t));
+        frame.upload = createBuffer(uploadPageSize * desc.maxUploadsPerFrame, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true, frame.uploadAllocation);
+    }
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = desc.format;
+    viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, sparse ? info.mipLevels : 1, 0, 1};
+    if (vkCreateImageView(device.device, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+        throw std::runtime_error("error creating virtual texture view");
+    }
+
+    if (sparse) {
+        if (device.features.timelineSemaphore) {
+            VkSemaphoreTypeCreateInfo typeInfo{};
+            typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+            typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+            typeInfo.initialValue = 0;
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            semaphoreInfo.pNext = &typeInfo;
+            if (vkCreateSemaphore(device.device, &semaphoreInfo, nullptr, &bindSemaphore) != VK_SUCCESS) {
+                throw std::runtime_error("error creating sparse bind semaphore");
+            }
+        }
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(device.device, &fenceInfo, nullptr, &bindFence) != VK_SUCCESS) {
+            throw std::runtime_error("error creating sparse bind fence");
+        }
+    }
+
+    initialize();
+
+    std::cout << "Virtual texture " << info.width << "x" << info.height << ", " << (sparse ? "sparse residency" : "software page table")
+              << ", " << pages.size() << " pages of " << info.pageWidth << "x" << info.pageHeight << ", " << desc.poolPages << " resident at most" << std::endl;
+}
+
+VirtualTexture::~VirtualTexture() {
+    if (bindFence != VK_NULL_HANDLE)
+        vkDestroyFence(device.device, bindFence, nullptr);
+    if (bindSemaphore != VK_NULL_HANDLE)
+        vkDestroySemaphore(device.device, bindSemaphore, nullptr);
+    for (Feedback &frame: feedback) {
+        allocator.DestroyBuffer(frame.upload, frame.uploadAllocation);
+        allocator.DestroyBuffer(frame.buffer, frame.allocation);
+    }
+    allocator.DestroyBuffer(pageTable, pageTableAllocation);
+    vkDestroyImageView(device.device, view, nullptr);
+    if (sparse) {
+        vkDestroyImage(device.device, image, nullptr);
+        for (Slot &slot: slots)
+            allocator.Free(slot.memory);
+        if (mipTailMemory.memory != VK_NULL_HANDLE)
+            allocator.Free(mipTailMemory);
+    } else {
+        allocator.DestroyImage(image, imageAllocation);
+    }
+}
+
+// Reads the feedback the frame that used frameIndex last time wrote, its fence must have been waited on. Loads the
+// missing pages that fit in the budget, coarse levels first so there is something close to show quickly, and evicts
+// the least recently used pages when the pool is full.
+void VirtualTexture::Update(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint64_t frameNumber) {
+    stats.uploads = 0;
+    stats.evictions = 0;
+    readFeedback(frameIndex, frameNumber);
+
+    for (auto it = pendingSlots.begin(); it != pendingSlots.end();) {
+        if (slots[*it].freeFrom <= frameNumber) {
+            freeSlots.push_back(*it);
+            it = pendingSlots.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    std::sort(requests.begin(), requests.end(), [this](uint32_t a, uint32_t b) {
+        return pages[a].level > pages[b].level;
+    });
+    std::vector<std::pair<uint32_t, uint32_t>> loads;
+    std::vector<uint32_t> evicted;
+    for (uint32_t page: requests) {
+        if (loads.size() + evicted.size() >= desc.maxUploadsPerFrame)
+            break;
+        if (!freeSlots.empty()) {
+            loads.push_back({page, freeSlots.back()});
+            freeSlots.pop_back();
+            continue;
+        }
+        // Only pages the last feedback didn't ask for are candidates, the slot becomes usable once no frame in flight
+        // can sample the old page anymore
+        uint32_t victim = NONE;
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            uint32_t resident = slots[i].page;
+            if (resident != NONE && pages[resident].lastUsed < frameNumber && (victim == NONE || pages[resident].lastUsed < pages[slots[victim].page].lastUsed))
+                victim = i;
+        }
+        if (victim == NONE)
+            break;
+        evicted.push_back(slots[victim].page);
+        pages[slots[victim].page].slot = NONE;
+        slots[victim].page = NONE;
+        slots[victim].freeFrom = frameNumber + desc.framesInFlight;
+        pendingSlots.push_back(victim);
+    }
+
+    if (loads.empty() && evicted.empty())
+        return;
+    if (sparse && !loads.empty())
+        bindPages(loads);
+
+    // Earlier frames may still be reading the image and the page table
+    VkImageMemoryBarrier toTransfer{};
+    toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toTransfer.srcAccessMask = 0;
+    toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toTransfer.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = image;
+    toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, loads.empty() ? 0 : 1, &toTransfer);
+
+    if (!loads.empty()) {
+        uint8_t *staging = static_cast<uint8_t*>(feedback[frameIndex].uploadAllocation.mapped);
+        std::vector<VkBufferImageCopy> regions;
+        for (uint32_t i = 0; i < loads.size(); i++) {
+            regions.push_back(loadPage(loads[i].first, loads[i].second, staging, uploadPageSize * i));
+        }
+        vkCmdCopyBufferToImage(commandBuffer, feedback[frameIndex].upload, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            static_cast<uint32_t>(regions.size()), regions.data());
+    }
+    for (uint32_t page: evicted) {
+        vkCmdFillBuffer(commandBuffer, pageTable, page * sizeof(uint32_t), sizeof(uint32_t), 0);
+    }
+    for (auto &load: loads) {
+        pages[load.first].slot = load.second;
+        slots[load.second].page = load.first;
+        vkCmdFillBuffer(commandBuffer, pageTable, load.first * sizeof(uint32_t), sizeof(uint32_t), sparse ? 1 : load.second + 1);
+    }
+
+    VkImageMemoryBarrier toShader = toTransfer;
+    toShader.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    toShader.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    toShader.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    VkMemoryBarrier pageTableBarrier{};
+    pageTableBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    pageTableBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    pageTableBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &pageTableBarrier, 0, nullptr, loads.empty() ? 0 : 1, &toShader);
+
+    stats.uploads = static_cast<uint32_t>(loads.size());
+    stats.evictions = static_cast<uint32_t>(evicted.size());
+    stats.totalUploads += loads.size();
+    stats.totalEvictions += evicted.size();
+    stats.residentPages += stats.uploads;
+    stats.residentPages -= stats.evictions;
+}
+
+// Makes the shader writes to the feedback buffer visible to Update() once the frame's fence is signalled
+void VirtualTexture::RecordFeedbackBarrier(VkCommandBuffer commandBuffer) {
+    VkMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &toHost, 0, nullptr, 0, nullptr);
+}
+
+void VirtualTexture::Request(uint32_t frameIndex, uint32_t level, uint32_t pageX, uint32_t pageY) {
+    if (level >= info.tailLevel || pageX >= levelPages[level].width || pageY >= levelPages[level].height)
+        return;
+    uint32_t *entries = static_cast<uint32_t*>(feedback[frameIndex].allocation.mapped);
+    entries[levelOffsets[level] + pageY * levelPages[level].width + pageX] = 1;
+}
+
+bool VirtualTexture::Sparse() {
+    return sparse;
+}
+
+VkImage VirtualTexture::Image() {
+    return image;
+}
+
+VkImageView VirtualTexture::ImageView() {
+    return view;
+}
+
+VkBuffer VirtualTexture::PageTableBuffer() {
+    return pageTable;
+}
+
+VkBuffer VirtualTexture::FeedbackBuffer(uint32_t frameIndex) {
+    return feedback[frameIndex].buffer;
+}
+
+VkDeviceSize VirtualTexture::PageCount() {
+    return pages.size();
+}
+
+VkExtent2D VirtualTexture::LevelPages(uint32_t level) {
+    if (level >= info.tailLevel)
+        return {0, 0};
+    return levelPages[level];
+}
+
+const VirtualTextureInfo& VirtualTexture::Info() {
+    return info;
+}
+
+const VirtualTextureStats& VirtualTexture::Stats() {
+    return stats;
+}
+
+VkSemaphore VirtualTexture::BindSemaphore() {
+    return bindSemaphore;
+}
+
+uint64_t VirtualTexture::BindValue() {
+    return bindValue;
+}
+
+bool VirtualTexture::sparseSupported() {
+    if (!device.features.sparseResidency || device.sparsebindingQueue == VK_NULL_HANDLE)
+        return false;
+
+    uint32_t count = 0;
+    vkGetPhysicalDeviceSparseImageFormatProperties(device.physicalDevice, desc.format, VK_IMAGE_TYPE_2D, VK_SAMPLE_COUNT_1_BIT,
+        VIRTUAL_TEXTURE_USAGE, VK_IMAGE_TILING_OPTIMAL, &count, nullptr);
+    return count > 0;
+}
+
+// Pages are the format's sparse block. Every pool page gets its memory up front, binding only moves it around.
+void VirtualTexture::createSparseImage() {
+    info.sparse = 1;
+    info.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(info.width, info.height)))) + 1;
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.flags = VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = desc.format;
+    imageInfo.extent = {info.width, info.height, 1};
+    imageInfo.mipLevels = info.mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VIRTUAL_TEXTURE_USAGE;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(device.device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+        throw std::runtime_error("error creating sparse virtual texture image");
+    }
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(device.device, image, &memoryRequirements);
+    uint32_t requirementCount = 0;
+    vkGetImageSparseMemoryRequirements(device.device, image, &requirementCount, nullptr);
+    std::vector<VkSparseImageMemoryRequirements> sparseRequirements(requirementCount);
+    vkGetImageSparseMemoryRequirements(device.device, image, &requirementCount, sparseRequirements.data());
+
+    // The metadata aspect, if the driver wants one, only ever lives in the mip tail region
+    std::vector<VkSparseMemoryBind> tailBinds;
+    VkDeviceSize tailSize = 0;
+    bool foundColor = false;
+    for (const VkSparseImageMemoryRequirements &requirements: sparseRequirements) {
+        bool metadata = requirements.formatProperties.aspectMask & VK_IMAGE_ASPECT_METADATA_BIT;
+        if (requirements.formatProperties.aspectMask & VK_IMAGE_ASPECT_COLOR_BIT) {
+            foundColor = true;
+            info.pageWidth = requirements.formatProperties.imageGranularity.width;
+            info.pageHeight = requirements.formatProperties.imageGranularity.height;
+            info.tailLevel = std::min(requirements.imageMipTailFirstLod, info.mipLevels);
+        }
+        if (requirements.imageMipTailFirstLod < info.mipLevels || metadata) {
+            VkSparseMemoryBind bind{};
+            bind.resourceOffset = requirements.imageMipTailOffset;
+            bind.size = requirements.imageMipTailSize;
+            bind.memoryOffset = tailSize;
+            bind.flags = metadata ? VK_SPARSE_MEMORY_BIND_METADATA_BIT : 0;
+            tailBinds.push_back(bind);
+            tailSize += (requirements.imageMipTailSize + memoryRequirements.alignment - 1) / memoryRequirements.alignment * memoryRequirements.alignment;
+        }
+    }
+    if (!foundColor) {
+        throw std::runtime_error("sparse virtual texture has no color aspect requirements");
+    }
+    uploadPageSize = static_cast<VkDeviceSize>(info.pageWidth) * info.pageHeight * desc.texelSize;
+
+    VkMemoryRequirements pageRequirements = memoryRequirements;
+    pageRequirements.size = memoryRequirements.alignment;
+    slots.resize(desc.poolPages);
+    for (Slot &slot: slots) {
+        slot.memory = allocator.Allocate(pageRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false);
+    }
+
+    if (tailBinds.empty())
+        return;
+    VkMemoryRequirements tailRequirements = memoryRequirements;
+    tailRequirements.size = tailSize;
+    mipTailMemory = allocator.Allocate(tailRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false);
+    for (VkSparseMemoryBind &bind: tailBinds) {
+        bind.memory = mipTailMemory.memory;
+        bind.memoryOffset += mipTailMemory.offset;
+    }
+
+    VkSparseImageOpaqueMemoryBindInfo opaqueBind{};
+    opaqueBind.image = image;
+    opaqueBind.bindCount = static_cast<uint32_t>(tailBinds.size());
+    opaqueBind.pBinds = tailBinds.data();
+    VkBindSparseInfo bindInfo{};
+    bindInfo.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+    bindInfo.imageOpaqueBindCount = 1;
+    bindInfo.pImageOpaqueBinds = &opaqueBind;
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence;
+    if (vkCreateFence(device.device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("error creating mip tail bind fence");
+    }
+    VkResult result = vkQueueBindSparse(device.sparsebindingQueue, 1, &bindInfo, fence);
+    if (result == VK_SUCCESS)
+        vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkDestroyFence(device.device, fence, nullptr);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("error binding virtual texture mip tail");
+    }
+}
+
+// One image split in equal slots, each a page plus a border so filtering doesn't bleed from the neighbours. The
+// levels stop at the first one that fits in a single page, which is pinned in slot 0 so there is always something.
+void VirtualTexture::createAtlas() {
+    uint32_t pageSize = desc.fallbackPageSize;
+    info.sparse = 0;
+    info.pageWidth = pageSize;
+    info.pageHeight = pageSize;
+    info.border = FALLBACK_PAGE_BORDER;
+    info.mipLevels = 1;
+    while (std::max(info.width >> (info.mipLevels - 1), info.height >> (info.mipLevels - 1)) > pageSize)
+        info.mipLevels++;
+    info.tailLevel = info.mipLevels;
+
+    uint32_t slotSize = pageSize + 2 * FALLBACK_PAGE_BORDER;
+    info.atlasPagesX = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(desc.poolPages))));
+    info.atlasPagesY = (desc.poolPages + info.atlasPagesX - 1) / info.atlasPagesX;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device.physicalDevice, &properties);
+    if (info.atlasPagesX * slotSize > properties.limits.maxImageDimension2D) {
+        throw std::runtime_error("virtual texture pool too big for the fallback atlas");
+    }
+    uploadPageSize = static_cast<VkDeviceSize>(slotSize) * slotSize * desc.texelSize;
+    slots.resize(desc.poolPages);
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = desc.format;
+    imageInfo.extent = {info.atlasPagesX * slotSize, info.atlasPagesY * slotSize, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VIRTUAL_TEXTURE_USAGE;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image = allocator.CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, imageAllocation);
+}
+
+// One page table entry per page of every paged level, coarser levels after finer ones
+void VirtualTexture::createPages() {
+    for (uint32_t level = 0; level < info.tailLevel; level++) {
+        VkExtent2D extent = levelExtent(level);
+        VkExtent2D count = {(extent.width + info.pageWidth - 1) / info.pageWidth, (extent.height + info.pageHeight - 1) / info.pageHeight};
+        levelOffsets.push_back(static_cast<uint32_t>(pages.size()));
+        levelPages.push_back(count);
+        for (uint32_t y = 0; y < count.height; y++) {
+            for (uint32_t x = 0; x < count.width; x++) {
+                Page page;
+                page.level = level;
+                page.x = x;
+                page.y = y;
+                pages.push_back(page);
+            }
+        }
+    }
+
+    uint32_t firstFree = 0;
+    if (!sparse) {
+        Page &pinned = pages.back();
+        pinned.slot = 0;
+        pinned.lastUsed = UINT64_MAX;
+        slots[0].page = static_cast<uint32_t>(pages.size() - 1);
+        firstFree = 1;
+        stats.residentPages = 1;
+    }
+    // Popped from the back, so low slots go first
+    for (uint32_t slot = static_cast<uint32_t>(slots.size()); slot > firstFree; slot--)
+        freeSlots.push_back(slot - 1);
+}
+
+// Clears the page table and uploads what is always resident: the mip tail with sparse residency, the pinned page
+// otherwise. Runs once on the graphics queue and waits for it.
+void VirtualTexture::initialize() {
+    std::vector<VkBufferImageCopy> regions;
+    VkDeviceSize stagingSize = 0;
+    if (sparse) {
+        for (uint32_t level = info.tailLevel; level < info.mipLevels; level++) {
+            VkExtent2D extent = levelExtent(level);
+            VkBufferImageCopy region{};
+            region.bufferOffset = stagingSize;
+            region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+            region.imageExtent = {extent.width, extent.height, 1};
+            regions.push_back(region);
+            stagingSize += static_cast<VkDeviceSize>(extent.width) * extent.height * desc.texelSize;
+        }
+    } else {
+        stagingSize = uploadPageSize;
+    }
+
+    Allocation stagingAllocation;
+    VkBuffer staging = createBuffer(std::max<VkDeviceSize>(stagingSize, 4), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true, stagingAllocation);
+    uint8_t *mapped = static_cast<uint8_t*>(stagingAllocation.mapped);
+    if (sparse) {
+        for (const VkBufferImageCopy &region: regions) {
+            loader(region.imageSubresource.mipLevel, {0, 0}, {region.imageExtent.width, region.imageExtent.height}, mapped + region.bufferOffset);
+        }
+    } else {
+        regions.push_back(loadPage(static_cast<uint32_t>(pages.size() - 1), 0, mapped, 0));
+    }
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = device.queueFamilies.graphicsFamily.value();
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(device.device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("error creating virtual texture command pool");
+    }
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(device.device, &allocInfo, &commandBuffer);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    VkImageMemoryBarrier toTransfer{};
+    toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toTransfer.srcAccessMask = 0;
+    toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = image;
+    toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+    if (!regions.empty())
+        vkCmdCopyBufferToImage(commandBuffer, staging, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+    vkCmdFillBuffer(commandBuffer, pageTable, 0, VK_WHOLE_SIZE, 0);
+    if (!sparse) {
+        VkMemoryBarrier fillBarrier{};
+        fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        fillBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &fillBarrier, 0, nullptr, 0, nullptr);
+        vkCmdFillBuffer(commandBuffer, pageTable, (pages.size() - 1) * sizeof(uint32_t), sizeof(uint32_t), 1);
+    }
+
+    VkImageMemoryBarrier toShader = toTransfer;
+    toShader.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    toShader.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    toShader.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    VkMemoryBarrier pageTableBarrier{};
+    pageTableBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    pageTableBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    pageTableBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &pageTableBarrier, 0, nullptr, 1, &toShader);
+    vkEndCommandBuffer(commandBuffer);
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence;
+    if (vkCreateFence(device.device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+        vkDestroyCommandPool(device.device, commandPool, nullptr);
+        allocator.DestroyBuffer(staging, stagingAllocation);
+        throw std::runtime_error("error creating virtual texture init fence");
+    }
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    VkResult result = vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, fence);
+    if (result == VK_SUCCESS)
+        vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkDestroyFence(device.device, fence, nullptr);
+    vkDestroyCommandPool(device.device, commandPool, nullptr);
+    allocator.DestroyBuffer(staging, stagingAllocation);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("error initializing virtual texture");
+    }
+}
+
+// Every page a shader wanted also keeps its coarser parents alive and asks for them when they're missing, so the
+// shader's fallback to a coarser level finds something close
+void VirtualTexture::readFeedback(uint32_t frameIndex, uint64_t frameNumber) {
+    requests.clear();
+    uint32_t *entries = static_cast<uint32_t*>(feedback[frameIndex].allocation.mapped);
+    for (uint32_t i = 0; i < pages.size(); i++) {
+        if (entries[i] == 0)
+            continue;
+        uint32_t index = i;
+        while (pages[index].lastUsed < frameNumber) {
+            Page &page = pages[index];
+            page.lastUsed = frameNumber;
+            if (page.slot == NONE)
+                requests.push_back(index);
+            if (page.level + 1 >= info.tailLevel)
+                break;
+            VkExtent2D parentPages = levelPages[page.level + 1];
+            index = levelOffsets[page.level + 1] + std::min(page.y / 2, parentPages.height - 1) * parentPages.width + std::min(page.x / 2, parentPages.width - 1);
+        }
+    }
+    memset(entries, 0, pages.size() * sizeof(uint32_t));
+    stats.requestedPages = static_cast<uint32_t>(requests.size());
+}
+
+// Slots keep their memory, loading a page unbinds whatever the slot held before and binds it to the new page
+void VirtualTexture::bindPages(const std::vector<std::pair<uint32_t, uint32_t>> &loads) {
+    std::vector<VkSparseImageMemoryBind> binds;
+    auto bind = [this, &binds](uint32_t index, const Allocation *memory) {
+        const Page &page = pages[index];
+        VkExtent2D extent = levelExtent(page.level);
+        VkSparseImageMemoryBind pageBind{};
+        pageBind.subresource = {VK_IMAGE_ASPECT_COLOR_BIT, page.level, 0};
+        pageBind.offset = {static_cast<int32_t>(page.x * info.pageWidth), static_cast<int32_t>(page.y * info.pageHeight), 0};
+        // Pages on the right and bottom edge can be partial
+        pageBind.extent = {std::min(info.pageWidth, extent.width - page.x * info.pageWidth), std::min(info.pageHeight, extent.height - page.y * info.pageHeight), 1};
+        pageBind.memory = memory ? memory->memory : VK_NULL_HANDLE;
+        pageBind.memoryOffset = memory ? memory->offset : 0;
+        binds.push_back(pageBind);
+    };
+    // A page evicted and asked for again can land in another slot while the old one still has it bound, reusing
+    // the old slot must not unbind it from its new memory
+    for (auto &load: loads) {
+        uint32_t oldSlot = pages[load.first].boundSlot;
+        if (oldSlot != NONE)
+            slots[oldSlot].boundPage = NONE;
+    }
+    for (auto &load: loads) {
+        Slot &slot = slots[load.second];
+        if (slot.boundPage != NONE) {
+            bind(slot.boundPage, nullptr);
+            pages[slot.boundPage].boundSlot = NONE;
+        }
+        bind(load.first, &slot.memory);
+        slot.boundPage = load.first;
+        pages[load.first].boundSlot = load.second;
+    }
+
+    VkSparseImageMemoryBindInfo imageBind{};
+    imageBind.image = image;
+    imageBind.bindCount = static_cast<uint32_t>(binds.size());
+    imageBind.pBinds = binds.data();
+    VkBindSparseInfo bindInfo{};
+    bindInfo.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+    bindInfo.imageBindCount = 1;
+    bindInfo.pImageBinds = &imageBind;
+
+    // With a timeline the frame's submit waits for the binds on the GPU, without one the CPU waits here
+    uint64_t signalValue = bindValue + 1;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+    if (bindSemaphore != VK_NULL_HANDLE) {
+        bindInfo.pNext = &timelineInfo;
+        bindInfo.signalSemaphoreCount = 1;
+        bindInfo.pSignalSemaphores = &bindSemaphore;
+    }
+    VkFence fence = bindSemaphore != VK_NULL_HANDLE ? VK_NULL_HANDLE : bindFence;
+    if (vkQueueBindSparse(device.sparsebindingQueue, 1, &bindInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("error binding virtual texture pages");
+    }
+    if (bindSemaphore != VK_NULL_HANDLE) {
+        bindValue = signalValue;
+    } else {
+        vkWaitForFences(device.device, 1, &bindFence, VK_TRUE, UINT64_MAX);
+        vkResetFences(device.device, 1, &bindFence);
+    }
+}
+
+// Calls the loader for a page into texels + bufferOffset and returns the copy that puts it in place
+VkBufferImageCopy VirtualTexture::loadPage(uint32_t index, uint32_t slot, uint8_t *texels, VkDeviceSize bufferOffset) {
+    const Page &page = pages[index];
+    VkBufferImageCopy region{};
+    region.bufferOffset = bufferOffset;
+    if (sparse) {
+        VkExtent2D extent = levelExtent(page.level);
+        VkOffset2D origin = {static_cast<int32_t>(page.x * info.pageWidth), static_cast<int32_t>(page.y * info.pageHeight)};
+        VkExtent2D pageExtent = {std::min(info.pageWidth, extent.width - origin.x), std::min(info.pageHeight, extent.height - origin.y)};
+        loader(page.level, origin, pageExtent, texels + bufferOffset);
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, page.level, 0, 1};
+        region.imageOffset = {origin.x, origin.y, 0};
+        region.imageExtent = {pageExtent.width, pageExtent.height, 1};
+    } else {
+        uint32_t slotSize = info.pageWidth + 2 * FALLBACK_PAGE_BORDER;
+        VkOffset2D origin = {static_cast<int32_t>(page.x * info.pageWidth) - static_cast<int32_t>(FALLBACK_PAGE_BORDER),
+            static_cast<int32_t>(page.y * info.pageHeight) - static_cast<int32_t>(FALLBACK_PAGE_BORDER)};
+        loader(page.level, origin, {slotSize, slotSize}, texels + bufferOffset);
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageOffset = {static_cast<int32_t>(slot % info.atlasPagesX * slotSize), static_cast<int32_t>(slot / info.atlasPagesX * slotSize), 0};
+        region.imageExtent = {slotSize, slotSize, 1};
+    }
+    return region;
+}
+
+VkExtent2D VirtualTexture::levelExtent(uint32_t level) {
+    return {std::max(info.width >> level, 1u), std::max(info.height >> level, 1u)};
+}
+
+VkBuffer VirtualTexture::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible, Allocation &allocation) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // Feedback is read back every frame, cached memory makes the scan cheap
+    if (hostVisible) {
+        return allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT, allocation);
+    }
+    return allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, allocation);
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "vulkanloader.h"
+#include <functional>
+#include <vector>
+#include "logicaldevice.h"
+#include "memoryallocator.h"
+
+struct VirtualTextureDesc {
+    VkExtent2D extent = {0, 0};
+    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+    uint32_t texelSize = 4;
+    // Physical pages, this is what bounds memory use whatever the virtual size
+    uint32_t poolPages = 1024;
+    uint32_t maxUploadsPerFrame = 32;
+    uint32_t framesInFlight = 2;
+    // Only for the fallback, sparse pages are whatever the format's sparse block is
+    uint32_t fallbackPageSize = 128;
+    // Take the software page table even when sparse residency is there, to test it
+    bool forceFallback = false;
+};
+
+// Matches VirtualTextureInfo in shaders/virtualtexture.glsl, std140 and std430 both work
+struct VirtualTextureInfo {
+    uint32_t width, height, pageWidth, pageHeight;
+    uint32_t atlasPagesX, atlasPagesY, mipLevels, tailLevel;
+    uint32_t border, sparse, padding[2];
+};
+
+struct VirtualTextureStats {
+    uint32_t residentPages = 0;
+    uint32_t requestedPages = 0;   // Asked for by the last feedback and not resident
+    uint32_t uploads = 0;          // In the last Update()
+    uint32_t evictions = 0;        // In the last Update()
+    uint64_t totalUploads = 0;
+    uint64_t totalEvictions = 0;
+};
+
+// Fills extent texels of a mip level starting at origin, rows tightly packed. With the fallback the region reaches
+// past the page by the border and can stick out of the level, clamp to the edge. Called from Update().
+typedef std::function<void(uint32_t level, VkOffset2D origin, VkExtent2D extent, uint8_t *texels)> PageLoader;
+
+// Texture far bigger than the memory it's allowed to use, split in pages that are loaded when shaders ask for them
+// and evicted least recently used first when the pool is full.
+//
+// With sparse residency the image is created sparse and pages are bound and unbound with vkQueueBindSparse on the
+// sparse binding queue, the mip tail stays bound. Without it pages are copied into an atlas image and a page table
+// maps virtual pages to atlas slots. Both keep the page table buffer up to date so shaders can fall back to a coarser
+// resident level, see shaders/virtualtexture.glsl.
+//
+// Every frame: Update() with the frame's command buffer once its fence has been waited on, shaders write the pages
+// they wanted to FeedbackBuffer(frame index), RecordFeedbackBarrier() after the last of them. With sparse residency
+// the frame's submit also waits on BindSemaphore() for BindValue() at the transfer stage. Not thread safe.
+class VirtualTexture {
+    private:
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct Page {
+        uint32_t level;
+        uint32_t x, y;
+        uint32_t slot = NONE;
+        uint64_t lastUsed = 0;
+        uint32_t boundSlot = NONE; // Sparse only, whose memory backs the page, can outlive slot after eviction
+    };
+
+    struct Slot {
+        uint32_t page = NONE;
+        // Evicted pages can still be sampled by frames in flight, the slot is only reused from this frame on
+        uint64_t freeFrom = 0;
+        Allocation memory;         // Sparse only
+        uint32_t boundPage = NONE; // Sparse only, stays bound after eviction until the slot or the page is bound again
+    };
+
+    struct Feedback {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation;
+        VkBuffer upload = VK_NULL_HANDLE;
+        Allocation uploadAllocation;
+    };
+
+    const LogicalDevice &device;
+    MemoryAllocator &allocator;
+    VirtualTextureDesc desc;
+    PageLoader loader;
+    bool sparse;
+    VirtualTextureInfo info{};
+    VkDeviceSize uploadPageSize;
+
+    VkImage image = VK_NULL_HANDLE;
+    Allocation imageAllocation;   // Fallback atlas only
+    Allocation mipTailMemory;     // Sparse only
+    VkImageView view = VK_NULL_HANDLE;
+    VkBuffer pageTable = VK_NULL_HANDLE;
+    Allocation pageTableAllocation;
+    std::vector<Feedback> feedback;
+
+    std::vector<Page> pages;
+    std::vector<uint32_t> levelOffsets;
+    std::vector<VkExtent2D> levelPages;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> pendingSlots;
+    std::vector<uint32_t> requests;
+    VirtualTextureStats stats;
+
+    VkSemaphore bindSemaphore = VK_NULL_HANDLE;
+    uint64_t bindValue = 0;
+    VkFence bindFence = VK_NULL_HANDLE;
+
+    public:
+    VirtualTexture(const LogicalDevice &device, MemoryAllocator &allocator, const VirtualTextureDesc &desc, PageLoader loader);
+    ~VirtualTexture();
+
+    // Outside a render pass, before anything samples the texture
+    void Update(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint64_t frameNumber);
+    void RecordFeedbackBarrier(VkCommandBuffer commandBuffer);
+    // CPU side prefetch, goes through the same feedback as the shaders
+    void Request(uint32_t frameIndex, uint32_t level, uint32_t pageX, uint32_t pageY);
+
+    bool Sparse();
+    VkImage Image();
+    VkImageView ImageView();
+    VkBuffer PageTableBuffer();
+    VkBuffer FeedbackBuffer(uint32_t frameIndex);
+    VkDeviceSize PageCount();
+    // Zero for levels in the mip tail
+    VkExtent2D LevelPages(uint32_t level);
+    const VirtualTextureInfo& Info();
+    const VirtualTextureStats& Stats();
+    // Null without timeline semaphores, Update() waits for the binds itself then
+    VkSemaphore BindSemaphore();
+    uint64_t BindValue();
+
+    private:
+    bool sparseSupported();
+    void createSparseImage();
+    void createAtlas();
+    void createPages();
+    void initialize();
+    void readFeedback(uint32_t frameIndex, uint64_t frameNumber);
+    void bindPages(const std::vector<std::pair<uint32_t, uint32_t>> &loads);
+    VkBufferImageCopy loadPage(uint32_t index, uint32_t slot, uint8_t *texels, VkDeviceSize bufferOffset);
+    VkExtent2D levelExtent(uint32_t level);
+    VkBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible, Allocation &allocation);
+};
@@ -0,0 +1,72 @@
+#include "vulkanloader.h"
+
+#include <mutex>
+#include <stdexcept>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <dlfcn.h>
+#endif
+
+#define VK_DEFINE_FUNCTION(name) PFN_##name name = nullptr;
+VK_EXPORTED_FUNCTIONS(VK_DEFINE_FUNCTION)
+VK_GLOBAL_FUNCTIONS(VK_DEFINE_FUNCTION)
+VK_INSTANCE_FUNCTIONS(VK_DEFINE_FUNCTION)
+VK_DEVICE_FUNCTIONS(VK_DEFINE_FUNCTION)
+#undef VK_DEFINE_FUNCTION
+
+namespace {
+    std::once_flag initialized;
+
+    PFN_vkGetInstanceProcAddr openLoader() {
+    #if defined(_WIN32)
+        HMODULE library = LoadLibraryA("vulkan-1.dll");
+        if (!library)
+            return nullptr;
+        return reinterpret_cast<PFN_vkGetInstanceProcAddr>(GetProcAddress(library, "vkGetInstanceProcAddr"));
+    #else
+        #if defined(__APPLE__)
+            const char *names[] = {"libvulkan.dylib", "libvulkan.1.dylib", "libMoltenVK.dylib"};
+        #else
+            const char *names[] = {"libvulkan.so.1", "libvulkan.so"};
+        #endif
+        // Never closed, the entry points have to stay valid until exit
+        for (const char *name: names) {
+            void *library = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+            if (library)
+                return reinterpret_cast<PFN_vkGetInstanceProcAddr>(dlsym(library, "vkGetInstanceProcAddr"));
+        }
+        return nullptr;
+    #endif
+    }
+}
+
+// Opens the loader library and loads the global functions. Safe to call more than once.
+void VulkanLoader::Initialize() {
+    std::call_once(initialized, [] {
+        vkGetInstanceProcAddr = openLoader();
+        if (!vkGetInstanceProcAddr) {
+            throw std::runtime_error("error loading the Vulkan loader library");
+        }
+
+        #define VK_LOAD_GLOBAL(name) name = reinterpret_cast<PFN_##name>(vkGetInstanceProcAddr(VK_NULL_HANDLE, #name));
+        VK_GLOBAL_FUNCTIONS(VK_LOAD_GLOBAL)
+        #undef VK_LOAD_GLOBAL
+    });
+}
+
+// Device functions are loaded here too, through the loader's trampolines, so they work before LoadDevice is called
+void VulkanLoader::LoadInstance(VkInstance instance) {
+    #define VK_LOAD_INSTANCE(name) name = reinterpret_cast<PFN_##name>(vkGetInstanceProcAddr(instance, #name));
+    VK_INSTANCE_FUNCTIONS(VK_LOAD_INSTANCE)
+    VK_DEVICE_FUNCTIONS(VK_LOAD_INSTANCE)
+    #undef VK_LOAD_INSTANCE
+}
+
+// Points the global device functions at the device's own entry points. Loading a second device replaces the first's.
+void VulkanLoader::LoadDevice(VkDevice device) {
+    #define VK_LOAD_DEVICE(name) name = reinterpret_cast<PFN_##name>(vkGetDeviceProcAddr(device, #name));
+    VK_DEVICE_FUNCTIONS(VK_LOAD_DEVICE)
+    #undef VK_LOAD_DEVICE
+}
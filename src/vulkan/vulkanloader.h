@@ -0,0 +1,25 @@
+#pragma once
+
+// Vulkan is loaded at runtime instead of linked, the headers must not declare the loader's exported prototypes
+#ifndef VK_NO_PROTOTYPES
+    #define VK_NO_PROTOTYPES
+#endif
+#include <vulkan/vulkan.h>
+#include "vulkanfunctions.h"
+
+// Global entry points with the same names as the prototypes, so calling code doesn't change. Device functions are
+// pointed at the device's own entry points once it's created, skipping the loader trampolines. That override is the
+// whole device level dispatch: there is no per device table, so the process can only use one VkDevice at a time.
+#define VK_DECLARE_FUNCTION(name) extern PFN_##name name;
+VK_EXPORTED_FUNCTIONS(VK_DECLARE_FUNCTION)
+VK_GLOBAL_FUNCTIONS(VK_DECLARE_FUNCTION)
+VK_INSTANCE_FUNCTIONS(VK_DECLARE_FUNCTION)
+VK_DEVICE_FUNCTIONS(VK_DECLARE_FUNCTION)
+#undef VK_DECLARE_FUNCTION
+
+class VulkanLoader {
+    public:
+    static void Initialize();
+    static void LoadInstance(VkInstance instance);
+    static void LoadDevice(VkDevice device);
+};
@@ -11,10 +11,16 @@ Window::~Window() {
     std::cout << "Closing window" << std::endl;
 }
 
+// Safe to call more than once, it's split from window creation so startup can time it on its own
+void Window::Init() {
+    if (!glfwInit())
+        throw std::runtime_error("could not initialize glfw");
+}
+
 void Window::createWindow(int width, int height, const char *title) {
-    glfwInit();
+    Init();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
     this->window = glfwCreateWindow(width, height, title, NULL, NULL);
     if (!window) {
         // TODO: return an error value that can be handled by the caller?
@@ -27,6 +33,9 @@ void Window::createWindow(int width, int height, const char *title) {
         glfwTerminate();
         throw std::runtime_error("could not create glfw window");
     }
+
+    glfwSetWindowUserPointer(this->window, this);
+    glfwSetFramebufferSizeCallback(this->window, framebufferSizeCallback);
 }
 
 bool Window::ShouldClose() {
@@ -36,3 +45,35 @@ bool Window::ShouldClose() {
 void Window::PollEvents() {
     glfwPollEvents();
 }
+
+// Blocks until something happens, used while minimized so we don't spin
+void Window::WaitEvents() {
+    glfwWaitEvents();
+}
+
+VkSurfaceKHR Window::CreateSurface(VkInstance instance) {
+    VkSurfaceKHR surface;
+    if (glfwCreateWindowSurface(instance, this->window, nullptr, &surface) != VK_SUCCESS) {
+        throw std::runtime_error("could not create window surface");
+    }
+    return surface;
+}
+
+// Size in pixels, which is not the same as the window size on high DPI screens
+VkExtent2D Window::FramebufferExtent() {
+    int width, height;
+    glfwGetFramebufferSize(this->window, &width, &height);
+    return {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+}
+
+// True once after every framebuffer resize
+bool Window::ConsumeResized() {
+    bool wasResized = this->resized;
+    this->resized = false;
+    return wasResized;
+}
+
+void Window::framebufferSizeCallback(GLFWwindow *window, int, int) {
+    Window *self = static_cast<Window*>(glfwGetWindowUserPointer(window));
+    self->resized = true;
+}
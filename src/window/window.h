@@ -1,17 +1,28 @@
 #pragma once
 
+#ifndef GLFW_INCLUDE_VULKAN
+#define GLFW_INCLUDE_VULKAN
+#endif
 #include <GLFW/glfw3.h>
 
 class Window {
     GLFWwindow *window;
+    bool resized = false;
 
     public:
         Window(int width, int height, const char *title);
         ~Window();
 
+        static void Init();
+
         bool ShouldClose();
         void PollEvents();
+        void WaitEvents();
+        VkSurfaceKHR CreateSurface(VkInstance instance);
+        VkExtent2D FramebufferExtent();
+        bool ConsumeResized();
 
     private:
         void createWindow(int width, int height, const char *title);
+        static void framebufferSizeCallback(GLFWwindow *window, int width, int height);
 };